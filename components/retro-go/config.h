@@ -51,6 +51,20 @@
 #define RG_BUILD_USER "ducalex"
 #endif
 
+// Rewind keeps a snapshot every RG_REWIND_INTERVAL frames in a RG_REWIND_BUDGET bytes arena.
+// Holding RG_REWIND_BTN steps back one snapshot every few frames.
+#ifndef RG_REWIND_BUDGET
+#define RG_REWIND_BUDGET (512 * 1024)
+#endif
+
+#ifndef RG_REWIND_INTERVAL
+#define RG_REWIND_INTERVAL 10
+#endif
+
+#ifndef RG_REWIND_BTN
+#define RG_REWIND_BTN (RG_KEY_SELECT | RG_KEY_LEFT)
+#endif
+
 #ifndef RG_RECOVERY_BTN
 #define RG_RECOVERY_BTN RG_KEY_ANY
 #endif
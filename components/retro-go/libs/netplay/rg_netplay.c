@@ -1,14 +1,24 @@
 #ifdef RG_ENABLE_NETPLAY
 
+#ifdef RG_TARGET_SDL2
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <semaphore.h>
+#include <time.h>
+#else
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <lwip/ip_addr.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
 #include <esp_system.h>
 #include <esp_event.h>
 #include <esp_wifi.h>
 #include <esp_log.h>
+#endif
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <assert.h>
 #include <netdb.h>
@@ -16,7 +26,7 @@
 #include "rg_system.h"
 #include "rg_netplay.h"
 
-#define NETPLAY_VERSION 0x01
+#define NETPLAY_VERSION 0x02
 #define MAX_PLAYERS 8
 
 #define BROADCAST (inet_addr(WIFI_BROADCAST_ADDR))
@@ -30,20 +40,101 @@
 // Test to skip the network task and semaphores
 #define NETPLAY_SYNCHRONOUS_TEST
 
+// How long rg_netplay_sync() waits for the peer before giving up
+#define NETPLAY_SYNC_TIMEOUT 5000000
+
+// Rollback mode keeps a snapshot for each of the last ROLLBACK_FRAMES frames, which is
+// also how far ahead of the remote player's confirmed input we are allowed to run.
+#define ROLLBACK_FRAMES 8
+#define ROLLBACK_HISTORY (ROLLBACK_FRAMES * 2)
+
+// In lockstep mode the host repeats its request until the guest acknowledges it
+#define LOCKSTEP_RESEND 30000
+
+// Both players exchange a CRC of their state every HASH_INTERVAL frames to detect desyncs
+#define HASH_INTERVAL 60
+#define HASH_HISTORY 4
+
+// A transport moves whole packets between players. `dest` is a player id, or a transport
+// specific address when >= MAX_PLAYERS. recv() returns the length of the packet, 0 on
+// timeout or < 0 on error. A negative timeout waits forever, 0 doesn't wait at all.
+typedef struct
+{
+    const char *name;
+    void (*init)(void);
+    bool (*open)(netplay_mode_t mode);
+    void (*close)(void);
+    bool (*send)(uint32_t dest, const void *data, size_t len);
+    int (*recv)(void *buffer, size_t len, int timeout_ms);
+} netplay_transport_t;
+
 static netplay_status_t netplay_status = NETPLAY_STATUS_NOT_INIT;
 static netplay_mode_t netplay_mode = NETPLAY_MODE_NONE;
 static netplay_callback_t netplay_callback = NULL;
+#ifdef RG_TARGET_SDL2
+static sem_t netplay_sync;
+#else
 static SemaphoreHandle_t netplay_sync;
+#endif
 // static bool netplay_available = false;
 
 static netplay_player_t players[MAX_PLAYERS];
 static netplay_player_t *local_player;
 static netplay_player_t *remote_player; // This only works in 2 player mode
 
-static tcpip_adapter_ip_info_t local_if;
-static wifi_config_t wifi_config;
+static netplay_replay_handler_t replay_handler;
+static bool link_mode;
 
-static int rx_sock, tx_sock;
+static struct
+{
+    uint32_t frame;          // Next frame to be emulated
+    uint32_t confirmed;      // Number of remote inputs received so far
+    uint32_t peer_confirmed; // Number of our inputs the remote player has received
+    uint32_t replay_from;    // First frame that was emulated with a wrong prediction
+    uint8_t data_len;
+    uint8_t local[ROLLBACK_HISTORY][16];
+    uint8_t remote[ROLLBACK_HISTORY][16];
+    uint8_t *states[ROLLBACK_FRAMES];
+    uint32_t state_frame[ROLLBACK_FRAMES];
+    size_t state_size[ROLLBACK_FRAMES];
+    size_t capacity;
+    uint32_t rollbacks;
+    uint32_t replayed;
+} rollback;
+
+static struct
+{
+    uint32_t frame;          // Next frame to be emulated
+    uint8_t ack[NETPLAY_SYNC_MAX_DATA]; // Data of the last SYNC_ACK we sent, in case it was lost
+    uint8_t ack_len;
+} lockstep;
+
+static struct
+{
+    uint32_t next;           // Next frame to hash (rollback mode)
+    netplay_hash_t local[HASH_HISTORY];
+    netplay_hash_t remote[HASH_HISTORY];
+    uint32_t checked;
+    uint32_t desyncs;
+} hashes;
+
+// Artificial network conditions applied to the packets we receive once connected, to see how
+// the sync modes cope. Delayed packets wait in a queue that is read whenever we wait for a packet.
+static struct
+{
+    int latency;             // One-way delay in ms
+    int jitter;              // Random extra delay in ms, packets may arrive out of order
+    int loss;                // Percentage of packets dropped
+    struct
+    {
+        int64_t due;
+        int len;
+        netplay_packet_t packet;
+    } queue[32];
+    int count;
+} impair;
+
+static FILE *stats_fp; // Per-frame sync statistics, in CSV
 
 
 static void dummy_netplay_callback(netplay_event_t event, void *arg)
@@ -52,116 +143,281 @@ static void dummy_netplay_callback(netplay_event_t event, void *arg)
 }
 
 
-static void network_cleanup()
+static void rollback_reset(void)
 {
-    if (rx_sock) close(rx_sock);
-    if (tx_sock) close(tx_sock);
+    rollback.frame = 0;
+    rollback.confirmed = 0;
+    rollback.peer_confirmed = 0;
+    rollback.replay_from = UINT32_MAX;
+    rollback.rollbacks = rollback.replayed = 0;
+    memset(rollback.local, 0, sizeof(rollback.local));
+    memset(rollback.remote, 0, sizeof(rollback.remote));
+    memset(rollback.state_frame, 0xFF, sizeof(rollback.state_frame));
+}
 
-    rx_sock = tx_sock = 0;
-    memset(&local_if, 0, sizeof(local_if));
+
+static void rollback_free(void)
+{
+    for (int i = 0; i < ROLLBACK_FRAMES; i++)
+    {
+        free(rollback.states[i]);
+        rollback.states[i] = NULL;
+    }
+    rollback.capacity = 0;
 }
 
 
-static void network_setup(tcpip_adapter_if_t tcpip_if)
+static void sync_reset(void)
 {
-    tcpip_adapter_get_ip_info(tcpip_if, &local_if);
+    rollback_reset();
+    memset(&lockstep, 0, sizeof(lockstep));
+    memset(&hashes, 0, sizeof(hashes));
+    memset(hashes.local, 0xFF, sizeof(hashes.local));
+    memset(hashes.remote, 0xFF, sizeof(hashes.remote));
+}
 
-    int player_id = ((local_if.ip.addr >> 24) & 0xF) - 1;
-    struct sockaddr_in rx_addr;
-    int bc_val = 1;
 
+static void set_status(netplay_status_t status)
+{
+    bool changed = status != netplay_status;
+
+    if (changed && status == NETPLAY_STATUS_CONNECTED)
+    {
+        sync_reset();
+    }
+
+    netplay_status = status;
+
+    if (changed)
+    {
+        (*netplay_callback)(RG_EVENT_TYPE_NETPLAY|NETPLAY_EVENT_STATUS_CHANGED, &netplay_status);
+    }
+}
+
+
+static void send_packet(uint32_t dest, uint8_t cmd, uint8_t arg, const void *data, uint8_t data_len);
+
+
+static void player_setup(int player_id, uint32_t ip_addr)
+{
     local_player = &players[player_id];
     local_player->id = player_id;
     local_player->version = NETPLAY_VERSION;
-    local_player->game_id = rg_system_get_app()->romCRC32;
-    local_player->ip_addr = local_if.ip.addr;
+    local_player->game_id = rg_system_get_rom_crc32();
+    local_player->ip_addr = ip_addr;
 
     RG_LOGI("netplay: Local player ID: %d\n", local_player->id);
+}
 
-    rx_addr.sin_family = AF_INET;
-    rx_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    rx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
 
-    rx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    tx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    assert(rx_sock > 0 && tx_sock > 0);
+// Wakes up rg_netplay_sync() in lockstep mode, it behaves like a binary semaphore on both targets
+static void sync_signal(void)
+{
+#ifdef RG_TARGET_SDL2
+    int value;
+    if (sem_getvalue(&netplay_sync, &value) == 0 && value < 1)
+        sem_post(&netplay_sync);
+#else
+    xSemaphoreGive(netplay_sync);
+#endif
+}
 
-    setsockopt(rx_sock, SOL_SOCKET, SO_BROADCAST, &bc_val, sizeof bc_val);
-    setsockopt(tx_sock, SOL_SOCKET, SO_BROADCAST, &bc_val, sizeof bc_val);
 
-    if (bind(rx_sock, (struct sockaddr *)&rx_addr, sizeof rx_addr) < 0)
+#ifndef NETPLAY_SYNCHRONOUS_TEST
+static bool sync_wait(int timeout_ms)
+{
+#ifdef RG_TARGET_SDL2
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
     {
-        RG_PANIC("netplay: bind() failed");
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
     }
+    return sem_timedwait(&netplay_sync, &deadline) == 0;
+#else
+    return xSemaphoreTake(netplay_sync, pdMS_TO_TICKS(timeout_ms)) == pdPASS;
+#endif
 }
+#endif
 
 
-static void set_status(netplay_status_t status)
+static int socket_recv(int sock, void *buffer, size_t len, struct sockaddr_in *from, int timeout_ms)
 {
-    bool changed = status != netplay_status;
+    socklen_t from_len = sizeof(*from);
 
-    netplay_status = status;
-
-    if (changed)
+    if (timeout_ms >= 0)
     {
-        (*netplay_callback)(RG_EVENT_TYPE_NETPLAY|NETPLAY_EVENT_STATUS_CHANGED, &netplay_status);
+        struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        fd_set read_fd_set;
+
+        FD_ZERO(&read_fd_set);
+        FD_SET(sock, &read_fd_set);
+
+        int sel = select(sock + 1, &read_fd_set, NULL, NULL, &timeout);
+        if (sel <= 0)
+        {
+            if (sel < 0)
+                RG_LOGE("netplay: select() failed\n");
+            return sel;
+        }
     }
+
+    return recvfrom(sock, buffer, len, 0, (struct sockaddr *)from, from ? &from_len : NULL);
 }
 
 
-static inline bool receive_packet(netplay_packet_t *packet, int timeout)
-{
-    fd_set read_fd_set;
+#ifdef RG_TARGET_SDL2
+// UDP over any network, meant to run two instances on the same computer. The host listens on
+// RG_NETPLAY_PORT and the guest introduces itself to RG_NETPLAY_HOST, see NETPLAY.md.
+static struct sockaddr_in udp_peers[MAX_PLAYERS];
+static int udp_sock = -1;
 
-    FD_ZERO(&read_fd_set);
-    FD_SET(rx_sock, &read_fd_set);
 
-    int sel = select(FD_SETSIZE, &read_fd_set, NULL, NULL, NULL);
+static void udp_init(void)
+{
+    const char *stats = getenv("RG_NETPLAY_STATS");
 
-    if (sel > 0)
-    {
-        return recv(rx_sock, &packet, sizeof packet, 0) >= 0;
-    }
-    else if (sel < 0)
+    impair.latency = RG_MAX(atoi(getenv("RG_NETPLAY_LATENCY") ?: "0"), 0);
+    impair.jitter = RG_MAX(atoi(getenv("RG_NETPLAY_JITTER") ?: "0"), 0);
+    impair.loss = RG_MAX(atoi(getenv("RG_NETPLAY_LOSS") ?: "0"), 0);
+
+    if (stats && stats[0])
     {
-        RG_LOGE("netplay: select() failed\n");
+        if ((stats_fp = fopen(stats, "w")))
+            fprintf(stats_fp, "frame,sync_us,lead,rollbacks,replayed,desyncs\n");
+        else
+            RG_LOGE("netplay: Can't open '%s'\n", stats);
     }
 
-    return false;
+    RG_LOGI("netplay: latency=%dms jitter=%dms loss=%d%% stats='%s'\n",
+        impair.latency, impair.jitter, impair.loss, stats ?: "");
 }
 
 
-static inline void send_packet(uint32_t dest, uint8_t cmd, uint8_t arg, void *data, uint8_t data_len)
+static void udp_close(void)
 {
-    netplay_packet_t packet = {local_player->id, cmd, arg, data_len, {}};
-    size_t len = sizeof(packet) - sizeof(packet.data) + data_len;
-    struct sockaddr_in tx_addr;
+    if (udp_sock >= 0)
+        close(udp_sock);
+    udp_sock = -1;
+}
 
-    if (data_len > 0)
+
+static bool udp_open(netplay_mode_t mode)
+{
+    const char *host = getenv("RG_NETPLAY_HOST") ?: "127.0.0.1";
+    const char *port = getenv("RG_NETPLAY_PORT");
+    struct sockaddr_in addr = {0};
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port ? atoi(port) : WIFI_NETPLAY_PORT);
+
+    memset(udp_peers, 0, sizeof(udp_peers));
+    udp_peers[0] = addr;
+    udp_peers[0].sin_addr.s_addr = inet_addr(host);
+
+    // Only the host needs a known port, the guest's address is learned from its packets
+    if (mode == NETPLAY_MODE_GUEST)
+        addr.sin_port = 0;
+
+    udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udp_sock < 0 || bind(udp_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
     {
-        memcpy(&packet.data, data, data_len);
+        RG_LOGE("netplay: bind() failed\n");
+        udp_close();
+        return false;
     }
 
-    if (dest < MAX_PLAYERS)
+    if (mode == NETPLAY_MODE_HOST)
     {
-        tx_addr.sin_family = AF_INET;
-        tx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
-        tx_addr.sin_addr.s_addr = players[dest].ip_addr;
+        player_setup(0, udp_peers[0].sin_addr.s_addr);
+        set_status(NETPLAY_STATUS_LISTENING);
     }
     else
     {
-        tx_addr.sin_family = AF_INET;
-        tx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
-        tx_addr.sin_addr.s_addr = dest;
+        player_setup(1, 0);
+        set_status(NETPLAY_STATUS_HANDSHAKE);
+        send_packet(0, NETPLAY_PACKET_INFO, 0, local_player, sizeof(netplay_player_t));
     }
 
-    if (sendto(tx_sock, &packet, len, 0, (struct sockaddr*)&tx_addr, sizeof tx_addr) <= 0)
+    return true;
+}
+
+
+static bool udp_send(uint32_t dest, const void *data, size_t len)
+{
+    if (dest >= MAX_PLAYERS || !udp_peers[dest].sin_port)
+        return false;
+
+    return sendto(udp_sock, data, len, 0, (struct sockaddr *)&udp_peers[dest], sizeof(udp_peers[dest])) > 0;
+}
+
+
+static int udp_recv(void *buffer, size_t len, int timeout_ms)
+{
+    struct sockaddr_in from;
+    int ret = socket_recv(udp_sock, buffer, len, &from, timeout_ms);
+
+    // The first byte of every packet is the sender's player id, remember where to reach it
+    if (ret > 0 && *(uint8_t *)buffer < MAX_PLAYERS)
+        udp_peers[*(uint8_t *)buffer] = from;
+
+    return ret;
+}
+
+
+static const netplay_transport_t transport = {
+    "udp", &udp_init, &udp_open, &udp_close, &udp_send, &udp_recv,
+};
+
+#else
+
+static tcpip_adapter_ip_info_t local_if;
+static wifi_config_t wifi_config;
+static int rx_sock, tx_sock;
+
+
+static void network_cleanup()
+{
+    if (rx_sock) close(rx_sock);
+    if (tx_sock) close(tx_sock);
+
+    rx_sock = tx_sock = 0;
+    memset(&local_if, 0, sizeof(local_if));
+}
+
+
+static void network_setup(tcpip_adapter_if_t tcpip_if)
+{
+    tcpip_adapter_get_ip_info(tcpip_if, &local_if);
+
+    int player_id = ((local_if.ip.addr >> 24) & 0xF) - 1;
+    struct sockaddr_in rx_addr;
+    int bc_val = 1;
+
+    player_setup(player_id, local_if.ip.addr);
+
+    rx_addr.sin_family = AF_INET;
+    rx_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    rx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
+
+    rx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    tx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    assert(rx_sock > 0 && tx_sock > 0);
+
+    setsockopt(rx_sock, SOL_SOCKET, SO_BROADCAST, &bc_val, sizeof bc_val);
+    setsockopt(tx_sock, SOL_SOCKET, SO_BROADCAST, &bc_val, sizeof bc_val);
+
+    if (bind(rx_sock, (struct sockaddr *)&rx_addr, sizeof rx_addr) < 0)
     {
-        RG_LOGE("netplay: sendto() failed\n");
-        // stop network
+        RG_PANIC("netplay: bind() failed");
     }
 }
 
+
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT)
@@ -195,17 +451,288 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
         {
             ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
 
-            send_packet(event->ip_info.ip.addr, NETPLAY_PACKET_INFO,
-                                       0, (void*)local_player, sizeof(netplay_player_t));
-            set_status(NETPLAY_STATUS_HANDSHAKE);
-        }
-    }
+            send_packet(event->ip_info.ip.addr, NETPLAY_PACKET_INFO,
+                                       0, (void*)local_player, sizeof(netplay_player_t));
+            set_status(NETPLAY_STATUS_HANDSHAKE);
+        }
+    }
+}
+
+
+static void wifi_init(void)
+{
+    tcpip_adapter_init();
+
+    esp_event_loop_create_default();
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE)); // Improves latency a lot
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+}
+
+
+static bool wifi_open(netplay_mode_t mode)
+{
+    esp_err_t ret = ESP_FAIL;
+
+    if (mode == NETPLAY_MODE_GUEST)
+    {
+        strncpy((char*)wifi_config.sta.ssid, WIFI_SSID, 32);
+        wifi_config.sta.channel = WIFI_CHANNEL;
+        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+        ESP_ERROR_CHECK(esp_wifi_start());
+        ret = esp_wifi_connect();
+    }
+    else
+    {
+        strncpy((char*)wifi_config.ap.ssid, WIFI_SSID, 32);
+        wifi_config.ap.authmode = WIFI_AUTH_OPEN;
+        wifi_config.ap.channel = WIFI_CHANNEL;
+        wifi_config.ap.max_connection = MAX_PLAYERS - 1;
+        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
+        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
+        ret = esp_wifi_start();
+    }
+
+    return ret == ESP_OK;
+}
+
+
+static void wifi_close(void)
+{
+    network_cleanup();
+    esp_wifi_stop();
+}
+
+
+static bool wifi_send(uint32_t dest, const void *data, size_t len)
+{
+    struct sockaddr_in tx_addr;
+
+    tx_addr.sin_family = AF_INET;
+    tx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
+    tx_addr.sin_addr.s_addr = dest < MAX_PLAYERS ? players[dest].ip_addr : dest;
+
+    return sendto(tx_sock, data, len, 0, (struct sockaddr*)&tx_addr, sizeof tx_addr) > 0;
+}
+
+
+static int wifi_recv(void *buffer, size_t len, int timeout_ms)
+{
+    return socket_recv(rx_sock, buffer, len, NULL, timeout_ms);
+}
+
+
+static const netplay_transport_t transport = {
+    "wifi", &wifi_init, &wifi_open, &wifi_close, &wifi_send, &wifi_recv,
+};
+#endif
+
+
+// Returns the length of the oldest delayed packet that is due, or 0 and sets *wait to the
+// time in ms until the next one (-1 if there is none)
+static int impair_recv(netplay_packet_t *packet, int *wait)
+{
+    int64_t now = rg_system_timer();
+    int next = -1, len;
+
+    for (int i = 0; i < impair.count; i++)
+    {
+        if (next < 0 || impair.queue[i].due < impair.queue[next].due)
+            next = i;
+    }
+
+    *wait = -1;
+
+    if (next < 0)
+        return 0;
+
+    if (impair.queue[next].due > now)
+    {
+        *wait = (impair.queue[next].due - now + 999) / 1000;
+        return 0;
+    }
+
+    len = impair.queue[next].len;
+    memcpy(packet, &impair.queue[next].packet, len);
+    memmove(&impair.queue[next], &impair.queue[next + 1], (--impair.count - next) * sizeof(impair.queue[0]));
+
+    return len;
+}
+
+
+// Returns false if the packet was dropped or delayed
+static bool impair_filter(const netplay_packet_t *packet, int len)
+{
+    int delay = impair.latency + (impair.jitter ? rand() % (impair.jitter + 1) : 0);
+
+    if (netplay_status != NETPLAY_STATUS_CONNECTED || !(impair.latency || impair.jitter || impair.loss))
+        return true;
+
+    if (impair.loss && rand() % 100 < impair.loss)
+        return false;
+
+    if (delay == 0 || impair.count == RG_COUNT(impair.queue))
+        return true;
+
+    impair.queue[impair.count].due = rg_system_timer() + delay * 1000;
+    impair.queue[impair.count].len = len;
+    memcpy(&impair.queue[impair.count].packet, packet, len);
+    impair.count++;
+
+    return false;
+}
+
+
+static bool receive_packet(netplay_packet_t *packet, int timeout_ms)
+{
+    int64_t deadline = rg_system_timer() + (int64_t)timeout_ms * 1000;
+
+    while (true)
+    {
+        int wait = timeout_ms < 0 ? -1 : RG_MAX((int)((deadline - rg_system_timer()) / 1000), 0);
+        int next;
+
+        // Delayed packets were checked when they arrived
+        if (impair_recv(packet, &next) > 0)
+            return true;
+
+        if (next >= 0 && (wait < 0 || next < wait))
+            wait = next;
+
+        int len = transport.recv(packet, sizeof(*packet), wait);
+        int expected_len = sizeof(*packet) - sizeof(packet->data) + packet->data_len;
+
+        if (len < 0)
+        {
+            RG_LOGE("netplay: Socket disconnected! (recv() failed)\n");
+            return false;
+        }
+        else if (len == 0)
+        {
+            // Timed out, or a delayed packet is due
+        }
+        else if (expected_len != len)
+        {
+            RG_LOGE("netplay: Packet size mismatch. expected=%d received=%d\n", expected_len, len);
+        }
+        else if (packet->player_id >= MAX_PLAYERS)
+        {
+            RG_LOGE("netplay: Packet invalid player id: %d\n", packet->player_id);
+        }
+        else if (packet->player_id == local_player->id)
+        {
+            RG_LOGE("netplay: Received echo!\n");
+        }
+        else if (impair_filter(packet, len))
+        {
+            players[packet->player_id].last_contact = rg_system_timer();
+            return true;
+        }
+
+        if (timeout_ms >= 0 && rg_system_timer() >= deadline)
+            return false;
+    }
+}
+
+
+static void send_packet(uint32_t dest, uint8_t cmd, uint8_t arg, const void *data, uint8_t data_len)
+{
+    netplay_packet_t packet = {local_player->id, cmd, arg, data_len, {}};
+    size_t len = sizeof(packet) - sizeof(packet.data) + data_len;
+
+    if (data_len > 0)
+    {
+        memcpy(&packet.data, data, data_len);
+    }
+
+    if (!transport.send(dest, &packet, len))
+    {
+        RG_LOGE("netplay: sendto() failed\n");
+        // stop network
+    }
+}
+
+
+static void hash_compare(const netplay_hash_t *hash, const netplay_hash_t *list)
+{
+    for (int i = 0; i < HASH_HISTORY; i++)
+    {
+        if (list[i].frame != hash->frame)
+            continue;
+
+        hashes.checked++;
+
+        if (list[i].crc != hash->crc)
+        {
+            RG_LOGE("netplay: Desync detected at frame %u!\n", (unsigned)hash->frame);
+            hashes.desyncs++;
+        }
+        break;
+    }
+}
+
+
+static void hash_local(uint32_t frame, uint32_t crc)
+{
+    netplay_hash_t hash = {frame, crc};
+
+    hashes.local[(frame / HASH_INTERVAL) % HASH_HISTORY] = hash;
+    send_packet(remote_player->id, NETPLAY_PACKET_HASH, 0, &hash, sizeof(hash));
+    hash_compare(&hash, hashes.remote);
+}
+
+
+static void hash_remote(const netplay_packet_t *packet)
+{
+    const netplay_hash_t *hash = (const netplay_hash_t *)packet->data;
+
+    if (packet->data_len != sizeof(*hash) || hash->frame % HASH_INTERVAL)
+        return;
+
+    hashes.remote[(hash->frame / HASH_INTERVAL) % HASH_HISTORY] = *hash;
+    hash_compare(hash, hashes.local);
+}
+
+
+static bool hash_state(uint32_t *crc)
+{
+    char *buffer = NULL;
+    size_t size = 0;
+
+    // The save handlers may seek back to patch headers, so we can't just checksum as it is written
+    FILE *fp = open_memstream(&buffer, &size);
+    bool success = fp && rg_system_get_app()->handlers.saveStateStream(fp);
+    if (fp)
+        fclose(fp);
+
+    if (success)
+        *crc = rg_crc32(0, (const uint8_t *)buffer, size);
+
+    free(buffer);
+    return success;
+}
+
+
+// A guest still introducing itself after we connected lost our INFO reply or READY. The task
+// doesn't read the socket anymore at this point, so the sync loops call this instead.
+static void handshake_resend(const netplay_packet_t *packet)
+{
+    if (netplay_mode != NETPLAY_MODE_HOST || packet->arg != 0 || !remote_player
+        || packet->player_id != remote_player->id)
+        return;
+
+    send_packet(remote_player->id, NETPLAY_PACKET_INFO, 1, (void*)local_player, sizeof(netplay_player_t));
+    send_packet(remote_player->id, NETPLAY_PACKET_READY, 0, 0, 0);
 }
 
 
 static void netplay_task()
 {
-    int len, expected_len;
     netplay_packet_t packet;
 
     RG_LOGI("netplay: Task started!\n");
@@ -215,51 +742,45 @@ static void netplay_task()
         memset(&packet, 0, sizeof(netplay_packet_t));
 
     #ifdef NETPLAY_SYNCHRONOUS_TEST
-        if (!rx_sock || netplay_status != NETPLAY_STATUS_HANDSHAKE)
+        if (!local_player || netplay_status < NETPLAY_STATUS_LISTENING || netplay_status > NETPLAY_STATUS_HANDSHAKE)
     #else
-        if (!rx_sock || netplay_status < NETPLAY_STATUS_HANDSHAKE)
+        // In rollback mode rg_netplay_sync() reads the socket itself once connected
+        if (!local_player || netplay_status < NETPLAY_STATUS_LISTENING
+            || (replay_handler && netplay_status == NETPLAY_STATUS_CONNECTED))
     #endif
         {
             rg_task_delay(100);
             continue;
         }
 
-        // if ((len = recv(client_sock, &packet, sizeof packet, 0)) <= 0)
-        if ((len = recvfrom(rx_sock, &packet, sizeof packet, 0, NULL, 0)) <= 0)
+        if (!receive_packet(&packet, 500))
         {
-            RG_LOGE("netplay: Socket disconnected! (recv() failed)\n");
-            rg_task_delay(100);
+            // Keep introducing ourselves until the host answers, the first packet may have been lost
+            if (netplay_mode == NETPLAY_MODE_GUEST && netplay_status == NETPLAY_STATUS_HANDSHAKE)
+                send_packet(0, NETPLAY_PACKET_INFO, 0, local_player, sizeof(netplay_player_t));
             continue;
         }
 
-        expected_len = sizeof(packet) - sizeof(packet.data) + packet.data_len;
+        netplay_player_t *packet_from = &players[packet.player_id];
 
-        if (expected_len != len)
-        {
-            RG_LOGE("netplay: Packet size mismatch. expected=%d received=%d\n", expected_len, len);
-            continue;
-        }
-        else if (packet.player_id >= MAX_PLAYERS)
-        {
-            RG_LOGE("netplay: Packet invalid player id: %d\n", packet.player_id);
-            continue;
-        }
-        else if (packet.player_id == local_player->id)
+        // The host only sends these once it's connected, so it did send READY and we lost it
+        if (netplay_mode == NETPLAY_MODE_GUEST && netplay_status == NETPLAY_STATUS_HANDSHAKE
+            && (packet.cmd == NETPLAY_PACKET_SYNC_REQ || packet.cmd == NETPLAY_PACKET_INPUT
+                || packet.cmd == NETPLAY_PACKET_HASH))
         {
-            RG_LOGE("netplay: Received echo!\n");
-            continue;
+            if (remote_player)
+                set_status(NETPLAY_STATUS_CONNECTED);
+            else // Its INFO was lost too, it will answer again
+                send_packet(0, NETPLAY_PACKET_INFO, 0, local_player, sizeof(netplay_player_t));
         }
 
-        netplay_player_t *packet_from = &players[packet.player_id];
-        packet_from->last_contact = rg_system_timer();
-
         switch (packet.cmd)
         {
             case NETPLAY_PACKET_INFO: // HOST <-> GUEST
                 if (packet.data_len != sizeof(netplay_player_t))
                 {
                     RG_LOGE("netplay: Player struct size mismatch. expected=%d received=%d\n",
-                            sizeof(netplay_player_t), packet.data_len);
+                            (int)sizeof(netplay_player_t), packet.data_len);
                     break;
                 }
 
@@ -275,13 +796,16 @@ static void netplay_task()
                     break;
                 }
 
+                // arg is 0 when the peer introduces itself and 1 when it replies to us
                 if (netplay_mode == NETPLAY_MODE_HOST)
                 {
+                    if (packet.arg == 0)
+                        send_packet(packet_from->id, NETPLAY_PACKET_INFO, 1, (void*)local_player, sizeof(netplay_player_t));
                     // Check if all players are ready (at the moment only 1, no need to check) then send NETPLAY_PACKET_READY
                     send_packet(packet_from->id, NETPLAY_PACKET_READY, 0, 0, 0);
                     set_status(NETPLAY_STATUS_CONNECTED);
                 }
-                else
+                else if (packet.arg == 0)
                 {
                     send_packet(packet_from->id, NETPLAY_PACKET_INFO, 1, (void*)local_player, sizeof(netplay_player_t));
                 }
@@ -296,12 +820,13 @@ static void netplay_task()
                 // }
 
                 // memcpy(&players, packet.data, packet.data_len);
-                set_status(NETPLAY_STATUS_CONNECTED);
+                if (remote_player)
+                    set_status(NETPLAY_STATUS_CONNECTED);
                 break;
 
             case NETPLAY_PACKET_SYNC_REQ: // HOST -> GUEST
                 memcpy(&packet_from->sync_data, packet.data, packet.data_len);
-                xSemaphoreGive(netplay_sync);
+                sync_signal();
                 break;
 
             case NETPLAY_PACKET_SYNC_ACK: // GUEST -> HOST
@@ -309,11 +834,21 @@ static void netplay_task()
 
                 // if received all players ACK then:
                 send_packet(remote_player->id, NETPLAY_PACKET_SYNC_DONE, packet.arg, 0, 0);
-                xSemaphoreGive(netplay_sync);
+                sync_signal();
                 break;
 
             case NETPLAY_PACKET_SYNC_DONE: // HOST -> GUEST
-                xSemaphoreGive(netplay_sync);
+                sync_signal();
+                break;
+
+            case NETPLAY_PACKET_HASH: // HOST <-> GUEST
+                // Our own hashes only start once connected
+                if (netplay_status == NETPLAY_STATUS_CONNECTED)
+                    hash_remote(&packet);
+                break;
+
+            case NETPLAY_PACKET_INPUT: // HOST <-> GUEST
+                // Read by rollback_receive() once connected
                 break;
 
             default:
@@ -334,18 +869,13 @@ static void netplay_init()
         netplay_status = NETPLAY_STATUS_STOPPED;
         netplay_callback = netplay_callback ?: dummy_netplay_callback;
         netplay_mode = NETPLAY_MODE_NONE;
+    #ifdef RG_TARGET_SDL2
+        sem_init(&netplay_sync, 0, 1);
+    #else
         netplay_sync = xSemaphoreCreateMutex();
+    #endif
 
-        tcpip_adapter_init();
-
-        esp_event_loop_create_default();
-
-        wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-        ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-        ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
-        ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
-        ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE)); // Improves latency a lot
-        ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+        transport.init();
 
         rg_task_create("rg_netplay", &netplay_task, NULL, 4096, RG_TASK_PRIORITY - 2, 1);
     }
@@ -357,6 +887,15 @@ void rg_netplay_init(netplay_callback_t callback)
     RG_LOGI("%s called.\n", __func__);
 
     netplay_callback = callback;
+
+#ifdef RG_TARGET_SDL2
+    // Lets two instances connect without going through the menu
+    const char *mode = getenv("RG_NETPLAY_MODE");
+    if (mode && strcmp(mode, "host") == 0)
+        rg_netplay_start(NETPLAY_MODE_HOST);
+    else if (mode && strcmp(mode, "guest") == 0)
+        rg_netplay_start(NETPLAY_MODE_GUEST);
+#endif
 }
 
 
@@ -439,8 +978,6 @@ bool rg_netplay_start(netplay_mode_t mode)
 {
     RG_LOGI("%s called.\n", __func__);
 
-    esp_err_t ret = ESP_FAIL;
-
     if (netplay_status == NETPLAY_STATUS_NOT_INIT)
     {
         netplay_init();
@@ -456,35 +993,26 @@ bool rg_netplay_start(netplay_mode_t mode)
 
     if (mode == NETPLAY_MODE_GUEST)
     {
-        RG_LOGI("netplay: Starting in guest mode.\n");
-
-        strncpy((char*)wifi_config.sta.ssid, WIFI_SSID, 32);
-        wifi_config.sta.channel = WIFI_CHANNEL;
-        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
-        ESP_ERROR_CHECK(esp_wifi_start());
-        ret = esp_wifi_connect();
-        netplay_mode = NETPLAY_MODE_GUEST;
+        RG_LOGI("netplay: Starting in guest mode (%s).\n", transport.name);
     }
     else if (mode == NETPLAY_MODE_HOST)
     {
-        RG_LOGI("netplay: Starting in host mode.\n");
-
-        strncpy((char*)wifi_config.ap.ssid, WIFI_SSID, 32);
-        wifi_config.ap.authmode = WIFI_AUTH_OPEN;
-        wifi_config.ap.channel = WIFI_CHANNEL;
-        wifi_config.ap.max_connection = MAX_PLAYERS - 1;
-        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
-        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
-        ret = esp_wifi_start();
-        netplay_mode = NETPLAY_MODE_HOST;
+        RG_LOGI("netplay: Starting in host mode (%s).\n", transport.name);
     }
     else
     {
         RG_PANIC("netplay: Error: Unknown mode!");
     }
 
-    return ret == ESP_OK;
+    netplay_mode = mode;
+
+    if (!transport.open(mode))
+    {
+        netplay_mode = NETPLAY_MODE_NONE;
+        return false;
+    }
+
+    return true;
 }
 
 
@@ -492,62 +1020,339 @@ bool rg_netplay_stop(void)
 {
     RG_LOGI("%s called.\n", __func__);
 
-    esp_err_t ret = ESP_FAIL;
-
     if (netplay_mode != NETPLAY_MODE_NONE)
     {
-        network_cleanup();
-        ret = esp_wifi_stop();
+        transport.close();
+        rollback_free();
+        impair.count = 0;
         netplay_status = NETPLAY_STATUS_STOPPED;
         netplay_mode = NETPLAY_MODE_NONE;
-        xSemaphoreGive(netplay_sync);
+        sync_signal();
+        return true;
     }
 
-    return ret == ESP_OK;
+    return false;
 }
 
 
-void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len)
+static bool rollback_resize(size_t capacity)
+{
+    for (int i = 0; i < ROLLBACK_FRAMES; i++)
+    {
+        void *state = realloc(rollback.states[i], capacity);
+        if (!state)
+            return false;
+        rollback.states[i] = state;
+    }
+    rollback.capacity = capacity;
+    return true;
+}
+
+
+static bool rollback_save(uint32_t frame)
 {
-    static uint32_t sync_count = 0, sync_time = 0, start_time = 0;
-    static netplay_packet_t packet;
+    int slot = frame % ROLLBACK_FRAMES;
 
-    if (netplay_status != NETPLAY_STATUS_CONNECTED)
+    rollback.state_frame[slot] = UINT32_MAX;
+
+    // The stream must not fill up, otherwise we can't tell a truncated state from a complete one
+    for (int tries = 0; tries < 4; ++tries)
+    {
+        FILE *fp = fmemopen(rollback.states[slot], rollback.capacity, "wb");
+        if (fp)
+        {
+            bool success = rg_system_get_app()->handlers.saveStateStream(fp);
+            long size = ftell(fp);
+            fclose(fp);
+            if (success && size > 0 && (size_t)size < rollback.capacity - 1)
+            {
+                rollback.state_frame[slot] = frame;
+                rollback.state_size[slot] = size;
+                return true;
+            }
+        }
+        if (!rollback_resize(rollback.capacity * 2))
+            break;
+    }
+
+    RG_LOGE("netplay: Snapshot of frame %u failed!\n", (unsigned)frame);
+    return false;
+}
+
+
+static bool rollback_load(uint32_t frame)
+{
+    int slot = frame % ROLLBACK_FRAMES;
+
+    if (rollback.state_frame[slot] != frame)
     {
+        RG_LOGE("netplay: No snapshot of frame %u!\n", (unsigned)frame);
+        return false;
+    }
+
+    FILE *fp = fmemopen(rollback.states[slot], rollback.state_size[slot], "rb");
+    bool success = fp && rg_system_get_app()->handlers.loadStateStream(fp);
+    if (fp)
+        fclose(fp);
+
+    return success;
+}
+
+
+// A snapshot is needed before every frame that may be replayed, and before every hashed frame
+static inline bool rollback_keep(uint32_t frame)
+{
+    return frame >= rollback.confirmed || frame % HASH_INTERVAL == 0;
+}
+
+
+// Remote input we haven't received yet is assumed to be the same as the last one we have
+static void rollback_predict(uint32_t frame)
+{
+    uint8_t *data = rollback.remote[frame % ROLLBACK_HISTORY];
+
+    if (frame < rollback.confirmed)
+        return;
+
+    if (rollback.confirmed > 0)
+        memcpy(data, rollback.remote[(rollback.confirmed - 1) % ROLLBACK_HISTORY], rollback.data_len);
+    else
+        memset(data, 0, rollback.data_len);
+}
+
+
+// Send all the inputs the remote player hasn't acknowledged yet, so a lost packet doesn't matter
+static void rollback_send(void)
+{
+    uint8_t buffer[sizeof(((netplay_packet_t *)0)->data)];
+    netplay_input_t *input = (netplay_input_t *)buffer;
+    uint32_t max_count = RG_MIN((sizeof(buffer) - sizeof(*input)) / rollback.data_len, ROLLBACK_HISTORY);
+    uint32_t last = rollback.frame;
+    uint32_t first = RG_MAX(rollback.peer_confirmed, last + 1 - RG_MIN(last + 1, max_count));
+
+    if (first > last)
         return;
+
+    input->frame = last;
+    input->confirmed = rollback.confirmed;
+    input->count = last - first + 1;
+    input->size = rollback.data_len;
+
+    for (int i = 0; i < input->count; i++)
+    {
+        memcpy(input->inputs + i * input->size, rollback.local[(first + i) % ROLLBACK_HISTORY], input->size);
     }
 
-    start_time = rg_system_timer();
+    send_packet(remote_player->id, NETPLAY_PACKET_INPUT, 0, buffer, sizeof(*input) + input->count * input->size);
+}
 
-    memcpy(&local_player->sync_data, data_in, data_len);
 
-    if (netplay_mode == NETPLAY_MODE_HOST)
+static bool rollback_receive(int timeout_ms)
+{
+    netplay_packet_t packet;
+    bool received = false;
+
+    // Wait for the first packet only, then drain whatever else is pending
+    while (receive_packet(&packet, received ? 0 : timeout_ms))
     {
-        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_REQ, 0, (void*)data_in, data_len);
+        netplay_input_t *input = (netplay_input_t *)packet.data;
+
+        if (packet.cmd == NETPLAY_PACKET_HASH)
+        {
+            hash_remote(&packet);
+            continue;
+        }
+
+        if (packet.cmd == NETPLAY_PACKET_INFO)
+        {
+            handshake_resend(&packet);
+            continue;
+        }
+
+        if (packet.cmd != NETPLAY_PACKET_INPUT
+            || packet.data_len < sizeof(*input)
+            || packet.data_len != sizeof(*input) + input->count * input->size
+            || input->size != rollback.data_len)
+        {
+            continue;
+        }
+
+        received = true;
+        rollback.peer_confirmed = RG_MAX(rollback.peer_confirmed, input->confirmed);
+
+        for (int i = 0; i < input->count; i++)
+        {
+            uint32_t frame = input->frame + 1 - input->count + i;
+            uint8_t *data = input->inputs + i * input->size;
+            uint8_t *slot = rollback.remote[frame % ROLLBACK_HISTORY];
+
+            if (frame != rollback.confirmed)
+                continue;
+
+            // We already emulated that frame with a prediction, was it right?
+            if (frame < rollback.frame && memcmp(slot, data, input->size) != 0)
+                rollback.replay_from = RG_MIN(rollback.replay_from, frame);
+
+            memcpy(slot, data, input->size);
+            rollback.confirmed++;
+        }
     }
 
-#ifdef NETPLAY_SYNCHRONOUS_TEST
-    if (netplay_mode == NETPLAY_MODE_HOST)
+    return received;
+}
+
+
+static void rollback_sync(void *data_in, void *data_out, uint8_t data_len)
+{
+    uint32_t frame = rollback.frame;
+
+    if (!rollback.capacity && !rollback_resize(32 * 1024))
     {
-        do {
-            recv(rx_sock, &packet, sizeof packet, 0); // ACK
-        } while (packet.cmd != NETPLAY_PACKET_SYNC_ACK);
-        // send_packet(remote_player->id, NETPLAY_PACKET_SYNC_DONE, packet.arg, 0, 0);
+        RG_LOGE("netplay: Not enough memory for rollback!\n");
+        rg_netplay_stop();
+        return;
     }
-    else
+
+    rollback.data_len = data_len;
+    memcpy(rollback.local[frame % ROLLBACK_HISTORY], data_in, data_len);
+
+    rollback_send();
+    rollback_receive(0);
+
+    // We can't run further ahead than our oldest snapshot
+    int64_t wait_start = rg_system_timer();
+    while ((int32_t)(frame - rollback.confirmed) >= ROLLBACK_FRAMES)
     {
-        do {
-            recv(rx_sock, &packet, sizeof packet, 0); // REQ
-        } while (packet.cmd != NETPLAY_PACKET_SYNC_REQ);
-        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_ACK, 0, (void*)data_in, data_len);
-        // recv(rx_sock, &packet, sizeof packet, 0); // DONE
+        if (rg_system_timer() - wait_start > NETPLAY_SYNC_TIMEOUT)
+        {
+            RG_LOGE("netplay: Lost sync...\n");
+            rg_netplay_stop();
+            return;
+        }
+        if (!rollback_receive(16))
+            rollback_send();
     }
 
-    memcpy(&remote_player->sync_data, packet.data, packet.data_len);
-    memcpy(data_out, remote_player->sync_data, data_len);
+    // Restore the snapshot taken before the first mispredicted frame and silently emulate up to now
+    if (rollback.replay_from < frame)
+    {
+        uint32_t from = rollback.replay_from;
+
+        if (rollback_load(from))
+        {
+            for (uint32_t f = from; f < frame; f++)
+            {
+                if (f != from && rollback_keep(f))
+                    rollback_save(f);
+                rollback_predict(f);
+                (*replay_handler)(rollback.local[f % ROLLBACK_HISTORY], rollback.remote[f % ROLLBACK_HISTORY]);
+            }
+            rollback.rollbacks++;
+            rollback.replayed += frame - from;
+        }
+        else
+        {
+            RG_LOGE("netplay: Rollback to frame %u failed, we will desync!\n", (unsigned)from);
+        }
+    }
+    rollback.replay_from = UINT32_MAX;
+
+    // A snapshot is final once all the inputs before it are confirmed. The wait above
+    // guarantees that it happens before its slot is reused.
+    while (hashes.next < frame && hashes.next <= rollback.confirmed)
+    {
+        int slot = hashes.next % ROLLBACK_FRAMES;
+        if (rollback.state_frame[slot] == hashes.next)
+            hash_local(hashes.next, rg_crc32(0, rollback.states[slot], rollback.state_size[slot]));
+        hashes.next += HASH_INTERVAL;
+    }
+
+    if (rollback_keep(frame))
+        rollback_save(frame);
+
+    rollback_predict(frame);
+
+    // The replay handler may have overwritten the local input
+    memcpy(data_in, rollback.local[frame % ROLLBACK_HISTORY], data_len);
+    memcpy(data_out, rollback.remote[frame % ROLLBACK_HISTORY], data_len);
+
+    rollback.frame++;
+}
+
+
+static void lockstep_sync(void *data_in, void *data_out, uint8_t data_len)
+{
+    uint32_t crc;
+
+    // Linked consoles each run their own game, their states have nothing in common
+    if (!link_mode && lockstep.frame % HASH_INTERVAL == 0
+        && rg_system_get_app()->handlers.saveStateStream && hash_state(&crc))
+    {
+        hash_local(lockstep.frame, crc);
+    }
+
+#ifdef NETPLAY_SYNCHRONOUS_TEST
+    netplay_packet_t packet;
+    uint8_t seq = lockstep.frame;
+    int64_t wait_start = rg_system_timer(), last_send = 0;
+
+    while (1)
+    {
+        int64_t now = rg_system_timer();
+
+        if (now - wait_start > NETPLAY_SYNC_TIMEOUT)
+        {
+            RG_LOGE("netplay: Lost sync...\n");
+            rg_netplay_stop();
+            return;
+        }
+
+        if (netplay_mode == NETPLAY_MODE_HOST && now - last_send > LOCKSTEP_RESEND)
+        {
+            send_packet(remote_player->id, NETPLAY_PACKET_SYNC_REQ, seq, data_in, data_len);
+            last_send = now;
+        }
+
+        if (!receive_packet(&packet, 10))
+            continue;
+
+        if (packet.cmd == NETPLAY_PACKET_HASH)
+        {
+            hash_remote(&packet);
+        }
+        else if (netplay_mode == NETPLAY_MODE_HOST)
+        {
+            if (packet.cmd == NETPLAY_PACKET_SYNC_ACK && packet.arg == seq)
+                break;
+            if (packet.cmd == NETPLAY_PACKET_INFO)
+                handshake_resend(&packet);
+        }
+        else if (packet.cmd == NETPLAY_PACKET_SYNC_REQ && packet.arg == seq)
+        {
+            send_packet(remote_player->id, NETPLAY_PACKET_SYNC_ACK, seq, data_in, data_len);
+            memcpy(lockstep.ack, data_in, data_len);
+            lockstep.ack_len = data_len;
+            break;
+        }
+        else if (packet.cmd == NETPLAY_PACKET_SYNC_REQ && packet.arg == (uint8_t)(seq - 1))
+        {
+            // The host didn't get our previous ACK
+            send_packet(remote_player->id, NETPLAY_PACKET_SYNC_ACK, packet.arg, lockstep.ack, lockstep.ack_len);
+        }
+    }
+
+    memcpy(data_out, packet.data, RG_MIN(packet.data_len, data_len));
 #else
+    data_len = RG_MIN(data_len, sizeof(local_player->sync_data));
+    memcpy(&local_player->sync_data, data_in, data_len);
+
+    if (netplay_mode == NETPLAY_MODE_HOST)
+    {
+        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_REQ, 0, (void*)data_in, data_len);
+    }
+
     // wait to receive/send NETPLAY_PACKET_SYNC_DONE
-    if (xSemaphoreTake(netplay_sync, 10000 / portTICK_PERIOD_MS) != pdPASS)
+    if (!sync_wait(10000))
     {
         RG_LOGE("netplay: Lost sync...\n");
         rg_netplay_stop();
@@ -560,15 +1365,86 @@ void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len)
     {
         send_packet(remote_player->id, NETPLAY_PACKET_SYNC_ACK, 0,
                     local_player->sync_data, sizeof(local_player->sync_data));
-        xSemaphoreTake(netplay_sync, 1000 / portTICK_PERIOD_MS);
+        sync_wait(1000);
     }
 #endif
 
-    sync_time += rg_system_timer() - start_time;
+    lockstep.frame++;
+}
+
+
+void rg_netplay_set_link_mode(bool enabled)
+{
+    link_mode = enabled;
+
+    if (enabled)
+        replay_handler = NULL;
+}
+
+
+void rg_netplay_set_replay_handler(netplay_replay_handler_t handler)
+{
+    rg_app_t *app = rg_system_get_app();
+
+    if (handler && link_mode)
+    {
+        RG_LOGW("netplay: Rollback isn't possible in link mode.\n");
+        handler = NULL;
+    }
+    else if (handler && (!app->handlers.saveStateStream || !app->handlers.loadStateStream))
+    {
+        RG_LOGW("netplay: This app can't snapshot its state, rollback disabled.\n");
+        handler = NULL;
+    }
+
+    replay_handler = handler;
+}
+
+
+void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len)
+{
+    static uint32_t sync_count = 0, sync_time = 0;
+
+    if (netplay_status != NETPLAY_STATUS_CONNECTED)
+    {
+        return;
+    }
+
+    int64_t start_time = rg_system_timer();
+    uint32_t frame;
+
+    if (replay_handler)
+    {
+        frame = rollback.frame;
+        rollback_sync(data_in, data_out, RG_MIN(data_len, sizeof(rollback.local[0])));
+    }
+    else
+    {
+        frame = lockstep.frame;
+        lockstep_sync(data_in, data_out, RG_MIN(data_len, NETPLAY_SYNC_MAX_DATA));
+    }
+
+    int elapsed = rg_system_timer() - start_time;
+    int lead = replay_handler ? (int)(rollback.frame - rollback.confirmed) : 0;
+
+    sync_time += elapsed;
+
+    if (stats_fp && netplay_status == NETPLAY_STATUS_CONNECTED)
+    {
+        fprintf(stats_fp, "%u,%d,%d,%u,%u,%u\n", (unsigned)frame, elapsed, lead,
+            (unsigned)rollback.rollbacks, (unsigned)rollback.replayed, (unsigned)hashes.desyncs);
+    }
 
     if (++sync_count == 60)
     {
-        RG_LOGI("netplay: Sync delay=%.4fms\n", (float)sync_time / sync_count / 1000);
+        if (replay_handler)
+            RG_LOGI("netplay: Sync delay=%.4fms frame=%u lead=%d rollbacks=%u replayed=%u hashes=%u desyncs=%u\n",
+                (float)sync_time / sync_count / 1000, (unsigned)rollback.frame, lead, (unsigned)rollback.rollbacks,
+                (unsigned)rollback.replayed, (unsigned)hashes.checked, (unsigned)hashes.desyncs);
+        else
+            RG_LOGI("netplay: Sync delay=%.4fms frame=%u hashes=%u desyncs=%u\n",
+                (float)sync_time / sync_count / 1000, (unsigned)lockstep.frame,
+                (unsigned)hashes.checked, (unsigned)hashes.desyncs);
         sync_count = sync_time = 0;
     }
 }
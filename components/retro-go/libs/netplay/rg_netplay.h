@@ -42,16 +42,35 @@ typedef enum {
     NETPLAY_PACKET_INPUT,       // Send gamepad data
     NETPLAY_PACKET_SERIAL,      // Send serial data
     NETPLAY_PACKET_RAW_DATA,    // Send raw data for the emulator to handle (serial, memory copy, etc)
+    NETPLAY_PACKET_HASH,        // Send a checksum of the emulation state to detect desyncs
 } netplay_packet_type_t;
 
+// Most data rg_netplay_sync() can exchange per frame. Rollback mode is limited to 16 bytes.
+#define NETPLAY_SYNC_MAX_DATA 128
+
 typedef struct __attribute__ ((packed)) {
     uint8_t player_id;
     uint8_t cmd;
     uint8_t arg; // seq
     uint8_t data_len;
-    uint8_t data[128];
+    uint8_t data[NETPLAY_SYNC_MAX_DATA];
 } netplay_packet_t;
 
+// Payload of NETPLAY_PACKET_INPUT, used by rollback mode
+typedef struct __attribute__ ((packed)) {
+    uint32_t frame;     // Frame of the last input in the packet
+    uint32_t confirmed; // Number of the recipient's frames received so far
+    uint8_t  count;     // Number of inputs, oldest first
+    uint8_t  size;      // Size of one input
+    uint8_t  inputs[];
+} netplay_input_t;
+
+// Payload of NETPLAY_PACKET_HASH
+typedef struct __attribute__ ((packed)) {
+    uint32_t frame;     // The state is taken before this frame is emulated
+    uint32_t crc;
+} netplay_hash_t;
+
 typedef struct __attribute__ ((packed)) {
     uint8_t  version;
     uint8_t  id;
@@ -64,6 +83,7 @@ typedef struct __attribute__ ((packed)) {
 
 typedef void (*netplay_callback_t)(netplay_event_t event, void *arg);
 typedef netplay_callback_t rg_netplay_handler_t;
+typedef void (*netplay_replay_handler_t)(void *local_data, void *remote_data);
 
 void rg_netplay_init(netplay_callback_t callback);
 void rg_netplay_deinit(void);
@@ -71,6 +91,8 @@ bool rg_netplay_quick_start(void);
 bool rg_netplay_start(netplay_mode_t mode);
 bool rg_netplay_stop(void);
 void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len);
+void rg_netplay_set_replay_handler(netplay_replay_handler_t handler);
+void rg_netplay_set_link_mode(bool enabled);
 
 netplay_mode_t rg_netplay_mode();
 netplay_status_t rg_netplay_status();
@@ -10,6 +10,7 @@
 #else
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
 #endif
 
 #if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
@@ -50,6 +51,256 @@ static const char *SETTING_OUTPUT = "AudioSink";
 static const char *SETTING_VOLUME = "Volume";
 static const char *SETTING_FILTER = "AudioFilter";
 
+#if RG_AUDIO_USE_SDL2
+// The ring is single-producer (rg_audio_submit) single-consumer (SDL callback), so no lock is needed
+// as long as each index is only written by its owner.
+#define SDL2_RING_SIZE     (8192)  // In samples, must be a power of two
+#define SDL2_TARGET_FILL   (2048)  // In samples, the latency we aim for
+#define SDL2_MAX_DRC       (0.005) // Maximum resampling ratio adjustment (0.5% is inaudible)
+static struct
+{
+    rg_audio_sample_t buffer[SDL2_RING_SIZE];
+    uint32_t head; // Written by the producer only
+    uint32_t tail; // Written by the consumer only
+    SDL_AudioDeviceID device;
+    int deviceRate;
+    double position; // Fractional read position carried over between submissions
+    rg_audio_sample_t last;
+} sdl2;
+
+static void sdl2_audio_callback(void *arg, uint8_t *stream, int len)
+{
+    rg_audio_sample_t *out = (rg_audio_sample_t *)stream;
+    size_t count = len / sizeof(rg_audio_sample_t);
+    uint32_t tail = sdl2.tail;
+    uint32_t head = __atomic_load_n(&sdl2.head, __ATOMIC_ACQUIRE);
+    size_t available = RG_MIN(head - tail, count);
+
+    for (size_t i = 0; i < available; ++i)
+        out[i] = sdl2.buffer[(tail + i) & (SDL2_RING_SIZE - 1)];
+
+    if (available < count)
+    {
+        memset(out + available, 0, (count - available) * sizeof(rg_audio_sample_t));
+        counters.underruns++;
+    }
+
+    __atomic_store_n(&sdl2.tail, tail + available, __ATOMIC_RELEASE);
+}
+
+static void sdl2_audio_submit(const rg_audio_sample_t *samples, size_t count, float volume)
+{
+    uint32_t head = sdl2.head;
+    uint32_t fill = head - __atomic_load_n(&sdl2.tail, __ATOMIC_ACQUIRE);
+
+    // Dynamic rate control: stretch or squeeze the input very slightly to drift towards the target
+    // fill level. This keeps emulation audio-locked without the pops that a full or empty ring causes.
+    double drc = 1.0 + SDL2_MAX_DRC * ((double)fill - SDL2_TARGET_FILL) / SDL2_TARGET_FILL;
+    double step = (audio.sampleRate / (double)sdl2.deviceRate) * RG_MIN(RG_MAX(drc, 1.0 - SDL2_MAX_DRC), 1.0 + SDL2_MAX_DRC);
+    double pos = sdl2.position;
+
+    // Block until we're back at the target latency, this is what paces emulation
+    while (fill > SDL2_TARGET_FILL + count)
+    {
+        SDL_Delay(1);
+        fill = head - __atomic_load_n(&sdl2.tail, __ATOMIC_ACQUIRE);
+    }
+
+    for (; pos < count; pos += step)
+    {
+        if (head - __atomic_load_n(&sdl2.tail, __ATOMIC_ACQUIRE) >= SDL2_RING_SIZE)
+            break; // Overrun, drop the rest
+
+        size_t index = (size_t)pos;
+        float frac = pos - index;
+        const rg_audio_sample_t *a = index ? &samples[index - 1] : &sdl2.last;
+        const rg_audio_sample_t *b = &samples[index];
+
+        sdl2.buffer[head & (SDL2_RING_SIZE - 1)] = (rg_audio_sample_t){
+            .left = (a->left + (b->left - a->left) * frac) * volume,
+            .right = (a->right + (b->right - a->right) * frac) * volume,
+        };
+        head++;
+    }
+
+    sdl2.position = RG_MAX(pos - count, 0.0);
+    sdl2.last = samples[count - 1];
+
+    __atomic_store_n(&sdl2.head, head, __ATOMIC_RELEASE);
+
+    counters.bufferFill = head - sdl2.tail;
+}
+#endif
+
+#if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
+// Samples are handed to rg_audio_task through a single-producer/single-consumer ring. The task does the
+// volume/DAC conversion and owns i2s_write, so a DMA stall no longer blocks the emulation loop directly.
+// If the task can't be created we fall back to converting and writing from the caller, like we used to.
+#define I2S_RING_SIZE (2048) // In samples, must be a power of two. About 46ms at 44.1KHz, or 2.7 frames at 60Hz.
+static struct
+{
+    rg_audio_sample_t *buffer;
+    uint32_t head; // Written by the producer only
+    uint32_t tail; // Written by the consumer only
+    TaskHandle_t producer;
+    TaskHandle_t consumer;
+    volatile bool producer_waiting;
+    volatile bool running;
+    bool direct; // No task, rg_audio_submit writes to the driver itself
+} i2s_ring;
+
+static void i2s_convert_samples(rg_audio_sample_t *dst, const rg_audio_sample_t *src, uint32_t pos, uint32_t mask, size_t count)
+{
+    const int volume = audio.muted ? 0 : (audio.volume * 256) / 100;
+
+    // Volume pass
+    for (size_t i = 0; i < count; ++i, ++pos)
+    {
+        const rg_audio_sample_t *sample = &src[pos & mask];
+        dst[i].left = (sample->left * volume) >> 8;
+        dst[i].right = (sample->right * volume) >> 8;
+    }
+
+    // In speaker mode we use left and right as a differential mono output to increase resolution.
+    if (audio.sink->type == RG_AUDIO_SINK_I2S_DAC)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            int sample = (dst[i].left + dst[i].right) >> 1;
+            if (sample > 0x7F00)
+            {
+                dst[i].left  =  0x8000 + (sample - 0x7F00);
+                dst[i].right = -0x8000 + 0x7F00;
+            }
+            else if (sample < -0x7F00)
+            {
+                dst[i].left  =  0x8000 + (sample + 0x7F00);
+                dst[i].right = -0x8000 + -0x7F00;
+            }
+            else
+            {
+                dst[i].left  =  0x8000;
+                dst[i].right = -0x8000 + sample;
+            }
+        }
+    }
+}
+
+static void i2s_task(void *arg)
+{
+    rg_audio_sample_t buffer[180];
+    size_t written = 0;
+
+    i2s_ring.consumer = xTaskGetCurrentTaskHandle();
+
+    while (i2s_ring.running)
+    {
+        uint32_t tail = i2s_ring.tail;
+        uint32_t head = __atomic_load_n(&i2s_ring.head, __ATOMIC_ACQUIRE);
+        size_t count = RG_MIN(head - tail, RG_COUNT(buffer));
+
+        if (count == 0)
+        {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        i2s_convert_samples(buffer, i2s_ring.buffer, tail, I2S_RING_SIZE - 1, count);
+
+        __atomic_store_n(&i2s_ring.tail, tail + count, __ATOMIC_RELEASE);
+        if (i2s_ring.producer_waiting)
+            xTaskNotifyGive(i2s_ring.producer);
+
+        // No lock here, the driver is only reconfigured after i2s_ring_stop() (mute, sample rate)
+        if (i2s_write(I2S_NUM_0, (void*)buffer, count * 4, &written, 1000) != ESP_OK)
+            RG_LOGW("I2S Submission error! Written: %d/%d\n", written, count * 4);
+    }
+
+    i2s_ring.consumer = NULL;
+    rg_task_delete(NULL);
+}
+
+static void i2s_ring_start(void)
+{
+    if (!i2s_ring.buffer)
+        i2s_ring.buffer = rg_alloc(I2S_RING_SIZE * sizeof(rg_audio_sample_t), MEM_FAST);
+    i2s_ring.head = i2s_ring.tail = 0;
+    i2s_ring.producer_waiting = false;
+    i2s_ring.running = true;
+    i2s_ring.direct = false;
+    if (!rg_task_create("rg_audio", &i2s_task, NULL, 3 * 1024, RG_TASK_PRIORITY - 2, 1))
+    {
+        RG_LOGW("Failed to create audio task, writing to the driver directly.\n");
+        i2s_ring.running = false;
+        i2s_ring.direct = true;
+    }
+    else
+        while (!i2s_ring.consumer) // The handle is set by the task itself, rg_task_create doesn't return it
+            rg_task_delay(1);
+}
+
+static void i2s_ring_stop(void)
+{
+    i2s_ring.direct = false;
+    if (!i2s_ring.running)
+        return;
+    i2s_ring.running = false;
+    while (i2s_ring.consumer)
+    {
+        xTaskNotifyGive(i2s_ring.consumer);
+        rg_task_delay(1);
+    }
+}
+
+static void i2s_direct_submit(const rg_audio_sample_t *samples, size_t count)
+{
+    rg_audio_sample_t buffer[180];
+    size_t written = 0;
+
+    // The caller already holds audioDevLock
+    for (size_t pos = 0; pos < count; pos += RG_COUNT(buffer))
+    {
+        size_t chunk = RG_MIN(count - pos, RG_COUNT(buffer));
+        i2s_convert_samples(buffer, samples + pos, 0, UINT32_MAX, chunk);
+        if (i2s_write(I2S_NUM_0, (void*)buffer, chunk * 4, &written, 1000) != ESP_OK)
+            RG_LOGW("I2S Submission error! Written: %d/%d\n", written, chunk * 4);
+    }
+}
+
+static void i2s_ring_submit(const rg_audio_sample_t *samples, size_t count)
+{
+    while (count > 0 && i2s_ring.running)
+    {
+        uint32_t head = i2s_ring.head;
+        uint32_t space = I2S_RING_SIZE - (head - __atomic_load_n(&i2s_ring.tail, __ATOMIC_ACQUIRE));
+
+        if (space == 0)
+        {
+            // The ring being full is what paces emulation, we sleep until the task makes room
+            i2s_ring.producer = xTaskGetCurrentTaskHandle();
+            i2s_ring.producer_waiting = true;
+            if (head - __atomic_load_n(&i2s_ring.tail, __ATOMIC_ACQUIRE) == I2S_RING_SIZE)
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+            i2s_ring.producer_waiting = false;
+            continue;
+        }
+
+        size_t chunk = RG_MIN(space, count);
+        size_t index = head & (I2S_RING_SIZE - 1);
+        size_t first = RG_MIN(chunk, I2S_RING_SIZE - index);
+
+        memcpy(i2s_ring.buffer + index, samples, first * sizeof(rg_audio_sample_t));
+        memcpy(i2s_ring.buffer, samples + first, (chunk - first) * sizeof(rg_audio_sample_t));
+
+        __atomic_store_n(&i2s_ring.head, head + chunk, __ATOMIC_RELEASE);
+        xTaskNotifyGive(i2s_ring.consumer);
+
+        samples += chunk;
+        count -= chunk;
+    }
+}
+#endif
+
 #define ACQUIRE_DEVICE(timeout) ({int x=xSemaphoreTake(audioDevLock, timeout);if(!x)RG_LOGE("Failed to acquire lock!\n");x;})
 #define RELEASE_DEVICE() xSemaphoreGive(audioDevLock);
 
@@ -136,13 +387,44 @@ void rg_audio_init(int sampleRate)
     else if (audio.sink->type == RG_AUDIO_SINK_SDL2)
     {
     #if RG_AUDIO_USE_SDL2
-        SDL_AudioSpec sdl2_config = {0};
-        error_code = 0;
+        SDL_AudioSpec desired = {
+            .freq = sampleRate,
+            .format = AUDIO_S16SYS,
+            .channels = 2,
+            .samples = 512,
+            .callback = &sdl2_audio_callback,
+        };
+        SDL_AudioSpec obtained = {0};
+        sdl2.head = sdl2.tail = 0;
+        sdl2.position = 0.0;
+        sdl2.last = (rg_audio_sample_t){0, 0};
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+        {
+            RG_LOGE("SDL_InitSubSystem failed: %s\n", SDL_GetError());
+        }
+        else if (!(sdl2.device = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE)))
+        {
+            RG_LOGE("SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
+        }
+        else
+        {
+            // The device rate may differ from ours, the resampler in sdl2_audio_submit takes care of it
+            sdl2.deviceRate = obtained.freq;
+            SDL_PauseAudioDevice(sdl2.device, 0);
+            error_code = 0;
+        }
     #else
         RG_LOGE("This device does not support SDL2!\n");
     #endif
     }
 
+#if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
+    if (!error_code && (audio.sink->type == RG_AUDIO_SINK_I2S_DAC || audio.sink->type == RG_AUDIO_SINK_I2S_EXT))
+    {
+        i2s_ring_start();
+    }
+#endif
+
     if (!error_code)
     {
         RG_LOGI("Audio ready. sink='%s', samplerate=%d, volume=%d\n",
@@ -166,6 +448,11 @@ void rg_audio_deinit(void)
     if (!audio.sink)
         return;
 
+#if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
+    // The task must be gone before we can tear down the driver (it writes without the lock)
+    i2s_ring_stop();
+#endif
+
     // We'll go ahead even if we can't acquire the lock...
     ACQUIRE_DEVICE(1000);
 
@@ -202,7 +489,9 @@ void rg_audio_deinit(void)
 #if RG_AUDIO_USE_SDL2
     else if (audio.sink->type == RG_AUDIO_SINK_SDL2)
     {
-        // ...
+        SDL_CloseAudioDevice(sdl2.device);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        sdl2.device = 0;
     }
 #endif
 
@@ -216,13 +505,19 @@ void rg_audio_submit(const rg_audio_sample_t *samples, size_t count)
 {
     const int64_t time_start = rg_system_timer();
 
-    if (!audio.sink)
+    if (!samples || !count)
         return;
 
-    if (!samples || !count)
+#ifdef RG_TARGET_SDL2
+    if (rg_benchmark_enabled())
+    {
+        // Headless: checksum the samples and don't wait for the sink, we want to run unthrottled
+        rg_benchmark_feed_audio(samples, count * sizeof(rg_audio_sample_t));
         return;
+    }
+#endif
 
-    if (!ACQUIRE_DEVICE(0))
+    if (!audio.sink)
         return;
 
     if (audio.sink->type == RG_AUDIO_SINK_DUMMY)
@@ -233,63 +528,28 @@ void rg_audio_submit(const rg_audio_sample_t *samples, size_t count)
 #if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
     else if (audio.sink->type == RG_AUDIO_SINK_I2S_DAC || audio.sink->type == RG_AUDIO_SINK_I2S_EXT)
     {
-        float volume = audio.muted ? 0.f : (audio.volume * 0.01f);
-        rg_audio_sample_t buffer[180];
-        size_t written = 0;
-        size_t pos = 0;
-
-        for (size_t i = 0; i < count; ++i)
+        if (i2s_ring.direct)
         {
-            int left = samples[i].left * volume;
-            int right = samples[i].right * volume;
-
-            // In speaker mode we use left and right as a differential mono output to increase resolution.
-            if (audio.sink->type == RG_AUDIO_SINK_I2S_DAC)
-            {
-                int sample = (left + right) >> 1;
-                if (sample > 0x7F00)
-                {
-                    left  =  0x8000 + (sample - 0x7F00);
-                    right = -0x8000 + 0x7F00;
-                }
-                else if (sample < -0x7F00)
-                {
-                    left  =  0x8000 + (sample + 0x7F00);
-                    right = -0x8000 + -0x7F00;
-                }
-                else
-                {
-                    left  =  0x8000;
-                    right = -0x8000 + sample;
-                }
-            }
-
-            // Clipping   (not necessary, we have (int16 * vol) and volume is never more than 1.0)
-            // if (left > 32767) left = 32767; else if (left < -32768) left = -32767;
-            // if (right > 32767) right = 32767; else if (right < -32768) right = -32767;
-
-            // Queue
-            buffer[pos].left = left;
-            buffer[pos].right = right;
-
-            if (i == count - 1 || ++pos == RG_COUNT(buffer))
-            {
-                if (i2s_write(I2S_NUM_0, (void*)buffer, pos * 4, &written, 1000) != ESP_OK)
-                    RG_LOGW("I2S Submission error! Written: %d/%d\n", written, pos * 4);
-                pos = 0;
-            }
+            // Only the direct path touches the driver from here, the ring is stopped before reconfiguring
+            if (!ACQUIRE_DEVICE(0))
+                return;
+            i2s_direct_submit(samples, count);
+            RELEASE_DEVICE();
+        }
+        else
+        {
+            i2s_ring_submit(samples, count);
         }
     }
 #endif
 #if RG_AUDIO_USE_SDL2
     else if (audio.sink->type == RG_AUDIO_SINK_SDL2)
     {
-        //
+        sdl2_audio_submit(samples, count, audio.muted ? 0.f : (audio.volume * 0.01f));
     }
 #endif
 
-    RELEASE_DEVICE();
-
+    rg_system_frame_add(RG_FRAME_PHASE_AUDIO, rg_system_timer() - time_start);
     counters.busyTime += rg_system_timer() - time_start;
     counters.samples += count;
 }
@@ -342,8 +602,13 @@ void rg_audio_set_mute(bool mute)
     // if (audio.muted == mute)
     //     return;
 
+#if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
+    bool restart = i2s_ring.running || i2s_ring.direct;
+    i2s_ring_stop();
+#endif
+
     if (!ACQUIRE_DEVICE(1000))
-        return;
+        goto restart;
 
 #if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
     if (audio.sink->type == RG_AUDIO_SINK_I2S_DAC)
@@ -360,6 +625,13 @@ void rg_audio_set_mute(bool mute)
 
     audio.muted = mute;
     RELEASE_DEVICE();
+
+restart:
+#if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
+    if (restart)
+        i2s_ring_start();
+#endif
+    return;
 }
 
 int rg_audio_get_sample_rate(void)
@@ -374,8 +646,13 @@ void rg_audio_set_sample_rate(int sampleRate)
     if (audio.sampleRate == sampleRate)
         return;
 
+#if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
+    bool restart = i2s_ring.running || i2s_ring.direct;
+    i2s_ring_stop();
+#endif
+
     if (!ACQUIRE_DEVICE(1000))
-        return;
+        goto restart;
 
 #if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
     if (audio.sink->type == RG_AUDIO_SINK_I2S_DAC || audio.sink->type == RG_AUDIO_SINK_I2S_EXT)
@@ -387,4 +664,11 @@ void rg_audio_set_sample_rate(int sampleRate)
 
     audio.sampleRate = sampleRate;
     RELEASE_DEVICE();
+
+restart:
+#if RG_AUDIO_USE_INT_DAC || RG_AUDIO_USE_EXT_DAC
+    if (restart)
+        i2s_ring_start();
+#endif
+    return;
 }
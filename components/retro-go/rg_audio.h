@@ -34,6 +34,8 @@ typedef struct
 {
     int64_t busyTime;
     int32_t samples;
+    int32_t bufferFill; // Samples queued in the sink, if it has a software buffer
+    int32_t underruns;  // Times the sink ran dry and had to output silence
 } rg_audio_counters_t;
 
 typedef struct
@@ -10,6 +10,7 @@
 #else
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <esp_heap_caps.h>
 #include <driver/gpio.h>
 #include <driver/spi_master.h>
 #endif
@@ -22,6 +23,9 @@
 #define SPI_BUFFER_COUNT      (6)
 #define SPI_BUFFER_LENGTH     (4 * 320) // In pixels (uint16)
 
+#define STAGING_HEAP_RESERVE  (64 * 1024) // Internal memory left to the application after allocating staging
+#define STAGING_WAIT_TRIGGER  (1000)      // In us. The app blocked that long on a frame, staging is worth it
+
 static spi_device_handle_t spi_dev;
 static QueueHandle_t spi_transactions;
 static QueueHandle_t spi_buffers;
@@ -30,6 +34,19 @@ static QueueHandle_t display_task_queue;
 static rg_display_counters_t counters;
 static rg_display_config_t config;
 static rg_display_t display;
+static volatile bool display_busy;
+
+// Private copy of the frame being sent, it allows the application to reuse its buffer right away.
+// It is only allocated once the application actually waits on the display, and if memory allows.
+static struct {
+    uint8_t *buffer;
+    size_t size;
+    bool wanted;
+    bool failed;
+    uint16_t palette[256];
+    rg_display_rect_t rects[RG_DISPLAY_MAX_RECTS];
+    int rect_count;
+} staging;
 
 static struct {
     uint8_t start  : 1; // Indicates this line or column is safe to start an update on
@@ -40,6 +57,25 @@ static struct {
     uint8_t empty;
 } screen_lines[RG_SCREEN_HEIGHT];
 
+typedef void (*blit_line_t)(uint16_t *dst, const void *src, const uint16_t *palette, const short *columns, int count);
+
+static struct {
+    short source[RG_SCREEN_WIDTH]; // Source column of each viewport column
+    short blend[RG_SCREEN_WIDTH];  // Viewport columns that repeat their left neighbour (horizontal filter)
+    int blend_count;
+    blit_line_t blit_line;
+} screen_cols;
+
+#define DIFF_CHUNK_WORDS (4) // Compare 16 bytes at a time
+#define DIFF_MAX_SPANS   (4) // Dirty spans tracked per line, more than that and they're merged
+#define DIFF_MERGE_GAP   (4) // In words. Closer spans are merged because a new window costs more than it saves
+#define DIFF_MERGE_SLACK (8) // In pixels. Horizontal drift allowed when growing a rect to the next line
+
+typedef struct {
+    short left;  // In words
+    short right; // In words, exclusive
+} diff_span_t;
+
 static const char *SETTING_BACKLIGHT = "DispBacklight";
 static const char *SETTING_SCALING = "DispScaling";
 static const char *SETTING_FILTER = "DispFilter";
@@ -396,6 +432,36 @@ static inline unsigned blend_pixels(unsigned a, unsigned b)
     return (v << 8) | (v >> 8);
 }
 
+// Line kernels, one per source format and scaling mode. The scaled variants read the source
+// through the column table built by update_viewport_scaling, so there is no per-pixel stepping.
+#define BLIT_LINE_KERNEL(name, type, scaled, pixel)                                             \
+    static void name(uint16_t *dst, const void *src, const uint16_t *palette, const short *columns, int count) \
+    {                                                                                           \
+        const type *line = (const type *)src + (scaled ? 0 : columns[0]);                      \
+        for (int x = 0; x < count; ++x)                                                         \
+        {                                                                                       \
+            type p = line[scaled ? columns[x] : x];                                             \
+            dst[x] = (pixel);                                                                   \
+        }                                                                                       \
+    }
+
+BLIT_LINE_KERNEL(blit_line_pal8,         uint8_t,  0, palette[p])
+BLIT_LINE_KERNEL(blit_line_pal8_scaled,  uint8_t,  1, palette[p])
+BLIT_LINE_KERNEL(blit_line_le16,         uint16_t, 0, (p << 8) | (p >> 8))
+BLIT_LINE_KERNEL(blit_line_le16_scaled,  uint16_t, 1, (p << 8) | (p >> 8))
+BLIT_LINE_KERNEL(blit_line_be16_scaled,  uint16_t, 1, p)
+
+static void blit_line_be16(uint16_t *dst, const void *src, const uint16_t *palette, const short *columns, int count)
+{
+    memcpy(dst, (const uint16_t *)src + columns[0], count * 2);
+}
+
+static const blit_line_t blit_line_kernels[3][2] = {
+    {blit_line_pal8, blit_line_pal8_scaled}, // RG_PIXEL_PAL
+    {blit_line_le16, blit_line_le16_scaled}, // RG_PIXEL_LE
+    {blit_line_be16, blit_line_be16_scaled}, // RG_PIXEL_BE
+};
+
 static inline void write_rect(int left, int top, int width, int height,
                               const void *framebuffer, const uint16_t *palette)
 {
@@ -413,20 +479,21 @@ static inline void write_rect(int left, int top, int width, int height,
     const int screen_left = display.viewport.x_pos + scaled_left;
     const int screen_bottom = RG_MIN(screen_top + scaled_height, screen_height);
     const int lines_per_buffer = SPI_BUFFER_LENGTH / scaled_width;
-    const int ix_acc = (x_inc * scaled_left) % screen_width;
+    const short *columns = screen_cols.source + scaled_left;
     const int filter_mode = config.scaling ? config.filter : 0;
     const bool filter_y = filter_mode == RG_DISPLAY_FILTER_VERT || filter_mode == RG_DISPLAY_FILTER_BOTH;
     const bool filter_x = filter_mode == RG_DISPLAY_FILTER_HORIZ || filter_mode == RG_DISPLAY_FILTER_BOTH;
-    const int format = display.source.format;
     const int stride = display.source.stride;
-    union { const uint8_t *u8; const uint16_t *u16; } buffer;
+    const blit_line_t blit_line = screen_cols.blit_line;
+    const uint8_t *buffer;
 
     if (scaled_width < 1 || scaled_height < 1)
     {
         return;
     }
 
-    buffer.u8 = framebuffer + display.source.offset + (top * stride) + (left * display.source.pixlen);
+    // Column lookups are absolute, so the buffer points to the start of the line
+    buffer = framebuffer + display.source.offset + (top * stride);
 
     lcd_set_window(
         screen_left + RG_SCREEN_MARGIN_LEFT,
@@ -458,33 +525,14 @@ static inline void write_rect(int left, int top, int width, int height,
         for (int i = 0; i < lines_to_copy; ++i)
         {
             if (i > 0 && screen_lines[screen_y].empty)
-            {
                 memcpy(line_buffer_ptr, line_buffer_ptr - scaled_width, scaled_width * 2);
-                line_buffer_ptr += scaled_width;
-            }
             else
-            {
-                #define RENDER_LINE(pixel) { \
-                    for (int x = 0, x_acc = ix_acc; x < width;) { \
-                        *line_buffer_ptr++ = (pixel); \
-                        x_acc += x_inc; \
-                        while (x_acc >= screen_width) { \
-                            x_acc -= screen_width; \
-                            ++x; \
-                        } \
-                    } \
-                }
-                if (format & RG_PIXEL_PAL)
-                    RENDER_LINE(palette[buffer.u8[x]])
-                else if (format & RG_PIXEL_LE)
-                    RENDER_LINE((buffer.u16[x] << 8) | (buffer.u16[x] >> 8))
-                else
-                    RENDER_LINE(buffer.u16[x])
-            }
+                blit_line(line_buffer_ptr, buffer, palette, columns, scaled_width);
+            line_buffer_ptr += scaled_width;
 
             if (!screen_lines[++screen_y].empty)
             {
-                buffer.u8 += stride;
+                buffer += stride;
                 ++y;
             }
         }
@@ -504,21 +552,12 @@ static inline void write_rect(int left, int top, int width, int height,
                 // Filter X
                 if (filter_x)
                 {
-                    uint16_t *buffer = line_buffer + y * scaled_width;
-                    for (int x = 0, frame_x = 0, prev_frame_x = -1, x_acc = ix_acc; x < scaled_width; ++x)
+                    uint16_t *buffer = line_buffer + y * scaled_width - scaled_left;
+                    for (int i = 0; i < screen_cols.blend_count; ++i)
                     {
-                        if (frame_x == prev_frame_x && x > 0 && x + 1 < scaled_width)
-                        {
+                        int x = screen_cols.blend[i];
+                        if (x > scaled_left && x + 1 < scaled_right)
                             buffer[x] = blend_pixels(buffer[x - 1], buffer[x + 1]);
-                        }
-                        prev_frame_x = frame_x;
-
-                        x_acc += x_inc;
-                        while (x_acc >= screen_width)
-                        {
-                            x_acc -= screen_width;
-                            ++frame_x;
-                        }
                     }
                 }
 
@@ -538,6 +577,7 @@ static inline void write_rect(int left, int top, int width, int height,
         }
 
         lcd_send_data(line_buffer, scaled_width * lines_to_copy * 2);
+        counters.bytesSent += scaled_width * lines_to_copy * 2;
     }
 }
 
@@ -601,11 +641,87 @@ static void update_viewport_scaling(void)
         }
     }
 
+    int x_acc = 0;
+
+    // write_rect rounds its right edge up with the truncated x_inc, it can go past viewport.width
+    int cols = (display.screen.width * src_width + display.viewport.x_inc - 1) / display.viewport.x_inc;
+    cols = RG_MIN(RG_MAX(cols, display.viewport.width), RG_SCREEN_WIDTH);
+
+    screen_cols.blend_count = 0;
+
+    for (int x = 0, screen_x = 0; screen_x < cols; ++screen_x)
+    {
+        screen_cols.source[screen_x] = RG_MIN(x, src_width - 1);
+
+        if (screen_x > 0 && screen_cols.source[screen_x - 1] == x)
+            screen_cols.blend[screen_cols.blend_count++] = screen_x;
+
+        x_acc += display.viewport.x_inc;
+        while (x_acc >= display.screen.width)
+        {
+            x_acc -= display.screen.width;
+            ++x;
+        }
+    }
+
+    int kernel_format = (display.source.format & RG_PIXEL_PAL) ? 0 : (display.source.format & RG_PIXEL_LE) ? 1 : 2;
+    screen_cols.blit_line = blit_line_kernels[kernel_format][new_width != src_width];
+
     RG_LOGI("%dx%d@%.3f => %dx%d@%.3f x_pos:%d y_pos:%d x_inc:%d y_inc:%d\n", src_width, src_height,
             src_width / (double)src_height, new_width, new_height, new_ratio, display.viewport.x_pos,
             display.viewport.y_pos, display.viewport.x_inc, display.viewport.y_inc);
 }
 
+static void update_staging_buffer(void)
+{
+    size_t size = display.source.offset + display.source.stride * display.source.height;
+
+    if (size == staging.size || !staging.wanted || staging.failed)
+        return;
+
+    free(staging.buffer);
+    staging.buffer = NULL;
+    staging.size = 0;
+
+    // This is a nice to have, if memory is tight we'll simply hold the emulator a bit longer
+#ifdef RG_TARGET_SDL2
+    staging.buffer = malloc(size);
+#else
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) >= size + STAGING_HEAP_RESERVE)
+        staging.buffer = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+
+    if (staging.buffer)
+    {
+        RG_LOGI("Staging buffer allocated (%d bytes).\n", (int)size);
+        staging.size = size;
+    }
+    else
+    {
+        RG_LOGW("Not enough memory for staging buffer (%d bytes), pipelining disabled.\n", (int)size);
+        staging.failed = true;
+    }
+}
+
+static void copy_to_staging(const rg_video_update_t *update)
+{
+    const int pixlen = display.source.pixlen;
+    const int stride = display.source.stride;
+
+    for (int i = 0; i < staging.rect_count; ++i)
+    {
+        const rg_display_rect_t *rect = &staging.rects[i];
+        size_t offset = display.source.offset + rect->top * stride + rect->left * pixlen;
+        size_t length = rect->width * pixlen;
+
+        for (int y = 0; y < rect->height; ++y, offset += stride)
+            memcpy(staging.buffer + offset, update->buffer + offset, length);
+    }
+
+    if (display.source.format & RG_PIXEL_PAL)
+        memcpy(staging.palette, update->palette, sizeof(staging.palette));
+}
+
 static void display_task(void *arg)
 {
     display_task_queue = xQueueCreate(1, sizeof(rg_video_update_t *));
@@ -621,23 +737,29 @@ static void display_task(void *arg)
         if (update == (void*)-1)
             break;
 
+        display_busy = true;
+
         if (display.changed)
         {
             if (config.scaling != RG_DISPLAY_SCALING_FILL)
                 rg_display_clear(C_BLACK);
             update_viewport_scaling();
+            staging.failed = false;
             update->type = RG_UPDATE_FULL;
             display.changed = false;
         }
 
+        update_staging_buffer();
+
         if (update->type == RG_UPDATE_FULL)
         {
-            // write_rect();
-            update->diff[0] = (rg_line_diff_t){
-                .left = 0,
-                .width = display.source.width,
-                .repeat = display.source.height,
-            };
+            staging.rects[0] = (rg_display_rect_t){0, 0, display.source.width, display.source.height};
+            staging.rect_count = 1;
+        }
+        else
+        {
+            memcpy(staging.rects, update->rects, update->rect_count * sizeof(rg_display_rect_t));
+            staging.rect_count = update->rect_count;
         }
 
         // It's better to update the counters before we start the transfer, in case someone needs it
@@ -645,22 +767,38 @@ static void display_task(void *arg)
             counters.fullFrames++;
         counters.totalFrames++;
 
-        for (int y = 0; y < display.source.height;)
+        const void *buffer = update->buffer;
+        const uint16_t *palette = update->palette;
+
+        // With a staging buffer we only hold the application for as long as it takes to copy the
+        // dirty area. Scaling, filtering, and the SPI transfer then overlap with the next frame.
+        if (staging.buffer)
         {
-            rg_line_diff_t *diff = &update->diff[y];
+            copy_to_staging(update);
+            buffer = staging.buffer;
+            palette = staging.palette;
+            xQueueReceive(display_task_queue, &update, portMAX_DELAY);
+        }
 
-            if (diff->width > 0)
-            {
-                write_rect(diff->left, y, diff->width, diff->repeat, update->buffer, update->palette);
-            }
-            y += diff->repeat;
+        for (int i = 0; i < staging.rect_count; ++i)
+        {
+            const rg_display_rect_t *rect = &staging.rects[i];
+            write_rect(rect->left, rect->top, rect->width, rect->height, buffer, palette);
         }
 
-        xQueueReceive(display_task_queue, &update, portMAX_DELAY);
+        if (!staging.buffer)
+            xQueueReceive(display_task_queue, &update, portMAX_DELAY);
+
+        display_busy = false;
 
         lcd_vsync();
     }
 
+    free(staging.buffer);
+    staging.buffer = NULL;
+    staging.size = 0;
+    staging.wanted = false;
+
     vQueueDelete(display_task_queue);
     display_task_queue = NULL;
 
@@ -786,145 +924,209 @@ bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame,
 }
 
 IRAM_ATTR
-rg_update_t rg_display_queue_update(/*const*/ rg_video_update_t *update, const rg_video_update_t *previousUpdate)
+static inline int diff_line(const uint32_t *a, const uint32_t *b, int words, diff_span_t *spans)
 {
-    const int64_t time_start = rg_system_timer();
-    // RG_ASSERT(display.source.width && display.source.height, "Source format not set!");
-    RG_ASSERT(update, "update is null!");
+    int count = 0;
+
+    // Mark words [l, r) as dirty, merging with the previous span if the gap is too small to be
+    // worth a new window. When we run out of spans the last one simply grows.
+    #define MARK_SPAN(l, r) {                                                                   \
+        if (count > 0 && ((l) - spans[count - 1].right < DIFF_MERGE_GAP || count == DIFF_MAX_SPANS)) \
+            spans[count - 1].right = (r);                                                      \
+        else                                                                                   \
+            spans[count++] = (diff_span_t){(l), (r)};                                          \
+    }
 
-    if (!previousUpdate || display.changed || config.update_mode == RG_DISPLAY_UPDATE_FULL)
+    int x = 0;
+
+    for (; x + DIFF_CHUNK_WORDS <= words; x += DIFF_CHUNK_WORDS)
     {
-        update->type = RG_UPDATE_FULL;
+        if (((a[x] ^ b[x]) | (a[x + 1] ^ b[x + 1]) | (a[x + 2] ^ b[x + 2]) | (a[x + 3] ^ b[x + 3])) == 0)
+            continue;
+
+        // Narrow the chunk down to the words that actually changed
+        int l = x, r = x + DIFF_CHUNK_WORDS;
+        while (a[l] == b[l])
+            ++l;
+        while (a[r - 1] == b[r - 1])
+            --r;
+        MARK_SPAN(l, r);
     }
-    else if (PTR_IN_SPIRAM(update->buffer) && PTR_IN_SPIRAM(previousUpdate->buffer))
+
+    for (; x < words; ++x)
     {
-        // There's no speed benefit in trying to diff when both buffers are in SPIRAM,
-        // it will almost always be faster to just update it everything...
-        update->type = RG_UPDATE_FULL;
+        if (a[x] != b[x])
+            MARK_SPAN(x, x + 1);
     }
-    else // RG_UPDATE_PARTIAL
+
+    #undef MARK_SPAN
+
+    return count;
+}
+
+IRAM_ATTR
+static inline rg_update_t diff_frame(rg_video_update_t *update, const rg_video_update_t *previousUpdate)
+{
+    const uint32_t *frame_buffer = update->buffer + display.source.offset;
+    const uint32_t *prev_buffer = previousUpdate->buffer + display.source.offset;
+    const int frame_width = display.source.width;
+    const int frame_height = display.source.height;
+    const int stride = display.source.stride;
+    const int words = (frame_width * display.source.pixlen) / sizeof(*frame_buffer);
+    const int pixels_per_word = sizeof(*frame_buffer) / display.source.pixlen;
+    rg_display_rect_t *rects = update->rects;
+    int rect_count = 0;
+
+    // Indexes of the rects that were extended on the previous line, only those can keep growing
+    int open[DIFF_MAX_SPANS], open_count = 0;
+    int next[DIFF_MAX_SPANS], next_count = 0;
+    diff_span_t spans[DIFF_MAX_SPANS];
+
+    // Past this point it's faster to send the whole frame in one go than to keep diffing and
+    // then send many windows. Finishing the diff is cheap now so the threshold can be higher
+    // than the 50% we used to have.
+    const int threshold = (frame_width * frame_height) * 3 / 4;
+    int changed = 0;
+
+    update->rect_count = 0;
+
+    for (int y = 0; y < frame_height; ++y)
     {
-        const uint32_t *frame_buffer = update->buffer + display.source.offset; // uint64_t is 0.7% faster!
-        const uint32_t *prev_buffer = previousUpdate->buffer + display.source.offset;
-        const int frame_width = display.source.width;
-        const int frame_height = display.source.height;
-        const int stride = display.source.stride;
-        const int blocks = (frame_width * display.source.pixlen) / sizeof(*frame_buffer);
-        const int pixels_per_block = sizeof(*frame_buffer) / display.source.pixlen;
-        rg_line_diff_t *out_diff = update->diff;
-
-        // If more than 50% of the screen has changed then stop the comparison and assume that the
-        // rest also changed. This is true in 77% of the cases in Pokemon, resulting in a net
-        // benefit. The other 23% of cases would have benefited from finishing the diff, so a better
-        // heuristic might be preferable (interlaced compare perhaps?).
-        int threshold = (frame_width * frame_height) / 2;
-        int changed = 0;
-
-        for (int y = 0; y < frame_height; ++y)
+        int span_count = diff_line(frame_buffer, prev_buffer, words, spans);
+
+        next_count = 0;
+
+        for (int i = 0; i < span_count; ++i)
         {
-            int left = 0, width = 0;
+            int left = spans[i].left * pixels_per_word;
+            int right = spans[i].right * pixels_per_word;
+            rg_display_rect_t *rect = NULL;
 
-            for (int x = 0; x < blocks && changed < threshold; ++x)
+            changed += right - left;
+
+            // Try to extend a rect from the previous line with a similar horizontal position
+            for (int j = 0; j < open_count; ++j)
             {
-                if (frame_buffer[x] != prev_buffer[x])
+                if (open[j] < 0)
+                    continue;
+
+                rg_display_rect_t *candidate = &rects[open[j]];
+                int candidate_right = candidate->left + candidate->width;
+
+                if (abs(candidate->left - left) <= DIFF_MERGE_SLACK && abs(candidate_right - right) <= DIFF_MERGE_SLACK)
                 {
-                    for (int xl = blocks - 1; xl >= x; --xl)
-                    {
-                        if (frame_buffer[xl] != prev_buffer[xl])
-                        {
-                            left = x * pixels_per_block;
-                            width = ((xl + 1) - x) * pixels_per_block;
-                            changed += width;
-                            break;
-                        }
-                    }
+                    candidate->left = RG_MIN(candidate->left, left);
+                    candidate->width = RG_MAX(candidate_right, right) - candidate->left;
+                    candidate->height++;
+                    next[next_count++] = open[j];
+                    open[j] = -1;
+                    rect = candidate;
                     break;
                 }
             }
 
-            out_diff[y].left = left;
-            out_diff[y].width = width;
-            out_diff[y].repeat = 1;
-
-            frame_buffer = (void *)frame_buffer + stride;
-            prev_buffer = (void *)prev_buffer + stride;
+            if (!rect)
+            {
+                if (rect_count == RG_DISPLAY_MAX_RECTS)
+                    return RG_UPDATE_FULL;
+                rects[rect_count] = (rg_display_rect_t){left, y, right - left, 1};
+                next[next_count++] = rect_count++;
+            }
         }
 
-        if (changed == 0)
-        {
-            update->type = RG_UPDATE_EMPTY;
-        }
-        else if (changed >= threshold)
-        {
-            update->type = RG_UPDATE_FULL;
-        }
-        else
-        {
-            update->type = RG_UPDATE_PARTIAL;
+        if (changed >= threshold)
+            return RG_UPDATE_FULL;
 
-            // If filtering is enabled we must adjust our diff blocks to be on appropriate boundaries
-            if (config.filter && config.scaling)
-            {
-                for (int y = 0; y < frame_height; ++y)
-                {
-                    if (out_diff[y].width < 1)
-                        continue;
+        memcpy(open, next, sizeof(open));
+        open_count = next_count;
 
-                    int block_start = y;
-                    int block_end = y;
-                    int left = out_diff[y].left;
-                    int right = left + out_diff[y].width;
+        frame_buffer = (void *)frame_buffer + stride;
+        prev_buffer = (void *)prev_buffer + stride;
+    }
 
-                    while (block_start > 0 && (out_diff[block_start].width > 0 || !filter_lines[block_start].start))
-                        block_start--;
+    if (rect_count == 0)
+        return RG_UPDATE_EMPTY;
 
-                    while (block_end < frame_height - 1 && (out_diff[block_end].width > 0 || !filter_lines[block_end].stop))
-                        block_end++;
+    // If filtering is enabled we must adjust our rects to be on appropriate boundaries
+    if (config.filter && config.scaling)
+    {
+        for (int i = 0; i < rect_count; ++i)
+        {
+            rg_display_rect_t *rect = &rects[i];
+            int top = rect->top;
+            int bottom = rect->top + rect->height - 1;
+            int left = RG_MAX(rect->left - 1, 0);
+            int right = RG_MIN(rect->left + rect->width + 1, frame_width);
 
-                    for (int i = block_start; i <= block_end; i++)
-                    {
-                        if (out_diff[i].width > 0)
-                        {
-                            right = RG_MAX(right, out_diff[i].left + out_diff[i].width);
-                            left = RG_MIN(left, out_diff[i].left);
-                        }
-                    }
+            while (top > 0 && !filter_lines[top].start)
+                top--;
 
-                    left = RG_MAX(left - 1, 0);
-                    right = RG_MIN(right + 1, frame_width);
+            while (bottom < frame_height - 1 && !filter_lines[bottom].stop)
+                bottom++;
 
-                    for (int i = block_start; i <= block_end; i++)
-                    {
-                        out_diff[i].left = left;
-                        out_diff[i].width = right - left;
-                    }
+            *rect = (rg_display_rect_t){left, top, right - left, bottom - top + 1};
+        }
+    }
 
-                    y = block_end;
-                }
-            }
+    update->rect_count = rect_count;
 
-            // Combine consecutive lines with similar changes location to optimize the SPI transfer
-            rg_line_diff_t *line = &out_diff[frame_height - 1];
-            rg_line_diff_t *prev_line = line - 1;
+    return RG_UPDATE_PARTIAL;
+}
 
-            for (; line > out_diff; --line, --prev_line)
-            {
-                int right = line->left + line->width;
-                int right_prev = prev_line->left + prev_line->width;
+IRAM_ATTR
+rg_update_t rg_display_queue_update(/*const*/ rg_video_update_t *update, const rg_video_update_t *previousUpdate)
+{
+    const int64_t time_start = rg_system_timer();
+    // RG_ASSERT(display.source.width && display.source.height, "Source format not set!");
+    RG_ASSERT(update, "update is null!");
 
-                if (abs(line->left - prev_line->left) <= 8 && abs(right - right_prev) <= 8)
-                {
-                    if (line->left < prev_line->left)
-                        prev_line->left = line->left;
-                    prev_line->width = RG_MAX(right, right_prev) - prev_line->left;
-                    prev_line->repeat = line->repeat + 1;
-                }
-            }
-        }
+    if (!previousUpdate || display.changed || config.update_mode == RG_DISPLAY_UPDATE_FULL)
+    {
+        update->type = RG_UPDATE_FULL;
     }
+    else if (PTR_IN_SPIRAM(update->buffer) && PTR_IN_SPIRAM(previousUpdate->buffer))
+    {
+        // There's no speed benefit in trying to diff when both buffers are in SPIRAM,
+        // it will almost always be faster to just update it everything...
+        update->type = RG_UPDATE_FULL;
+    }
+    else // RG_UPDATE_PARTIAL
+    {
+        update->type = diff_frame(update, previousUpdate);
+        counters.diffTime += rg_system_timer() - time_start;
+        rg_system_frame_add(RG_FRAME_PHASE_DIFF, rg_system_timer() - time_start);
+    }
+
+    if (update->type != RG_UPDATE_PARTIAL)
+        update->rect_count = 0;
+
+    const int64_t time_queue = rg_system_timer();
 
+#ifdef RG_TARGET_SDL2
+    if (rg_benchmark_enabled())
+    {
+        // Headless: checksum the whole source frame instead of sending it to the screen
+        rg_benchmark_feed_video((uint8_t *)update->buffer + display.source.offset,
+            display.source.stride * display.source.height);
+        // Account what display_task would have sent, unscaled, so the diff's payoff can be compared
+        if (update->type == RG_UPDATE_FULL)
+        {
+            counters.bytesSent += display.source.width * display.source.height * 2;
+            counters.fullFrames++;
+        }
+        for (int i = 0; i < update->rect_count; ++i)
+            counters.bytesSent += update->rects[i].width * update->rects[i].height * 2;
+        counters.totalFrames++;
+    }
+    else
+#endif
     xQueueSend(display_task_queue, &update, portMAX_DELAY);
 
+    // We had to wait for the previous frame, ask the display task for a staging buffer
+    if (!staging.buffer && rg_system_timer() - time_queue > STAGING_WAIT_TRIGGER)
+        staging.wanted = true;
+
+    rg_system_frame_add(RG_FRAME_PHASE_DISPLAY, rg_system_timer() - time_queue);
     counters.busyTime += rg_system_timer() - time_start;
 
     return update->type;
@@ -952,7 +1154,7 @@ void rg_display_set_source_format(int width, int height, int crop_h, int crop_v,
 
 void rg_display_sync(void)
 {
-    while (uxQueueMessagesWaiting(display_task_queue))
+    while (uxQueueMessagesWaiting(display_task_queue) || display_busy)
         continue; // Wait until display queue is done
 }
 
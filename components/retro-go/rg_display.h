@@ -76,6 +76,8 @@ typedef struct
     int32_t totalFrames;
     int32_t fullFrames;
     int64_t busyTime; // This is only time spent blocking the main task
+    int64_t diffTime; // Part of busyTime spent comparing frames
+    int64_t bytesSent;
 } rg_display_counters_t;
 
 typedef struct
@@ -106,19 +108,23 @@ typedef struct
     bool changed;
 } rg_display_t;
 
+#define RG_DISPLAY_MAX_RECTS 48
+
 typedef struct
 {
-    short left;   // int32_t left:10;
-    short width;  // int32_t width:10;
-    short repeat; // int32_t repeat:10;
-} rg_line_diff_t;
+    short left;
+    short top;
+    short width;
+    short height;
+} rg_display_rect_t;
 
 typedef struct
 {
     rg_update_t type;
     void *buffer;          // Should be at least height*stride bytes. expects uint8_t * | uint16_t *
     uint16_t palette[256]; // Used in RG_PIXEL_PAL is set
-    rg_line_diff_t diff[256];
+    int rect_count;        // Number of dirty rectangles (in source pixels) filled by rg_display_queue_update
+    rg_display_rect_t rects[RG_DISPLAY_MAX_RECTS];
 } rg_video_update_t;
 
 void rg_display_init(void);
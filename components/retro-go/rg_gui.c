@@ -929,6 +929,36 @@ static rg_gui_event_t speedup_update_cb(rg_gui_option_t *option, rg_gui_event_t
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t frameskip_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    int value = 0;
+    // 0 = Auto, 1 = Off (draw all), N = draw 1 of N
+    if (rg_system_get_frameskip(&value) == RG_FRAMESKIP_AUTO)
+        value = 0;
+
+    if (event == RG_DIALOG_PREV && --value < 0) value = 4;
+    if (event == RG_DIALOG_NEXT && ++value > 4) value = 0;
+
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+        rg_system_set_frameskip(value ? RG_FRAMESKIP_FIXED : RG_FRAMESKIP_AUTO, value);
+
+    if (value == 0)      strcpy(option->value, "Auto");
+    else if (value == 1) strcpy(option->value, "Off ");
+    else                 sprintf(option->value, "1/%d ", value);
+
+    return RG_DIALOG_VOID;
+}
+
+static rg_gui_event_t rewind_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+        rg_emu_set_rewind(!rg_emu_get_rewind());
+
+    strcpy(option->value, rg_emu_get_rewind() ? "On " : "Off");
+
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t disk_activity_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT) {
@@ -1001,6 +1031,9 @@ int rg_gui_options_menu(void)
         *opt++ = (rg_gui_option_t){0, "Filter", "None", 1, &filter_update_cb};
         *opt++ = (rg_gui_option_t){0, "Update", "Partial", 1, &update_mode_update_cb};
         *opt++ = (rg_gui_option_t){0, "Speed", "1x", 1, &speedup_update_cb};
+        *opt++ = (rg_gui_option_t){0, "Frameskip", "Auto", 1, &frameskip_update_cb};
+        if (app->handlers.saveStateStream)
+            *opt++ = (rg_gui_option_t){0, "Rewind", "Off", 1, &rewind_update_cb};
     }
 
     size_t extra_options = get_dialog_items_count(app->options);
@@ -1087,6 +1120,26 @@ int rg_gui_about_menu(const rg_gui_option_t *extra_options)
     return sel;
 }
 
+static void frame_timing_dialog(void)
+{
+    const char *names[RG_FRAME_PHASE_COUNT] = {"Input   ", "Emulate ", "Render  ", "Diff    ", "Display ", "Audio   "};
+    char values[RG_FRAME_PHASE_COUNT + 1][24];
+    rg_gui_option_t options[RG_FRAME_PHASE_COUNT + 2];
+    rg_stats_t stats = rg_system_get_counters();
+
+    for (int i = 0; i < RG_FRAME_PHASE_COUNT; ++i)
+    {
+        rg_frame_timing_t *timing = &stats.frameTiming[i];
+        sprintf(values[i], "%.1f/%.1f/%.1fms", timing->p50 / 1000.f, timing->p95 / 1000.f, timing->p99 / 1000.f);
+        options[i] = (rg_gui_option_t){0, names[i], values[i], 1, NULL};
+    }
+    sprintf(values[RG_FRAME_PHASE_COUNT], "%.1fKB %dus/frame", stats.bytesPerFrame / 1024.f, stats.diffPerFrame);
+    options[RG_FRAME_PHASE_COUNT] = (rg_gui_option_t){0, "Sent    ", values[RG_FRAME_PHASE_COUNT], 1, NULL};
+    options[RG_FRAME_PHASE_COUNT + 1] = (rg_gui_option_t)RG_DIALOG_CHOICE_LAST;
+
+    rg_gui_dialog("Frame timing (p50/95/99)", options, 0);
+}
+
 int rg_gui_debug_menu(const rg_gui_option_t *extra_options)
 {
     char screen_res[20], source_res[20], scaled_res[20];
@@ -1108,6 +1161,12 @@ int rg_gui_debug_menu(const rg_gui_option_t *extra_options)
         {3000, "Cheats", NULL, 1, NULL},
         {4000, "Crash", NULL, 1, NULL},
         {5000, "Random time", NULL, 1, NULL},
+        {7000, "Frame timing", NULL, 1, NULL},
+        {8000, rg_input_movie_mode() ? "Stop movie" : "Record movie", NULL, 1, NULL},
+        {8001, "Play movie", NULL, rg_input_movie_mode() ? 0 : 1, NULL},
+    #ifdef RG_ENABLE_PROFILING
+        {6000, "Save profile", NULL, 1, NULL},
+    #endif
         RG_DIALOG_CHOICE_LAST
     };
 
@@ -1143,6 +1202,29 @@ int rg_gui_debug_menu(const rg_gui_option_t *extra_options)
         struct timeval tv = {rand() % 1893474000, 0};
         settimeofday(&tv, NULL);
     }
+    else if (sel == 7000)
+    {
+        frame_timing_dialog();
+    }
+    else if (sel == 8000 || sel == 8001)
+    {
+        char *filename = rg_emu_get_path(RG_PATH_MOVIE, rg_system_get_app()->romPath);
+        if (rg_input_movie_mode())
+            rg_input_movie_stop();
+        else if (sel == 8000)
+            rg_input_movie_record(filename);
+        else if (!rg_input_movie_play(filename))
+            rg_gui_alert("Movie", "Unable to open the movie file");
+        free(filename);
+    }
+#ifdef RG_ENABLE_PROFILING
+    else if (sel == 6000)
+    {
+        rg_profiler_stop();
+        rg_profiler_export(RG_STORAGE_ROOT "/profile.json");
+        rg_profiler_start();
+    }
+#endif
 
     return sel;
 }
@@ -2,6 +2,7 @@
 #include "rg_input.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifdef RG_TARGET_SDL2
@@ -20,6 +21,17 @@ static bool input_task_running = false;
 static int64_t last_gamepad_read = 0;
 static uint32_t gamepad_state = -1; // _Atomic
 static int battery_level = -1;
+static struct
+{
+    rg_movie_mode_t mode;
+    rg_movie_header_t header;
+    char filename[RG_PATH_MAX];
+    bool pending;
+    uint32_t frame;
+    uint32_t current;
+    uint32_t romCRC; // Of the loaded ROM, computed when playback starts
+    FILE *fp;
+} movie;
 #if USE_ADC_DRIVER
 static esp_adc_cal_characteristics_t adc_chars;
 #endif
@@ -313,6 +325,10 @@ long rg_input_gamepad_last_read(void)
 uint32_t rg_input_read_gamepad(void)
 {
     last_gamepad_read = rg_system_timer();
+    if (movie.mode == RG_MOVIE_PLAYBACK && !movie.pending)
+        return movie.current | (gamepad_state & ~RG_MOVIE_KEYS);
+    if (movie.mode == RG_MOVIE_RECORD)
+        movie.current = gamepad_state & RG_MOVIE_KEYS;
     return gamepad_state;
 }
 
@@ -362,3 +378,150 @@ bool rg_input_read_battery(float *percent, float *volts)
 
     return true;
 }
+
+static char *movie_state_path(void)
+{
+    static char path[RG_PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s.sav", movie.filename);
+    return path;
+}
+
+bool rg_input_movie_record(const char *filename)
+{
+    RG_ASSERT(filename, "bad param");
+
+    rg_input_movie_stop();
+
+    if (!(movie.fp = fopen(filename, "wb")))
+    {
+        RG_LOGE("Unable to create movie '%s'!\n", filename);
+        return false;
+    }
+
+    rg_app_t *app = rg_system_get_app();
+    movie.header = (rg_movie_header_t){
+        .magic = RG_MOVIE_MAGIC,
+        .version = RG_MOVIE_VERSION,
+        .flags = app->handlers.saveState ? RG_MOVIE_FROM_STATE : 0,
+        .romCRC = rg_system_get_rom_crc32(),
+    };
+    strncpy(movie.header.app, app->name, sizeof(movie.header.app) - 1);
+    strncpy(movie.filename, filename, sizeof(movie.filename) - 1);
+    fwrite(&movie.header, sizeof(movie.header), 1, movie.fp);
+
+    movie.mode = RG_MOVIE_RECORD;
+    movie.pending = true;
+    movie.frame = 0;
+
+    RG_LOGI("Recording movie '%s'\n", filename);
+    return true;
+}
+
+bool rg_input_movie_play(const char *filename)
+{
+    RG_ASSERT(filename, "bad param");
+
+    rg_input_movie_stop();
+
+    if (!(movie.fp = fopen(filename, "rb")))
+    {
+        RG_LOGE("Unable to open movie '%s'!\n", filename);
+        return false;
+    }
+
+    if (fread(&movie.header, sizeof(movie.header), 1, movie.fp) != 1
+        || movie.header.magic != RG_MOVIE_MAGIC || movie.header.version != RG_MOVIE_VERSION)
+    {
+        RG_LOGE("Invalid movie file '%s'!\n", filename);
+        fclose(movie.fp);
+        movie.fp = NULL;
+        return false;
+    }
+
+    strncpy(movie.filename, filename, sizeof(movie.filename) - 1);
+    movie.romCRC = rg_system_get_rom_crc32();
+    movie.mode = RG_MOVIE_PLAYBACK;
+    movie.pending = true;
+    movie.frame = 0;
+    movie.current = 0;
+
+    RG_LOGI("Playing movie '%s' (%d frames)\n", filename, (int)movie.header.frames);
+    return true;
+}
+
+void rg_input_movie_stop(void)
+{
+    if (movie.mode == RG_MOVIE_NONE)
+        return;
+
+    if (movie.mode == RG_MOVIE_RECORD)
+    {
+        // Update the header now that we know the length
+        movie.header.frames = movie.frame;
+        fseek(movie.fp, 0, SEEK_SET);
+        fwrite(&movie.header, sizeof(movie.header), 1, movie.fp);
+    }
+
+    RG_LOGI("Movie stopped after %d frames.\n", (int)movie.frame);
+
+    fclose(movie.fp);
+    movie.fp = NULL;
+    movie.mode = RG_MOVIE_NONE;
+    movie.pending = false;
+}
+
+rg_movie_mode_t rg_input_movie_mode(void)
+{
+    return movie.mode;
+}
+
+void rg_input_movie_tick(void)
+{
+    if (movie.mode == RG_MOVIE_NONE)
+        return;
+
+    if (movie.pending)
+    {
+        // The emulator is known to be up and running by now, we can snapshot or restore its state
+        rg_app_t *app = rg_system_get_app();
+        bool from_state = movie.header.flags & RG_MOVIE_FROM_STATE;
+        bool success;
+
+        if (from_state && movie.mode == RG_MOVIE_RECORD)
+            success = app->handlers.saveState && app->handlers.saveState(movie_state_path());
+        else if (from_state)
+            success = app->handlers.loadState && app->handlers.loadState(movie_state_path());
+        else
+            success = rg_emu_reset(true);
+
+        if (!success)
+        {
+            RG_LOGE("Unable to restore the movie's starting point!\n");
+            rg_input_movie_stop();
+            return;
+        }
+
+        if (movie.mode == RG_MOVIE_PLAYBACK && movie.header.romCRC != movie.romCRC)
+            RG_LOGW("ROM CRC mismatch, the movie will probably desync!\n");
+
+        movie.pending = false;
+    }
+    else if (movie.mode == RG_MOVIE_RECORD)
+    {
+        fwrite(&movie.current, sizeof(movie.current), 1, movie.fp);
+        movie.frame++;
+        return;
+    }
+    else
+    {
+        movie.frame++;
+    }
+
+    // Fetch the state for the upcoming frame
+    if (movie.mode == RG_MOVIE_PLAYBACK && (movie.frame >= movie.header.frames
+        || fread(&movie.current, sizeof(movie.current), 1, movie.fp) != 1))
+    {
+        RG_LOGI("End of movie reached.\n");
+        rg_input_movie_stop();
+    }
+}
@@ -29,3 +29,34 @@ bool rg_input_key_is_pressed(rg_key_t key);
 void rg_input_wait_for_key(rg_key_t key, bool pressed);
 uint32_t rg_input_read_gamepad(void);
 bool rg_input_read_battery(float *percent, float *volts);
+
+// Input movies: one gamepad state per emulated frame, starting from a save state (or a reset).
+// Recording and playback actually start at the next rg_system_tick(), once the app is running.
+typedef enum
+{
+    RG_MOVIE_NONE = 0,
+    RG_MOVIE_RECORD,
+    RG_MOVIE_PLAYBACK,
+} rg_movie_mode_t;
+
+#define RG_MOVIE_MAGIC    0x564D4752 // "RGMV"
+#define RG_MOVIE_VERSION  1
+#define RG_MOVIE_KEYS     (RG_KEY_ALL & ~(RG_KEY_MENU|RG_KEY_OPTION))
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;     // RG_MOVIE_FROM_STATE if the movie starts from `<movie>.sav`, otherwise from a reset
+    uint32_t romCRC;    // CRC32 of the ROM file, checked (but not enforced) on playback
+    uint32_t frames;
+    char app[24];
+} rg_movie_header_t;
+
+#define RG_MOVIE_FROM_STATE 0x0001
+
+bool rg_input_movie_record(const char *filename);
+bool rg_input_movie_play(const char *filename);
+void rg_input_movie_stop(void);
+void rg_input_movie_tick(void);
+rg_movie_mode_t rg_input_movie_mode(void);
@@ -1,148 +1,354 @@
 #include "rg_system.h"
 #include "rg_profiler.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
 
 #ifdef RG_ENABLE_PROFILING
+#ifdef RG_TARGET_SDL2
+#include <SDL2/SDL.h>
+#else
 #include <freertos/FreeRTOS.h>
-#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#endif
 
 // Note this profiler might be inaccurate because of:
 // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=28205
 
-// We also need to add multi-core support. Currently it's not an issue
-// because all our profiled code runs on the same core.
+// Every thread records into its own rg_profile_thread_t, so the hooks never take a lock. The only
+// shared state is the slot counter (atomic) and the generation number, which tells each thread to
+// reset its own data after rg_profiler_start. Reading is done while the profiler is stopped.
 
 static rg_profile_t *profile;
-static SemaphoreHandle_t lock;
 static bool enabled = false;
+static __thread rg_profile_thread_t *current;
+static __thread bool unprofiled;
+
+NO_PROFILE static inline int64_t get_time(void)
+{
+#ifdef RG_TARGET_SDL2
+    return SDL_GetPerformanceCounter() * (1000000.0 / SDL_GetPerformanceFrequency());
+#else
+    // rg_system_timer() is itself instrumented, we can't call it from the hooks
+    return esp_timer_get_time();
+#endif
+}
+
+NO_PROFILE static rg_profile_thread_t *get_thread(void)
+{
+    if (current || unprofiled || !profile)
+        return current;
+
+    int index = __atomic_fetch_add(&profile->total_threads, 1, __ATOMIC_RELAXED);
+    if (index >= RG_PROFILER_MAX_THREADS)
+    {
+        unprofiled = true;
+        return NULL;
+    }
+
+    current = &profile->threads[index];
+#ifdef RG_TARGET_SDL2
+    snprintf(current->name, sizeof(current->name), "thread%d", index);
+#else
+    strncpy(current->name, pcTaskGetTaskName(NULL), sizeof(current->name) - 1);
+#endif
+
+    return current;
+}
 
-#define LOCK_PROFILE()   xSemaphoreTake(lock, pdMS_TO_TICKS(10000)); // {while(lock);lock=true;}
-#define UNLOCK_PROFILE() xSemaphoreGive(lock);                       // {lock = false;}
+NO_PROFILE static inline void sync_generation(rg_profile_thread_t *thread)
+{
+    if (thread->generation == profile->generation)
+        return;
 
-NO_PROFILE static inline rg_profile_frame_t *find_frame(void *this_fn, void *call_site)
+    memset(thread->frames, 0, sizeof(thread->frames));
+    thread->total_frames = 0;
+    thread->events_head = 0;
+    thread->generation = profile->generation;
+
+    // Frames on the stack belong to the previous run
+    for (int i = 0; i < RG_MIN(thread->depth, RG_PROFILER_MAX_DEPTH); ++i)
+        thread->stack[i].frame = NULL;
+}
+
+NO_PROFILE static inline rg_profile_frame_t *find_frame(rg_profile_thread_t *thread, void *ptr, void *caller, bool is_section)
 {
-    for (int i = 0; i < 512; ++i)
+    size_t index = (((uintptr_t)ptr >> 2) ^ ((uintptr_t)caller >> 4)) & (RG_PROFILER_MAX_FRAMES - 1);
+
+    for (size_t i = 0; i < RG_PROFILER_MAX_FRAMES; ++i)
     {
-        rg_profile_frame_t *frame = &profile->frames[i];
+        rg_profile_frame_t *frame = &thread->frames[(index + i) & (RG_PROFILER_MAX_FRAMES - 1)];
+
+        if (frame->func_ptr == ptr && frame->caller_ptr == caller)
+            return frame;
 
-        if (frame->func_ptr == 0)
+        if (frame->func_ptr == NULL)
         {
-            profile->total_frames = RG_MAX(profile->total_frames, i + 1);
-            frame->func_ptr = this_fn;
-            // frame->caller_ptr = call_site;
+            frame->func_ptr = ptr;
+            frame->caller_ptr = caller;
+            frame->is_section = is_section;
+            thread->total_frames++;
+            return frame;
         }
+    }
+
+    return NULL; // Table is full, drop it
+}
+
+NO_PROFILE static inline void add_event(rg_profile_thread_t *thread, uint8_t type, void *ptr, bool is_section, int64_t now)
+{
+    if (!thread->events)
+        return;
+
+    thread->events[thread->events_head++ & (RG_PROFILER_MAX_EVENTS - 1)] = (rg_profile_event_t){
+        .time = now - profile->time_started,
+        .ptr = ptr,
+        .type = type,
+        .is_section = is_section,
+    };
+}
+
+NO_PROFILE static void profile_enter(void *ptr, bool is_section)
+{
+    rg_profile_thread_t *thread = get_thread();
+
+    if (!thread || thread->busy)
+        return;
 
-        if (frame->func_ptr == this_fn) // && frame->caller_ptr == call_site)
+    thread->busy = true;
+
+    int64_t now = get_time();
+
+    if (thread->depth < RG_PROFILER_MAX_DEPTH)
+    {
+        // The caller is the nearest function, a section name isn't something we can symbolize
+        void *caller = thread->depth > 0 ? thread->stack[thread->depth - 1].function : NULL;
+        rg_profile_frame_t *frame = NULL;
+
+        if (enabled)
         {
-            return frame;
+            sync_generation(thread);
+            if ((frame = find_frame(thread, ptr, caller, is_section)))
+            {
+                frame->num_calls++;
+                frame->active++;
+            }
+            add_event(thread, 'B', ptr, is_section, now);
+        }
+
+        thread->stack[thread->depth].frame = frame;
+        thread->stack[thread->depth].enter_time = now;
+        thread->stack[thread->depth].ptr = ptr;
+        thread->stack[thread->depth].function = is_section ? caller : ptr;
+    }
+
+    // We keep counting past the maximum depth so that exits stay balanced
+    thread->depth++;
+    thread->busy = false;
+}
+
+NO_PROFILE static void profile_exit(void *ptr, bool is_section)
+{
+    rg_profile_thread_t *thread = get_thread();
+
+    if (!thread || thread->busy || thread->depth == 0)
+        return;
+
+    // Ignore exits that don't match our stack (function entered before the profiler was ready)
+    if (thread->depth <= RG_PROFILER_MAX_DEPTH && !is_section && thread->stack[thread->depth - 1].ptr != ptr)
+        return;
+
+    thread->busy = true;
+
+    int64_t now = get_time();
+
+    if (--thread->depth < RG_PROFILER_MAX_DEPTH)
+    {
+        rg_profile_frame_t *frame = thread->stack[thread->depth].frame;
+
+        if (enabled && frame && thread->generation == profile->generation)
+        {
+            if (--frame->active == 0)
+                frame->run_time += now - thread->stack[thread->depth].enter_time;
+            add_event(thread, 'E', thread->stack[thread->depth].ptr, is_section, now);
         }
     }
 
-    RG_PANIC("Profile memory exhausted!");
+    thread->busy = false;
 }
 
 NO_PROFILE void rg_profiler_init(void)
 {
-    profile = rg_alloc(sizeof(rg_profile_t), MEM_SLOW);
-    lock = xSemaphoreCreateMutex();
+    rg_profile_t *new_profile = rg_alloc(sizeof(rg_profile_t), MEM_SLOW);
+
+    for (size_t i = 0; i < RG_PROFILER_MAX_THREADS; ++i)
+        new_profile->threads[i].events = rg_alloc(RG_PROFILER_MAX_EVENTS * sizeof(rg_profile_event_t), MEM_SLOW);
+
+    profile = new_profile;
+
     RG_LOGI("init done.\n");
 }
 
+NO_PROFILE void rg_profiler_free(void)
+{
+    rg_profile_t *old_profile = profile;
+
+    enabled = false;
+    profile = NULL;
+
+    if (old_profile)
+    {
+        for (size_t i = 0; i < RG_PROFILER_MAX_THREADS; ++i)
+            free(old_profile->threads[i].events);
+        free(old_profile);
+    }
+}
+
 NO_PROFILE void rg_profiler_start(void)
 {
-    LOCK_PROFILE();
+    if (!profile)
+        return;
 
-    memset(profile, 0, sizeof(rg_profile_t));
-    profile->time_started = rg_system_timer();
+    profile->time_started = get_time();
+    profile->time_stopped = 0;
+    __atomic_add_fetch(&profile->generation, 1, __ATOMIC_RELEASE);
     enabled = true;
-
-    UNLOCK_PROFILE();
 }
 
 NO_PROFILE void rg_profiler_stop(void)
 {
+    if (!profile)
+        return;
+
     enabled = false;
+    profile->time_stopped = get_time();
 }
 
 NO_PROFILE void rg_profiler_print(void)
 {
+    rg_profile_thread_t *self = get_thread();
+
     if (!profile)
         return;
 
-    LOCK_PROFILE();
+    if (self)
+        self->busy = true;
+
+    int total_frames = 0;
+    int64_t time_stopped = profile->time_stopped ?: get_time();
+
+    for (int t = 0; t < RG_MIN(profile->total_threads, RG_PROFILER_MAX_THREADS); ++t)
+        if (profile->threads[t].generation == profile->generation)
+            total_frames += profile->threads[t].total_frames;
 
-    printf("RGD:PROF:BEGIN %d %d\n", profile->total_frames, (int)(rg_system_timer() - profile->time_started));
+    printf("RGD:PROF:BEGIN %d %d\n", total_frames, (int)(time_stopped - profile->time_started));
 
-    for (int i = 0; i < profile->total_frames; ++i)
+    for (int t = 0; t < RG_MIN(profile->total_threads, RG_PROFILER_MAX_THREADS); ++t)
     {
-        rg_profile_frame_t *frame = &profile->frames[i];
-
-        printf(
-            "RGD:PROF:DATA %p\t%p\t%u\t%u\n",
-            frame->caller_ptr,
-            frame->func_ptr,
-            frame->num_calls,
-            frame->run_time
-        );
-    }
+        rg_profile_thread_t *thread = &profile->threads[t];
 
-    printf("RGD:PROF:END\n");
+        if (thread->generation != profile->generation)
+            continue;
 
-    UNLOCK_PROFILE();
-}
+        for (int i = 0; i < RG_PROFILER_MAX_FRAMES; ++i)
+        {
+            rg_profile_frame_t *frame = &thread->frames[i];
 
-NO_PROFILE void rg_profiler_push(char *section_name)
-{
+            if (!frame->func_ptr)
+                continue;
 
-}
+            if (frame->is_section)
+                printf("RGD:PROF:SECTION %s\t%s\t%u\t%u\n", thread->name, (char *)frame->func_ptr,
+                       frame->num_calls, frame->run_time);
+            else
+                printf("RGD:PROF:DATA %p\t%p\t%u\t%u\n", frame->caller_ptr, frame->func_ptr,
+                       frame->num_calls, frame->run_time);
+        }
+    }
 
-NO_PROFILE void rg_profiler_pop(void)
-{
+    printf("RGD:PROF:END\n");
 
+    if (self)
+        self->busy = false;
 }
 
-NO_PROFILE void __cyg_profile_func_enter(void *this_fn, void *call_site)
+NO_PROFILE bool rg_profiler_export(const char *filename)
 {
-    if (!enabled)
-        return;
+    rg_profile_thread_t *self = get_thread();
+    FILE *fp;
 
-    int64_t now = rg_system_timer();
+    if (!profile)
+        return false;
 
-    LOCK_PROFILE();
+    if (self)
+        self->busy = true;
 
-    rg_profile_frame_t *fn = find_frame(this_fn, call_site);
+    // Chrome Trace Event format, can be opened in chrome://tracing or https://ui.perfetto.dev
+    if ((fp = fopen(filename, "w")))
+    {
+        const char *separator = "";
 
-    // Recursion will need a real stack, this is absurd
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
+        fputs("{\"traceEvents\":[\n", fp);
 
-    fn->enter_time = rg_system_timer(); // not now, because we delayed execution
-    fn->num_calls++;
+        for (int t = 0; t < RG_MIN(profile->total_threads, RG_PROFILER_MAX_THREADS); ++t)
+        {
+            rg_profile_thread_t *thread = &profile->threads[t];
+            uint32_t head = thread->events_head;
+            uint32_t start = head > RG_PROFILER_MAX_EVENTS ? head - RG_PROFILER_MAX_EVENTS : 0;
+
+            if (thread->generation != profile->generation)
+                continue;
+
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    separator, t, thread->name);
+            separator = ",\n";
+
+            for (uint32_t i = start; i < head; ++i)
+            {
+                rg_profile_event_t *event = &thread->events[i & (RG_PROFILER_MAX_EVENTS - 1)];
+
+                // Function addresses can be symbolized afterwards with addr2line
+                if (event->is_section)
+                    fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"section\",", (char *)event->ptr);
+                else
+                    fprintf(fp, ",\n{\"name\":\"%p\",\"cat\":\"function\",", event->ptr);
+                fprintf(fp, "\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":%d}", event->type, event->time, t);
+            }
+        }
 
-    UNLOCK_PROFILE();
-}
+        fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+        fclose(fp);
 
-NO_PROFILE void __cyg_profile_func_exit(void *this_fn, void *call_site)
-{
-    if (!enabled)
-        return;
+        RG_LOGI("Profile saved to '%s'.\n", filename);
+    }
 
-    int64_t now = rg_system_timer();
+    if (self)
+        self->busy = false;
 
-    LOCK_PROFILE();
+    return fp != NULL;
+}
 
-    rg_profile_frame_t *fn = find_frame(this_fn, call_site);
+NO_PROFILE void rg_profiler_push(char *section_name)
+{
+    profile_enter(section_name, true);
+}
 
-    // Ignore if profiler was disabled when function entered
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
+NO_PROFILE void rg_profiler_pop(void)
+{
+    profile_exit(NULL, true);
+}
 
-    fn->enter_time = 0;
+NO_PROFILE void __cyg_profile_func_enter(void *this_fn, void *call_site)
+{
+    profile_enter(this_fn, false);
+}
 
-    UNLOCK_PROFILE();
+NO_PROFILE void __cyg_profile_func_exit(void *this_fn, void *call_site)
+{
+    profile_exit(this_fn, false);
 }
 
 #endif
@@ -3,22 +3,54 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define RG_PROFILER_MAX_THREADS (4)    // Threads beyond this are not profiled
+#define RG_PROFILER_MAX_FRAMES  (512)  // Unique (function, caller) pairs per thread, must be a power of two
+#define RG_PROFILER_MAX_DEPTH   (64)   // Call stack depth per thread
+#define RG_PROFILER_MAX_EVENTS  (8192) // Trace events kept per thread (oldest are overwritten), power of two
+
 typedef struct
 {
-    void *func_ptr;
-    void *caller_ptr;
-    uint32_t enter_time;
+    void *func_ptr;     // Function address or section name
+    void *caller_ptr;   // Parent function address or section name
     uint32_t num_calls;
-    uint32_t run_time;
+    uint32_t run_time;  // Inclusive, in microseconds
+    uint16_t active;    // Recursion depth, run_time is only accumulated by the outermost call
+    uint16_t is_section;
 } rg_profile_frame_t;
 
+typedef struct
+{
+    uint32_t time;      // Microseconds since rg_profiler_start
+    void *ptr;          // Function address or section name
+    uint8_t type;       // 'B' or 'E' (chrome trace phases)
+    uint8_t is_section;
+} rg_profile_event_t;
+
+typedef struct
+{
+    char name[16];
+    uint32_t generation;
+    int32_t total_frames;
+    int32_t depth;
+    struct {
+        rg_profile_frame_t *frame;
+        int64_t enter_time;
+        void *ptr;
+        void *function; // Nearest function on the stack (ptr itself unless it's a section)
+    } stack[RG_PROFILER_MAX_DEPTH];
+    rg_profile_frame_t frames[RG_PROFILER_MAX_FRAMES];
+    rg_profile_event_t *events;
+    uint32_t events_head;
+    bool busy;
+} rg_profile_thread_t;
+
 typedef struct
 {
     int64_t time_started;
     int64_t time_stopped;
-    int32_t total_frames;
-    int32_t locked;
-    rg_profile_frame_t frames[512];
+    uint32_t generation;
+    int32_t total_threads;
+    rg_profile_thread_t threads[RG_PROFILER_MAX_THREADS];
 } rg_profile_t;
 
 #ifdef __cplusplus
@@ -30,6 +62,7 @@ void rg_profiler_free(void);
 void rg_profiler_start(void);
 void rg_profiler_stop(void);
 void rg_profiler_print(void);
+bool rg_profiler_export(const char *filename);
 void rg_profiler_push(char *section_name);
 void rg_profiler_pop(void);
 
@@ -56,6 +56,7 @@ typedef struct
 {
     uint32_t totalFrames, fullFrames, ticks;
     int64_t busyTime, updateTime;
+    int64_t diffTime, bytesSent;
 } counters_t;
 
 typedef struct
@@ -64,12 +65,89 @@ typedef struct
     char name[20];
 } rg_task_t;
 
+// Frame phase histograms. Buckets are 50us wide up to 2ms, then 500us wide up to 32ms.
+#define FRAME_BUCKETS 100
+#define FRAME_BUCKET(us) ((us) < 2000 ? (us) / 50 : RG_MIN(40 + ((us) - 2000) / 500, FRAME_BUCKETS - 1))
+#define FRAME_BUCKET_TIME(b) ((b) < 40 ? (b) * 50 + 25 : 2000 + ((b) - 40) * 500 + 250)
+typedef struct
+{
+    int32_t current[RG_FRAME_PHASE_COUNT];
+    uint16_t histogram[RG_FRAME_PHASE_COUNT][FRAME_BUCKETS];
+    int64_t lastMark;
+    int32_t nested;
+} frame_timing_t;
+
+#ifdef RG_TARGET_SDL2
+typedef struct
+{
+    bool enabled;
+    int frames;             // Frames to run before reporting and exiting
+    int frame;
+    uint32_t videoCRC;
+    uint32_t audioCRC;
+    int videoFrames;
+    size_t audioBytes;
+    int64_t startTime;
+    int64_t lastTick;
+    int maxFrameTime;
+    uint32_t histogram[FRAME_BUCKETS];
+} benchmark_t;
+#endif
+
+// Rewind snapshots are stored as a XOR delta against the next (newer) snapshot, packed as
+// runs of [zeros:u16][literals:u16][literal bytes...]. Only the newest state is kept whole,
+// stepping back applies the deltas one at a time. The oldest deltas are dropped when full.
+#define REWIND_MAX_RECORDS 256
+#define REWIND_HOLD_TICKS 3
+typedef struct
+{
+    bool enabled;
+    uint8_t *arena;         // Packed deltas
+    size_t arenaSize;
+    size_t head;            // Next write offset in arena
+    uint8_t *current;       // Scratch state, zero padded past currentSize
+    uint8_t *previous;      // Newest snapshot, zero padded past previousSize
+    size_t currentSize, previousSize;
+    size_t capacity;        // Size of current and previous
+    struct {uint32_t offset, length, size;} records[REWIND_MAX_RECORDS];
+    int first, count;
+    int counter;
+    int holdCounter;
+    bool hasSnapshot;
+    bool stepped;
+    int64_t lastTime;       // Duration of the last snapshot, reported in the stats log
+} rewind_t;
+
+typedef struct
+{
+    rg_frameskip_t mode;
+    int value;
+    int forceSkip;
+    int consecutiveSkips;
+    uint32_t frames;
+    bool drawing;           // Decision taken for the frame in progress
+    int32_t lag;
+    int32_t drawCost;
+    int32_t skipCost;
+    int32_t samplesPerFrame; // Fixed point 28.4, averaged because some apps submit audio from another task
+    int32_t lastSamples;
+    int32_t lastUnderruns;
+} scheduler_t;
+
 // The trace will survive a software reset
 static RTC_NOINIT_ATTR panic_trace_t panicTrace;
 static rg_stats_t statistics;
 static rg_app_t app;
 static logbuf_t logbuf;
 static rg_task_t tasks[8];
+static frame_timing_t frameTiming;
+static scheduler_t scheduler;
+static rewind_t rewinder;
+
+static void rewind_tick(void);
+#ifdef RG_TARGET_SDL2
+static benchmark_t benchmark;
+#endif
 static int ledValue = -1;
 static int wdtCounter = 0;
 static bool exitCalled = false;
@@ -78,6 +156,7 @@ static bool initialized = false;
 static const char *SETTING_BOOT_NAME = "BootName";
 static const char *SETTING_BOOT_ARGS = "BootArgs";
 static const char *SETTING_BOOT_FLAGS = "BootFlags";
+static const char *SETTING_FRAMESKIP = "Frameskip";
 
 
 static void rtc_time_init(void)
@@ -168,6 +247,35 @@ static void update_memory_statistics(void)
     statistics.freeStackMain = uxTaskGetStackHighWaterMark(tasks[0].handle);
 }
 
+static void update_frame_timing(void)
+{
+    for (int phase = 0; phase < RG_FRAME_PHASE_COUNT; ++phase)
+    {
+        uint16_t *histogram = frameTiming.histogram[phase];
+        rg_frame_timing_t *timing = &statistics.frameTiming[phase];
+        int total = 0, count = 0;
+
+        for (int i = 0; i < FRAME_BUCKETS; ++i)
+            total += histogram[i];
+
+        *timing = (rg_frame_timing_t){0, 0, 0};
+
+        for (int i = 0; i < FRAME_BUCKETS && total > 0; ++i)
+        {
+            count += histogram[i];
+            if (!timing->p50 && count * 100 >= total * 50)
+                timing->p50 = FRAME_BUCKET_TIME(i);
+            if (!timing->p95 && count * 100 >= total * 95)
+                timing->p95 = FRAME_BUCKET_TIME(i);
+            if (!timing->p99 && count * 100 >= total * 99)
+                timing->p99 = FRAME_BUCKET_TIME(i);
+        }
+
+        // It's a rolling window, we don't care if we lose a frame or two to a race with rg_system_tick
+        memset(histogram, 0, sizeof(frameTiming.histogram[0]));
+    }
+}
+
 static void update_statistics(void)
 {
     static counters_t counters = {0};
@@ -181,6 +289,8 @@ static void update_statistics(void)
     counters.busyTime = statistics.busyTime;
     counters.ticks = statistics.ticks;
     counters.updateTime = rg_system_timer();
+    counters.diffTime = display.diffTime;
+    counters.bytesSent = display.bytesSent;
 
     float elapsedTime = (counters.updateTime - previous.updateTime) / 1000000.f;
     statistics.busyPercent = RG_MIN((counters.busyTime - previous.busyTime) / (elapsedTime * 1000000.f) * 100.f, 100.f);
@@ -188,7 +298,12 @@ static void update_statistics(void)
     statistics.skippedFPS = statistics.totalFPS - ((counters.totalFrames - previous.totalFrames) / elapsedTime);
     statistics.fullFPS = (counters.fullFrames - previous.fullFrames) / elapsedTime;
 
+    int frames = RG_MAX(counters.totalFrames - previous.totalFrames, 1);
+    statistics.bytesPerFrame = (counters.bytesSent - previous.bytesSent) / frames;
+    statistics.diffPerFrame = (counters.diffTime - previous.diffTime) / frames;
+
     update_memory_statistics();
+    update_frame_timing();
 }
 
 static void system_monitor_task(void *arg)
@@ -230,6 +345,22 @@ static void system_monitor_task(void *arg)
             (int)(statistics.fullFPS + 0.9f),
             batteryPercent);
 
+        #define FRAME_TIMING(phase) statistics.frameTiming[phase].p50 / 1000.f, \
+            statistics.frameTiming[phase].p95 / 1000.f, statistics.frameTiming[phase].p99 / 1000.f
+        RG_LOGD("INPUT:%.1f/%.1f/%.1f, EMU:%.1f/%.1f/%.1f, RENDER:%.1f/%.1f/%.1f, DIFF:%.1f/%.1f/%.1f, "
+                "DISP:%.1f/%.1f/%.1f, AUDIO:%.1f/%.1f/%.1f (ms p50/p95/p99)\n",
+            FRAME_TIMING(RG_FRAME_PHASE_INPUT), FRAME_TIMING(RG_FRAME_PHASE_EMULATE),
+            FRAME_TIMING(RG_FRAME_PHASE_RENDER), FRAME_TIMING(RG_FRAME_PHASE_DIFF),
+            FRAME_TIMING(RG_FRAME_PHASE_DISPLAY), FRAME_TIMING(RG_FRAME_PHASE_AUDIO));
+        #undef FRAME_TIMING
+        RG_LOGD("SCHED: budget=%d lag=%d draw=%d skip=%d (us)\n", statistics.frameBudget,
+            statistics.frameLag, statistics.drawCost, statistics.skipCost);
+        RG_LOGD("DISPLAY: sent=%d bytes/frame diff=%d us/frame\n", statistics.bytesPerFrame,
+            statistics.diffPerFrame);
+        if (rewinder.enabled)
+            RG_LOGD("REWIND: snapshot=%d us records=%d arena=%d/%d bytes\n", (int)rewinder.lastTime,
+                rewinder.count, (int)rewinder.head, (int)rewinder.arenaSize);
+
         if ((wdtCounter -= loopTime_us) <= 0)
         {
             if (rg_input_gamepad_last_read() > WDT_TIMEOUT)
@@ -249,6 +380,9 @@ static void system_monitor_task(void *arg)
             {
                 rg_profiler_stop();
                 rg_profiler_print();
+            #ifdef RG_TARGET_SDL2
+                rg_profiler_export(RG_STORAGE_ROOT "/profile.json");
+            #endif
                 rg_profiler_start();
             }
         #endif
@@ -303,6 +437,98 @@ static void setup_gpios(void)
 #endif
 }
 
+#ifdef RG_TARGET_SDL2
+static void benchmark_init(void)
+{
+    const char *frames = getenv("RG_BENCHMARK_FRAMES");
+    const char *rom = getenv("RG_BENCHMARK_ROM");
+    const char *input = getenv("RG_BENCHMARK_INPUT");
+
+    if (!frames || atoi(frames) <= 0)
+        return;
+
+    benchmark = (benchmark_t){.enabled = true, .frames = atoi(frames)};
+
+    if (rom && rom[0])
+        app.romPath = rom;
+
+    // The movie starts on the first tick, same as the measurement
+    if (input && input[0])
+        rg_input_movie_play(input);
+
+    RG_LOGI("Benchmark mode: rom='%s' frames=%d input='%s'\n", app.romPath ?: "",
+        benchmark.frames, input ?: "");
+}
+
+static void benchmark_tick(void)
+{
+    int64_t now = rg_system_timer();
+
+    // The first frame includes loading and warming up, it isn't part of the measurement
+    if (benchmark.frame++ == 0)
+    {
+        benchmark.startTime = benchmark.lastTick = now;
+        return;
+    }
+
+    int frameTime = now - benchmark.lastTick;
+    benchmark.histogram[FRAME_BUCKET(frameTime)]++;
+    benchmark.maxFrameTime = RG_MAX(benchmark.maxFrameTime, frameTime);
+    benchmark.lastTick = now;
+
+    if (benchmark.frame <= benchmark.frames)
+        return;
+
+    int frames = benchmark.frames, count = 0;
+    int p50 = 0, p95 = 0, p99 = 0;
+    for (int i = 0; i < FRAME_BUCKETS; ++i)
+    {
+        count += benchmark.histogram[i];
+        if (!p50 && count * 100 >= frames * 50)
+            p50 = FRAME_BUCKET_TIME(i);
+        if (!p95 && count * 100 >= frames * 95)
+            p95 = FRAME_BUCKET_TIME(i);
+        if (!p99 && count * 100 >= frames * 99)
+            p99 = FRAME_BUCKET_TIME(i);
+    }
+
+    float seconds = (now - benchmark.startTime) / 1000000.f;
+    rg_display_counters_t display = rg_display_get_counters();
+    int drawn = RG_MAX(display.totalFrames, 1);
+
+    // Same RGD: format as the profiler, so that the output can be collected from the logs
+    printf("RGD:BENCH:BEGIN %s %s\n", app.name, app.romPath ?: "");
+    printf("RGD:BENCH:SPEED frames=%d time=%.3f fps=%.2f\n", frames, seconds, frames / seconds);
+    printf("RGD:BENCH:FRAMETIME p50=%d p95=%d p99=%d max=%d\n", p50, p95, p99, benchmark.maxFrameTime);
+    printf("RGD:BENCH:VIDEO crc=%08X frames=%d\n", (unsigned)benchmark.videoCRC, benchmark.videoFrames);
+    printf("RGD:BENCH:AUDIO crc=%08X bytes=%d\n", (unsigned)benchmark.audioCRC, (int)benchmark.audioBytes);
+    printf("RGD:BENCH:DISPLAY frames=%d full=%d bytes/frame=%d diff_us/frame=%d\n", (int)display.totalFrames,
+        (int)display.fullFrames, (int)(display.bytesSent / drawn), (int)(display.diffTime / drawn));
+    printf("RGD:BENCH:END\n");
+    fflush(stdout);
+
+    exitCalled = true; // Don't go back to the launcher
+    exit(0);
+}
+
+bool rg_benchmark_enabled(void)
+{
+    return benchmark.enabled;
+}
+
+void rg_benchmark_feed_video(const void *data, size_t length)
+{
+    benchmark.videoCRC = rg_crc32(benchmark.videoCRC, data, length);
+    benchmark.videoFrames++;
+}
+
+void rg_benchmark_feed_audio(const void *data, size_t length)
+{
+    benchmark.audioCRC = rg_crc32(benchmark.audioCRC, data, length);
+    benchmark.audioBytes += length;
+}
+#endif
+
 rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg_gui_option_t *options)
 {
     const esp_app_desc_t *esp_app = esp_ota_get_app_description();
@@ -364,6 +590,15 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg
         app.romPath = app.bootArgs;
     }
 
+    #ifdef RG_TARGET_SDL2
+    benchmark_init();
+    #endif
+
+    // 0 means auto, otherwise it's the fixed ratio
+    int frameskip = rg_settings_get_number(NS_APP, SETTING_FRAMESKIP, 0);
+    scheduler.mode = frameskip > 0 ? RG_FRAMESKIP_FIXED : RG_FRAMESKIP_AUTO;
+    scheduler.value = RG_MAX(frameskip, 0);
+
     rg_input_init(); // Must be first for the qtpy (input -> aw9523 -> lcd)
     rg_display_init();
     rg_gui_init();
@@ -489,16 +724,174 @@ rg_app_t *rg_system_get_app(void)
     return &app;
 }
 
+uint32_t rg_system_get_rom_crc32(void)
+{
+    // Reading the whole ROM is slow, so it's done at most once per ROM
+    static const char *cached_path = NULL;
+    static uint32_t cached_crc = 0;
+    const char *path = rg_system_get_app()->romPath;
+    uint32_t crc = 0;
+    uint8_t buffer[512];
+    size_t count;
+
+    if (path && path == cached_path)
+        return cached_crc;
+
+    FILE *fp = path ? fopen(path, "rb") : NULL;
+    if (!fp)
+        return 0;
+    while ((count = fread(buffer, 1, sizeof(buffer), fp)))
+        crc = rg_crc32(crc, buffer, count);
+    fclose(fp);
+
+    cached_path = path;
+    cached_crc = crc;
+
+    return crc;
+}
+
 rg_stats_t rg_system_get_counters(void)
 {
     return statistics;
 }
 
+static void scheduler_update(int elapsed)
+{
+    rg_audio_counters_t audio = rg_audio_get_counters();
+    int sampleRate = rg_audio_get_sample_rate();
+    int samples = audio.samples - scheduler.lastSamples;
+    int budget;
+
+    if (!scheduler.samplesPerFrame && sampleRate > 0)
+        scheduler.samplesPerFrame = (sampleRate << 4) / RG_MAX(app.refreshRate, 1);
+    scheduler.samplesPerFrame += ((samples << 4) - scheduler.samplesPerFrame) / 16;
+    scheduler.lastSamples = audio.samples;
+
+    // The audio we produce is the real time that a frame covers, it already accounts for speed
+    if (sampleRate > 0 && scheduler.samplesPerFrame > 0)
+        budget = ((int64_t)scheduler.samplesPerFrame * 1000000 / sampleRate) >> 4;
+    else
+        budget = 1000000 / (RG_MAX(app.refreshRate, 1) * app.speed);
+
+    if (scheduler.drawing)
+        scheduler.drawCost += (elapsed - scheduler.drawCost) / 8;
+    else
+        scheduler.skipCost += (elapsed - scheduler.skipCost) / 8;
+
+    // When we're early the audio sink blocks, so we can't get ahead of real time
+    scheduler.lag = RG_MIN(RG_MAX(scheduler.lag + elapsed - budget, 0), budget * 4);
+
+    // The sink ran dry, we're later than we thought
+    if (audio.underruns != scheduler.lastUnderruns)
+        scheduler.lag = RG_MIN(scheduler.lag + budget, budget * 4);
+    scheduler.lastUnderruns = audio.underruns;
+
+    statistics.frameBudget = budget;
+    statistics.frameLag = scheduler.lag;
+    statistics.drawCost = scheduler.drawCost;
+    statistics.skipCost = scheduler.skipCost;
+}
+
+IRAM_ATTR bool rg_system_schedule_frame(void)
+{
+    int budget = statistics.frameBudget;
+    bool draw;
+
+    scheduler.frames++;
+
+#ifdef RG_TARGET_SDL2
+    // Skipping depends on timing, the benchmark's video CRC must not. Every frame is drawn.
+    if (benchmark.enabled)
+        draw = true;
+    else
+#endif
+    if (scheduler.forceSkip > 0)
+    {
+        scheduler.forceSkip--;
+        draw = false;
+    }
+    else if (scheduler.mode == RG_FRAMESKIP_FIXED)
+    {
+        draw = (scheduler.frames % RG_MAX(scheduler.value, 1)) == 0;
+    }
+    else
+    {
+        // Draw if we'd still be within the target latency afterwards. We never skip too many
+        // frames in a row, a slideshow is better than a frozen screen.
+        int target = scheduler.value > 0 ? scheduler.value : budget;
+        int maxSkips = RG_MAX(3, (int)(app.speed * 3));
+        draw = scheduler.consecutiveSkips >= maxSkips
+            || scheduler.lag + scheduler.drawCost - budget <= target;
+    }
+
+    scheduler.consecutiveSkips = draw ? 0 : scheduler.consecutiveSkips + 1;
+    scheduler.drawing = draw;
+
+    return draw;
+}
+
+void rg_system_skip_frames(int count)
+{
+    scheduler.forceSkip = RG_MAX(count, 0);
+}
+
+void rg_system_set_frameskip(rg_frameskip_t mode, int value)
+{
+    scheduler.mode = mode;
+    scheduler.value = RG_MAX(value, 0);
+    rg_settings_set_number(NS_APP, SETTING_FRAMESKIP, mode == RG_FRAMESKIP_FIXED ? RG_MAX(value, 1) : 0);
+}
+
+rg_frameskip_t rg_system_get_frameskip(int *value)
+{
+    if (value)
+        *value = scheduler.value;
+    return scheduler.mode;
+}
+
 IRAM_ATTR void rg_system_tick(int busyTime)
 {
     statistics.busyTime += busyTime;
     statistics.ticks++;
     // WDT_RELOAD(WDT_TIMEOUT);
+
+    scheduler_update(busyTime);
+
+    // Commit the frame's phase timings, phases that weren't marked this frame are skipped
+    for (int phase = 0; phase < RG_FRAME_PHASE_COUNT; ++phase)
+    {
+        if (frameTiming.current[phase] > 0)
+            frameTiming.histogram[phase][FRAME_BUCKET(frameTiming.current[phase])]++;
+        frameTiming.current[phase] = 0;
+    }
+
+    rg_input_movie_tick();
+
+    if (rewinder.enabled)
+        rewind_tick();
+
+    #ifdef RG_TARGET_SDL2
+    if (benchmark.enabled)
+        benchmark_tick();
+    #endif
+}
+
+IRAM_ATTR void rg_system_frame_mark(rg_frame_phase_t phase)
+{
+    // Time since the previous mark goes to `phase`, minus what was reported by rg_system_frame_add
+    // in the meantime (display and audio are usually called from within the emulation phase)
+    int64_t now = rg_system_timer();
+    if (frameTiming.lastMark && phase < RG_FRAME_PHASE_COUNT)
+        frameTiming.current[phase] += RG_MAX((int)(now - frameTiming.lastMark) - frameTiming.nested, 0);
+    frameTiming.lastMark = now;
+    frameTiming.nested = 0;
+}
+
+IRAM_ATTR void rg_system_frame_add(rg_frame_phase_t phase, int elapsed)
+{
+    if (phase < RG_FRAME_PHASE_COUNT)
+        frameTiming.current[phase] += elapsed;
+    frameTiming.nested += elapsed;
 }
 
 IRAM_ATTR int64_t rg_system_timer(void)
@@ -522,7 +915,7 @@ char *rg_emu_get_path(rg_path_type_t pathType, const char *filename)
     if (!buffer)
         RG_PANIC("Out of memory!");
 
-    if (type == RG_PATH_SAVE_STATE || type == RG_PATH_SAVE_SRAM)
+    if (type == RG_PATH_SAVE_STATE || type == RG_PATH_SAVE_SRAM || type == RG_PATH_MOVIE)
         strcpy(buffer, RG_BASE_PATH_SAVES);
     else if (type == RG_PATH_SCREENSHOT)
         strcpy(buffer, RG_BASE_PATH_SAVES);
@@ -553,6 +946,8 @@ char *rg_emu_get_path(rg_path_type_t pathType, const char *filename)
             strcat(buffer, ".sram");
         else if (type == RG_PATH_SCREENSHOT)
             strcat(buffer, ".png");
+        else if (type == RG_PATH_MOVIE)
+            strcat(buffer, ".rgm");
     }
 
     // Don't shrink the buffer, we could use the extra space (append extension, etc).
@@ -758,12 +1153,267 @@ bool rg_emu_reset(bool hard)
     return false;
 }
 
+static size_t rewind_pack(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t length)
+{
+    uint8_t *start = out;
+    size_t pos = 0;
+
+    while (pos < length)
+    {
+        size_t zeros = pos;
+        while (pos < length && (pos & 3) && a[pos] == b[pos] && pos - zeros < 0xFFFF)
+            pos++;
+        while (pos + 4 <= length && !(pos & 3) && *(uint32_t *)(a + pos) == *(uint32_t *)(b + pos)
+            && pos - zeros <= 0xFFFF - 4)
+            pos += 4;
+        while (pos < length && a[pos] == b[pos] && pos - zeros < 0xFFFF)
+            pos++;
+        zeros = pos - zeros;
+
+        // Literals run until we find at least 4 unchanged bytes
+        size_t literals = pos;
+        while (pos < length && pos - literals < 0xFFFF)
+        {
+            if (pos + 4 <= length && a[pos] == b[pos] && a[pos + 1] == b[pos + 1]
+                && a[pos + 2] == b[pos + 2] && a[pos + 3] == b[pos + 3])
+                break;
+            pos++;
+        }
+        literals = pos - literals;
+
+        *out++ = zeros & 0xFF;
+        *out++ = zeros >> 8;
+        *out++ = literals & 0xFF;
+        *out++ = literals >> 8;
+        for (size_t i = pos - literals; i < pos; i++)
+            *out++ = a[i] ^ b[i];
+    }
+
+    return out - start;
+}
+
+static void rewind_unpack(uint8_t *state, const uint8_t *in, size_t length)
+{
+    const uint8_t *end = in + length;
+    size_t pos = 0;
+
+    while (in < end)
+    {
+        pos += in[0] | (in[1] << 8);
+        size_t literals = in[2] | (in[3] << 8);
+        in += 4;
+        while (literals--)
+            state[pos++] ^= *in++;
+    }
+}
+
+static bool rewind_resize(size_t capacity)
+{
+    void *current = realloc(rewinder.current, capacity);
+    void *previous = current ? realloc(rewinder.previous, capacity) : NULL;
+    if (current)
+        rewinder.current = current;
+    if (previous)
+        rewinder.previous = previous;
+    if (!current || !previous)
+        return false;
+    memset(rewinder.current + rewinder.capacity, 0, capacity - rewinder.capacity);
+    memset(rewinder.previous + rewinder.capacity, 0, capacity - rewinder.capacity);
+    rewinder.capacity = capacity;
+    return true;
+}
+
+static bool rewind_snapshot(void)
+{
+    FILE *fp = NULL;
+    long size = 0;
+
+    // The stream must not fill up, otherwise we can't tell a truncated state from a complete one
+    for (int tries = 0; tries < 4; ++tries)
+    {
+        if ((fp = fmemopen(rewinder.current, rewinder.capacity, "wb")))
+        {
+            bool success = app.handlers.saveStateStream(fp);
+            size = ftell(fp);
+            fclose(fp);
+            if (success && size > 0 && (size_t)size < rewinder.capacity - 1)
+                break;
+        }
+        size = 0;
+        if (!rewind_resize(rewinder.capacity * 2))
+            break;
+    }
+
+    if (size <= 0)
+    {
+        RG_LOGE("Snapshot failed, disabling rewind.\n");
+        rg_emu_set_rewind(false);
+        return false;
+    }
+
+    // fmemopen writes a null terminator, and the previous contents may be longer than this state
+    if (rewinder.currentSize > (size_t)size)
+        memset(rewinder.current + size, 0, rewinder.currentSize - size);
+    rewinder.current[size] = 0;
+    rewinder.currentSize = size;
+
+    if (rewinder.hasSnapshot)
+    {
+        size_t length = RG_MAX(rewinder.currentSize, rewinder.previousSize);
+        size_t bound = length + (length / 0xFFFF + 1) * 8;
+
+        if (rewinder.head + bound > rewinder.arenaSize)
+            rewinder.head = 0;
+
+        // Drop the oldest records overlapping the region we're about to write
+        while (rewinder.count > 0)
+        {
+            int index = rewinder.first;
+            uint32_t offset = rewinder.records[index].offset;
+            uint32_t end = offset + rewinder.records[index].length;
+            if (rewinder.count < REWIND_MAX_RECORDS && (end <= rewinder.head || offset >= rewinder.head + bound))
+                break;
+            rewinder.first = (rewinder.first + 1) % REWIND_MAX_RECORDS;
+            rewinder.count--;
+        }
+
+        if (bound <= rewinder.arenaSize)
+        {
+            int index = (rewinder.first + rewinder.count++) % REWIND_MAX_RECORDS;
+            rewinder.records[index].offset = rewinder.head;
+            rewinder.records[index].length = rewind_pack(rewinder.arena + rewinder.head, rewinder.previous, rewinder.current, length);
+            rewinder.records[index].size = rewinder.previousSize;
+            rewinder.head += rewinder.records[index].length;
+        }
+        else
+        {
+            // The chain of deltas is broken, older records are useless now
+            rewinder.count = 0;
+        }
+    }
+
+    uint8_t *temp = rewinder.previous;
+    rewinder.previous = rewinder.current;
+    rewinder.current = temp;
+    size_t temp_size = rewinder.previousSize;
+    rewinder.previousSize = rewinder.currentSize;
+    rewinder.currentSize = temp_size;
+    rewinder.hasSnapshot = true;
+    rewinder.stepped = false;
+
+    return true;
+}
+
+static void rewind_tick(void)
+{
+    // Movies must stay deterministic, and rewinding mid-movie makes no sense anyway
+    if (rg_input_movie_mode() != RG_MOVIE_NONE)
+        return;
+
+    if ((rg_input_read_gamepad() & RG_REWIND_BTN) == RG_REWIND_BTN)
+    {
+        if (rewinder.holdCounter++ % REWIND_HOLD_TICKS == 0)
+            rg_emu_rewind();
+        rewinder.counter = 0;
+        return;
+    }
+
+    rewinder.holdCounter = 0;
+
+    if (++rewinder.counter >= RG_REWIND_INTERVAL)
+    {
+        int64_t startTime = rg_system_timer();
+        rewind_snapshot();
+        rewinder.lastTime = rg_system_timer() - startTime;
+        rewinder.counter = 0;
+    }
+}
+
+bool rg_emu_rewind(void)
+{
+    if (!rewinder.enabled || !rewinder.hasSnapshot)
+        return false;
+
+    // The first step goes back to the newest snapshot, then we walk the deltas
+    if (rewinder.stepped)
+    {
+        if (rewinder.count == 0)
+            return false;
+
+        int index = (rewinder.first + --rewinder.count) % REWIND_MAX_RECORDS;
+        size_t length = RG_MAX(rewinder.previousSize, (size_t)rewinder.records[index].size);
+        rewind_unpack(rewinder.previous, rewinder.arena + rewinder.records[index].offset, rewinder.records[index].length);
+        memset(rewinder.previous + rewinder.records[index].size, 0, length - rewinder.records[index].size);
+        rewinder.previousSize = rewinder.records[index].size;
+        rewinder.head = rewinder.records[index].offset;
+    }
+    rewinder.stepped = true;
+
+    FILE *fp = fmemopen(rewinder.previous, rewinder.previousSize, "rb");
+    bool success = fp && app.handlers.loadStateStream(fp);
+    if (fp)
+        fclose(fp);
+
+    if (!success)
+        RG_LOGE("Failed to restore rewind snapshot!\n");
+
+    return success;
+}
+
+bool rg_emu_set_rewind(bool enable)
+{
+    if (enable && !rewinder.enabled)
+    {
+        if (!app.handlers.saveStateStream || !app.handlers.loadStateStream)
+        {
+            RG_LOGW("This app doesn't support rewind.\n");
+            return false;
+        }
+
+        rewinder = (rewind_t){0};
+        // rg_alloc would panic, rewind is optional so we just turn it off if memory is short
+    #ifdef RG_TARGET_SDL2
+        rewinder.arena = malloc(RG_REWIND_BUDGET);
+    #else
+        rewinder.arena = heap_caps_malloc(RG_REWIND_BUDGET, MALLOC_CAP_SPIRAM);
+    #endif
+        rewinder.arenaSize = RG_REWIND_BUDGET;
+
+        if (!rewinder.arena || !rewind_resize(64 * 1024))
+        {
+            RG_LOGW("Not enough memory for rewind, it will stay off.\n");
+            enable = false;
+        }
+        else
+        {
+            rewinder.enabled = true;
+            RG_LOGI("Rewind enabled: budget=%d interval=%d\n", RG_REWIND_BUDGET, RG_REWIND_INTERVAL);
+        }
+    }
+
+    if (!enable)
+    {
+        free(rewinder.arena);
+        free(rewinder.current);
+        free(rewinder.previous);
+        rewinder = (rewind_t){0};
+    }
+
+    return rewinder.enabled;
+}
+
+bool rg_emu_get_rewind(void)
+{
+    return rewinder.enabled;
+}
+
 static void shutdown_cleanup(void)
 {
     rg_display_clear(C_BLACK);                  // Let the user know that something is happening
     rg_gui_draw_hourglass();                    // ...
     rg_system_event(RG_EVENT_SHUTDOWN, NULL);   // Allow apps to save their state if they want
     rg_audio_deinit();                          // Disable sound ASAP to avoid audio garbage
+    rg_input_movie_stop();                      // Finish the recording's header before storage goes away
     rtc_time_save();                            // RTC might save to storage, do it before
     rg_storage_deinit();                        // Unmount storage
     rg_input_wait_for_key(RG_KEY_ALL, false);   // Wait for all keys to be released (boot is sensitive to GPIO0,32,33)
@@ -930,9 +1580,28 @@ int rg_system_get_led(void)
 
 uint32_t rg_crc32(uint32_t crc, const uint8_t* buf, uint32_t len)
 {
+#ifdef RG_TARGET_SDL2
+    // Same result as the ROM's crc32_le (reflected 0xEDB88320, inverted in and out)
+    static uint32_t table[256];
+    if (!table[1])
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t value = i;
+            for (int j = 0; j < 8; ++j)
+                value = (value >> 1) ^ (0xEDB88320 & -(value & 1));
+            table[i] = value;
+        }
+    }
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+#else
     // This is part of the ROM but finding the correct header is annoying as it differs per SOC...
     extern uint32_t crc32_le(uint32_t crc, const uint8_t * buf, uint32_t len);
     return crc32_le(crc, buf, len);
+#endif
 }
 
 // Note: You should use calloc/malloc everywhere possible. This function is used to ensure
@@ -44,6 +44,7 @@ typedef enum
     RG_PATH_ROM_FILE   = 0x400,
     RG_PATH_CACHE_FILE = 0x500,
     RG_PATH_GAME_CONFIG= 0x600,
+    RG_PATH_MOVIE      = 0x700,
 } rg_path_type_t;
 
 enum
@@ -107,7 +108,30 @@ typedef enum
     RG_EVENT_MASK         = 0xFFFF,
 } rg_event_t;
 
+typedef enum
+{
+    RG_FRAME_PHASE_INPUT = 0, // Reading input and main loop overhead
+    RG_FRAME_PHASE_EMULATE,   // CPU emulation, minus the rendering reported below
+    RG_FRAME_PHASE_RENDER,    // PPU/VDP scanline rendering, reported with rg_system_frame_add
+    RG_FRAME_PHASE_DIFF,      // Frame comparison in rg_display_queue_update
+    RG_FRAME_PHASE_DISPLAY,   // Waiting for the display task in rg_display_queue_update
+    RG_FRAME_PHASE_AUDIO,     // rg_audio_submit
+    RG_FRAME_PHASE_COUNT,
+} rg_frame_phase_t;
+
+typedef struct
+{
+    int p50, p95, p99; // In microseconds, over the last stats period
+} rg_frame_timing_t;
+
+typedef enum
+{
+    RG_FRAMESKIP_AUTO = 0,  // Skip based on predicted frame cost, value is the target latency in us (0 = one frame)
+    RG_FRAMESKIP_FIXED,     // Draw one frame out of `value`
+} rg_frameskip_t;
+
 typedef bool (*rg_state_handler_t)(const char *filename);
+typedef bool (*rg_stream_handler_t)(FILE *fp);
 typedef bool (*rg_reset_handler_t)(bool hard);
 typedef void (*rg_event_handler_t)(int event, void *data);
 typedef bool (*rg_screenshot_handler_t)(const char *filename, int width, int height);
@@ -118,6 +142,8 @@ typedef struct
 {
     rg_state_handler_t loadState;       // rg_emu_load_state() handler
     rg_state_handler_t saveState;       // rg_emu_save_state() handler
+    rg_stream_handler_t loadStateStream;// Same as loadState but from an open stream (used by rewind)
+    rg_stream_handler_t saveStateStream;// Same as saveState but to an open stream (used by rewind)
     rg_reset_handler_t reset;           // rg_emu_reset() handler
     rg_screenshot_handler_t screenshot; // rg_emu_screenshot() handler
     rg_event_handler_t event;           // listen to retro-go system events
@@ -182,6 +208,14 @@ typedef struct
     int freeBlockInt;
     int freeBlockExt;
     int freeStackMain;
+    int bytesPerFrame;  // Display data sent per drawn frame
+    int diffPerFrame;   // Microseconds spent diffing per drawn frame
+    rg_frame_timing_t frameTiming[RG_FRAME_PHASE_COUNT];
+    // Frame scheduler state, all in microseconds
+    int frameBudget;    // Real time covered by one frame, derived from the audio produced
+    int frameLag;       // How far behind real time we're running
+    int drawCost;       // Predicted cost of a drawn frame
+    int skipCost;       // Predicted cost of a skipped frame
 } rg_stats_t;
 
 rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg_gui_option_t *options);
@@ -195,12 +229,19 @@ bool rg_system_find_app(const char *app);
 void rg_system_set_led(int value);
 int  rg_system_get_led(void);
 void rg_system_tick(int busyTime);
+bool rg_system_schedule_frame(void);
+void rg_system_skip_frames(int count);
+void rg_system_set_frameskip(rg_frameskip_t mode, int value);
+rg_frameskip_t rg_system_get_frameskip(int *value);
+void rg_system_frame_mark(rg_frame_phase_t phase);
+void rg_system_frame_add(rg_frame_phase_t phase, int elapsed);
 void rg_system_vlog(int level, const char *context, const char *format, va_list va);
 void rg_system_log(int level, const char *context, const char *format, ...) __attribute__((format(printf,3,4)));
 bool rg_system_save_trace(const char *filename, bool append);
 void rg_system_event(rg_event_t event, void *data);
 int64_t rg_system_timer(void);
 rg_app_t *rg_system_get_app(void);
+uint32_t rg_system_get_rom_crc32(void);
 rg_stats_t rg_system_get_counters(void);
 
 // Wrappers for the OS' task/thread creation API. It also keeps track of handles for debugging purposes...
@@ -214,6 +255,9 @@ bool rg_emu_load_state(uint8_t slot);
 bool rg_emu_reset(bool hard);
 bool rg_emu_screenshot(const char *filename, int width, int height);
 rg_emu_state_t *rg_emu_get_states(const char *romPath, size_t slots);
+bool rg_emu_set_rewind(bool enable);
+bool rg_emu_get_rewind(void);
+bool rg_emu_rewind(void);
 
 uint32_t rg_crc32(uint32_t crc, const uint8_t* buf, uint32_t len);
 void *rg_alloc(size_t size, uint32_t caps);
@@ -228,6 +272,15 @@ void *rg_alloc(size_t size, uint32_t caps);
 
 #define PTR_IN_SPIRAM(ptr) ((void*)(ptr) >= (void*)0x3F800000 && (void*)(ptr) < (void*)0x3FC00000)
 
+#ifdef RG_TARGET_SDL2
+// Headless benchmark mode, enabled by setting RG_BENCHMARK_FRAMES in the environment.
+// RG_BENCHMARK_ROM overrides the ROM and RG_BENCHMARK_INPUT is an input movie to replay.
+// The display and audio sinks are bypassed and their output is checksummed instead.
+bool rg_benchmark_enabled(void);
+void rg_benchmark_feed_video(const void *data, size_t length);
+void rg_benchmark_feed_audio(const void *data, size_t length);
+#endif
+
 /* Utilities */
 
 // #define gpio_set_level(num, level) (((num) & I2C) ? rg_gpio_set_level((num) & ~I2C) : (gpio_set_level)(num, level) == ESP_OK)
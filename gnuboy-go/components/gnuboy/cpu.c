@@ -8,6 +8,9 @@
 // Anything above 10 have diminishing returns
 #define COUNTERS_TICK_PERIOD 8
 
+// Length of the LY/STAT polling loops recognized by idle_skip()
+#define IDLE_LOOP_CYCLES 8
+
 static const byte cycles_table[256] =
 {
 	1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
@@ -138,6 +141,8 @@ A = LB(acc); }
 #define JR ( PC += 1+(n8)readb(PC) )
 #define JP ( PC = readw(PC) )
 
+#define JR_IDLE ( clen += idle_skip(count + clen, remaining - clen), JR )
+
 #define NOJR   ( clen--,  PC++ )
 #define NOJP   ( clen--,  PC+=2 )
 #define NOCALL ( clen-=3, PC+=2 )
@@ -259,7 +264,8 @@ static inline void timer_advance(int cycles)
 /* cnt - time to emulate, expressed in real clock cycles */
 static inline void serial_advance(int cycles)
 {
-	if (hw.serial > 0)
+	// With a link cable the transfer completes in gnuboy_link_exchange()
+	if (hw.serial > 0 && !hw.link)
 	{
 		hw.serial -= cycles << 1;
 		if (hw.serial <= 0)
@@ -273,6 +279,69 @@ static inline void serial_advance(int cycles)
 	}
 }
 
+/* next_event()
+	Returns the number of cycles, since the counters were last advanced,
+	until the next event that can change what the CPU sees: an LCD mode
+	or line change (which also runs HDMA), a timer overflow or the end of
+	a serial transfer. Until then a halted CPU has nothing to do.
+*/
+static inline int next_event(void)
+{
+	int cycles = cpu.double_speed ? lcd.cycles : (lcd.cycles + 1) >> 1;
+
+	if (R_TAC & 0x04)
+	{
+		int shift = (((-R_TAC) & 3) << 1) + 1;
+		int ticks = ((256 - R_TIMA) << 9) - cpu.timer;
+		int timer = (ticks + (1 << shift) - 1) >> shift;
+		if (timer < cycles)
+			cycles = timer;
+	}
+
+	if (hw.serial > 0 && !hw.link)
+	{
+		int serial = (hw.serial + 1) >> 1;
+		if (serial < cycles)
+			cycles = serial;
+	}
+
+	return cycles;
+}
+
+/* idle_skip()
+	Called by a taken JR, returns the cycles to burn if it jumps back to
+	a loop that only polls LY or STAT:
+
+		loop: LDH A,(LY|STAT) ; CP n | AND n | BIT b,A ; JR cc,loop
+
+	The outcome can't change before next_event(), so we skip all the
+	iterations until then. pending - cycles not yet given to the counters
+*/
+static inline int idle_skip(int pending, int remaining)
+{
+	unsigned loop = PC - 5;
+	byte reg, op;
+	int skip;
+
+	if (readb(PC) != 0xFA || readb(loop) != 0xF0)
+		return 0;
+
+	reg = readb(loop + 1);
+	op = readb(loop + 2);
+
+	if ((reg != RI_LY && reg != RI_STAT) ||
+		(op != 0xFE && op != 0xE6 && (op != 0xCB || (readb(loop + 3) & 0xC7) != 0x47)))
+		return 0;
+
+	skip = next_event() - pending;
+	if (skip > remaining)
+		skip = remaining;
+	if (skip < IDLE_LOOP_CYCLES)
+		return 0;
+
+	return skip - (skip % IDLE_LOOP_CYCLES);
+}
+
 /* cpu_emulate()
 	Emulate CPU for time no less than specified
 
@@ -294,9 +363,13 @@ IRAM_ATTR int cpu_emulate(int cycles)
 		remaining >>= 1;
 
 next:
-	/* Skip idle cycles */
+	/* Skip idle cycles up to the next event that could wake us up */
 	if (cpu.halted) {
-		clen = 1;
+		clen = next_event() - count;
+		if (clen > remaining)
+			clen = remaining;
+		if (clen < 1)
+			clen = 1;
 		goto _skip;
 	}
 
@@ -637,13 +710,13 @@ next:
 	case 0x18: /* JR */
 		JR; break;
 	case 0x20: /* JR NZ */
-		if (!(F&FZ)) JR; else NOJR; break;
+		if (!(F&FZ)) JR_IDLE; else NOJR; break;
 	case 0x28: /* JR Z */
-		if (F&FZ) JR; else NOJR; break;
+		if (F&FZ) JR_IDLE; else NOJR; break;
 	case 0x30: /* JR NC */
-		if (!(F&FC)) JR; else NOJR; break;
+		if (!(F&FC)) JR_IDLE; else NOJR; break;
 	case 0x38: /* JR C */
-		if (F&FC) JR; else NOJR; break;
+		if (F&FC) JR_IDLE; else NOJR; break;
 
 	case 0xC3: /* JP */
 		JP; break;
@@ -809,9 +882,6 @@ _skip:
 		sound_advance(count);
 		// sound_emulate(count);
 
-		// Here we could calculate when the next event is going to happen
-		// So that we can skip even more cycles, but it doesn't seem to save
-		// much more CPU and adds lots of complexity...
 		count = 0;
 	}
 
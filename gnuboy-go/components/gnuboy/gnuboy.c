@@ -10,6 +10,9 @@
 // Set in the far future for VBA-M support
 #define RTC_BASE 1893456000
 
+// Frames an internally clocked transfer waits for the other side before giving up
+#define LINK_TIMEOUT 8
+
 gb_host_t host;
 
 
@@ -113,6 +116,48 @@ void gnuboy_set_pad(int pad)
 }
 
 
+/*
+	Link cable. Transfers can't be done bit by bit over a network, so while connected they
+	are held until the end of the frame. The host exchanges gnuboy_link_get() with the other
+	side once per frame and passes the peer's value to gnuboy_link_exchange(). Both sides see
+	the same pair of values and complete the transfer together, one byte per frame at most.
+*/
+void gnuboy_link_connect(bool connected)
+{
+	hw.link = connected;
+	hw.link_wait = 0;
+}
+
+
+uint16_t gnuboy_link_get(void)
+{
+	return (R_SC << 8) | R_SB;
+}
+
+
+void gnuboy_link_exchange(uint16_t remote)
+{
+	byte remote_sc = remote >> 8;
+
+	if (!hw.link || !(R_SC & 0x80))
+		return;
+
+	// Both sides must be transferring and at least one of them must provide the clock
+	if ((remote_sc & 0x80) && ((R_SC | remote_sc) & 0x01))
+		R_SB = remote & 0xFF;
+	else if ((R_SC & 0x01) && ++hw.link_wait >= LINK_TIMEOUT)
+		R_SB = 0xFF; // Nobody is listening, same as without a cable
+	else
+		return;
+
+	R_SC &= 0x7f;
+	hw.serial = 0;
+	hw.link_wait = 0;
+	hw_interrupt(IF_SERIAL, 1);
+	hw_interrupt(IF_SERIAL, 0);
+}
+
+
 int gnuboy_load_bios(const char *file)
 {
 	MESSAGE_INFO("Loading BIOS file: '%s'\n", file);
@@ -633,7 +678,7 @@ typedef struct
 } sblock_t;
 
 
-static int do_save_load(const char *file, bool save)
+static int do_save_load(FILE *fp, bool save)
 {
 	uint32_t sav_ver = SAVE_VERSION;
 	const svar_t svars[] =
@@ -720,13 +765,8 @@ static int do_save_load(const char *file, bool save)
 		{NULL, 0},
 	};
 
-	FILE *fp = NULL;
-
 	if (save)
 	{
-		if (!(fp = fopen(file, "wb")))
-			goto _error;
-
 		for (int i = 0; svars[i].ptr; i++)
 		{
 			uint32_t d = 0;
@@ -764,9 +804,6 @@ static int do_save_load(const char *file, bool save)
 	}
 	else
 	{
-		if (!(fp = fopen(file, "rb")))
-			goto _error;
-
 		for (int i = 0; blocks[i].ptr != NULL; i++)
 		{
 			if (fread(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
@@ -822,14 +859,12 @@ static int do_save_load(const char *file, bool save)
 		hw_updatemap();
 	}
 
-	fclose(fp);
 	free(buf);
 
 	return 0;
 
 _error:
-	if (fp) fclose(fp);
-	if (buf) free(buf);
+	free(buf);
 
 	return -1;
 }
@@ -837,11 +872,33 @@ _error:
 
 int gnuboy_save_state(const char *file)
 {
-	return do_save_load(file, true);
+	FILE *fp = fopen(file, "wb");
+	if (!fp)
+		return -1;
+	int ret = do_save_load(fp, true);
+	fclose(fp);
+	return ret;
 }
 
 
 int gnuboy_load_state(const char *file)
 {
-	return do_save_load(file, false);
+	FILE *fp = fopen(file, "rb");
+	if (!fp)
+		return -1;
+	int ret = do_save_load(fp, false);
+	fclose(fp);
+	return ret;
+}
+
+
+int gnuboy_write_state(FILE *fp)
+{
+	return do_save_load(fp, true);
+}
+
+
+int gnuboy_read_state(FILE *fp)
+{
+	return do_save_load(fp, false);
 }
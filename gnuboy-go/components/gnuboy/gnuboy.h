@@ -129,6 +129,10 @@ bool gnuboy_sram_dirty(void);
 void gnuboy_load_bank(int);
 void gnuboy_set_pad(int);
 
+void gnuboy_link_connect(bool connected);
+uint16_t gnuboy_link_get(void);
+void gnuboy_link_exchange(uint16_t remote);
+
 void gnuboy_get_time(int *day, int *hour, int *minute, int *second);
 void gnuboy_set_time(int day, int hour, int minute, int second);
 int  gnuboy_get_hwtype(void);
@@ -140,3 +144,5 @@ int gnuboy_load_sram(const char *file);
 int gnuboy_save_sram(const char *file, bool quick_save);
 int gnuboy_load_state(const char *file);
 int gnuboy_save_state(const char *file);
+int gnuboy_read_state(FILE *fp);
+int gnuboy_write_state(FILE *fp);
@@ -214,6 +214,7 @@ void hw_reset(bool hard)
 {
 	hw.ilines = 0;
 	hw.serial = 0;
+	hw.link_wait = 0;
 	hw.hdma = 0;
 	hw.pad = 0;
 
@@ -552,6 +553,7 @@ void hw_write(unsigned a, byte b)
 					hw.serial = 1952; // 8 * 122us;
 				else
 					hw.serial = 0;
+				hw.link_wait = 0;
 				R_SC = b; /* & 0x7f; */
 				break;
 			case RI_SB:
@@ -216,6 +216,8 @@ typedef struct
 
 	int serial; 	// Serial cycle counter
 	int hdma; 		// DMA cycle counter
+	bool link;		// Link cable connected, see gnuboy_link_exchange()
+	int link_wait;	// Frames the current transfer has been waiting for the other side
 
 	int hwtype;		// type of emulated device
 	int frames;		// total frames counter
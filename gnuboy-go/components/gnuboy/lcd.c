@@ -802,7 +802,16 @@ void lcd_emulate(int cycles)
 			break;
 		case 2:
 			/* search -> */
+#ifdef RETRO_GO
+			if (host.video.enabled)
+			{
+				int64_t start = rg_system_timer();
+				lcd_renderline();
+				rg_system_frame_add(RG_FRAME_PHASE_RENDER, rg_system_timer() - start);
+			}
+#else
 			lcd_renderline();
+#endif
 			stat_change(3); /* -> transfer */
 			lcd.cycles += 86;
 			break;
@@ -11,18 +11,37 @@ static rg_video_update_t *currentUpdate = &updates[0];
 
 static rg_app_t *app;
 
-static bool fullFrame = false;
-static long skipFrames = 20; // The 20 is to hide startup flicker in some games
-
 static const char *sramFile;
 static long autoSaveSRAM = 0;
 static long autoSaveSRAM_Timer = 0;
 
 static const char *SETTING_SAVESRAM = "SaveSRAM";
 static const char *SETTING_PALETTE  = "Palette";
+
+#ifdef RG_ENABLE_NETPLAY
+static bool netplay = false;
+#endif
 // --- MAIN
 
 
+static void event_handler(int event, void *arg)
+{
+#ifdef RG_ENABLE_NETPLAY
+    // Each player runs its own game, netplay is only a link cable between them
+    if (event == (RG_EVENT_TYPE_NETPLAY | NETPLAY_EVENT_STATUS_CHANGED))
+    {
+        bool new_netplay = (rg_netplay_status() == NETPLAY_STATUS_CONNECTED);
+
+        if (netplay && !new_netplay)
+            rg_gui_alert("Netplay", "Link cable disconnected!");
+
+        gnuboy_link_connect(new_netplay);
+        netplay = new_netplay;
+    }
+#endif
+}
+
+
 static bool screenshot_handler(const char *filename, int width, int height)
 {
     return rg_display_save_frame(filename, currentUpdate, width, height);
@@ -45,19 +64,28 @@ static bool load_state_handler(const char *filename)
         return false;
     }
 
-    skipFrames = 0;
+    rg_system_skip_frames(0);
     autoSaveSRAM_Timer = 0;
 
     // TO DO: Call rtc_sync() if a physical RTC is present
     return true;
 }
 
+static bool save_stream_handler(FILE *fp)
+{
+    return gnuboy_write_state(fp) == 0;
+}
+
+static bool load_stream_handler(FILE *fp)
+{
+    return gnuboy_read_state(fp) == 0;
+}
+
 static bool reset_handler(bool hard)
 {
     gnuboy_reset(hard);
 
-    fullFrame = false;
-    skipFrames = 20;
+    rg_system_skip_frames(20);
     autoSaveSRAM_Timer = 0;
 
     if (hard)
@@ -208,7 +236,7 @@ static rg_gui_event_t sram_settings_cb(rg_gui_option_t *option, rg_gui_event_t e
 static void blit_frame(void)
 {
     rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
-    fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
+    rg_display_queue_update(currentUpdate, previousUpdate);
     currentUpdate = previousUpdate;
     host.video.buffer = currentUpdate->buffer;
 }
@@ -231,8 +259,11 @@ void app_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateStream = &load_stream_handler,
+        .saveStateStream = &save_stream_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
+        .event = &event_handler,
     };
     const rg_gui_option_t options[] = {
         {0, "Palette", "7/7", 1, &palette_update_cb},
@@ -243,6 +274,10 @@ void app_main(void)
 
     app = rg_system_init(AUDIO_SAMPLE_RATE, &handlers, options);
 
+#ifdef RG_ENABLE_NETPLAY
+    rg_netplay_set_link_mode(true);
+#endif
+
     updates[0].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_ANY);
     updates[1].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_ANY);
 
@@ -271,6 +306,7 @@ void app_main(void)
 
     // Hard reset to have a clean slate
     gnuboy_reset(true);
+    rg_system_skip_frames(20); // The 20 is to hide startup flicker in some games
 
     // Load saved state or SRAM
     if (app->bootFlags & RG_BOOT_RESUME)
@@ -318,10 +354,25 @@ void app_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_system_schedule_frame();
+
+    #ifdef RG_ENABLE_NETPLAY
+        if (netplay)
+        {
+            // Serial transfers started during the previous frame complete now, on both sides
+            uint16_t local = gnuboy_link_get(), remote = 0;
+            rg_netplay_sync(&local, &remote, sizeof(local));
+            if (rg_netplay_status() == NETPLAY_STATUS_CONNECTED)
+                gnuboy_link_exchange(remote);
+        }
+    #endif
+
+        rg_system_frame_mark(RG_FRAME_PHASE_INPUT);
 
         gnuboy_run(drawFrame);
 
+        rg_system_frame_mark(RG_FRAME_PHASE_EMULATE);
+
         if (autoSaveSRAM > 0)
         {
             if (autoSaveSRAM_Timer <= 0)
@@ -336,28 +387,13 @@ void app_main(void)
                 auto_sram_update();
 
                 #if RG_STORAGE_DRIVER == 1 // This is only necessary when the SPI bus is shared
-                skipFrames += 5;
+                rg_system_skip_frames(5);
                 #endif
             }
         }
 
         int elapsed = rg_system_timer() - startTime;
 
-        if (skipFrames == 0)
-        {
-            int frameTime = 1000000 / (60 * app->speed);
-            if (elapsed > frameTime - 2000) // It takes about 2ms to copy the audio buffer
-                skipFrames = (elapsed + frameTime / 2) / frameTime;
-            else if (drawFrame && fullFrame) // This could be avoided when scaling != full
-                skipFrames = 1;
-            if (app->speed > 1.f) // This is a hack until we account for audio speed...
-                skipFrames += (int)app->speed;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
-
         // Tick before submitting audio/syncing
         rg_system_tick(elapsed);
 
@@ -78,4 +78,9 @@ void m68k_write_memory_8(unsigned int address,unsigned int value);
 void gwenesis_bus_save_state();
 void gwenesis_bus_load_state();
 
+/* Sound side of the bus, implemented by the frontend. The 68K may run ahead of
+ * the Z80/YM2612: writes are queued with a timestamp and reads call sync first. */
+void gwenesis_sound_sync(void);
+void gwenesis_sound_ym_write(unsigned int address, unsigned int value);
+
 #endif
\ No newline at end of file
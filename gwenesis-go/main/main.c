@@ -1,5 +1,4 @@
 #include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
 #include <freertos/semphr.h>
 #include <rg_system.h>
 #include <stdio.h>
@@ -30,8 +29,31 @@ static rg_video_update_t *currentUpdate = &updates[0];
 
 static rg_app_t *app;
 
-#define WAIT_FOR_Z80_RUN() while (uxQueueMessagesWaiting(sound_task_run));
-static QueueHandle_t sound_task_run;
+// The 68K core runs ahead of the Z80/YM2612 and logs what the sound core needs to
+// replay (elapsed time, YM writes, Z80 interrupts) in a single producer/consumer ring.
+typedef struct {
+    uint64_t clock;
+    uint8_t type;
+    uint8_t address;
+    uint8_t value;
+} sound_event_t;
+
+enum {
+    SOUND_RUN = 0,  // Catch up to clock
+    SOUND_YM_WRITE, // YM2612Write(address, value)
+    SOUND_Z80_IRQ,  // z80_irq_line(value)
+    SOUND_FRAME,    // Catch up to clock and submit the frame's audio
+};
+
+#define SOUND_RING_SIZE 1024  // Must be a power of two
+#define SOUND_KICK_LINES 32   // Wake the sound core every n lines
+#define YM_CYCLES_PER_SAMPLE 1008 // 53.693175 MHz master clock / AUDIO_SAMPLE_RATE
+
+static sound_event_t sound_ring[SOUND_RING_SIZE];
+static uint32_t sound_head, sound_tail;
+static SemaphoreHandle_t sound_wake;
+static uint64_t system_clock, sound_clock;
+static size_t audio_index;
 
 static bool yfm_enabled = true;
 static bool yfm_resample = true;
@@ -160,10 +182,55 @@ static bool screenshot_handler(const char *filename, int width, int height)
     return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
+static void sound_push(uint64_t clock, int type, int address, int value)
+{
+    uint32_t head = sound_head;
+
+    // The ring is full, let the sound core drain it
+    while (head - __atomic_load_n(&sound_tail, __ATOMIC_ACQUIRE) >= SOUND_RING_SIZE)
+        xSemaphoreGive(sound_wake);
+
+    sound_ring[head & (SOUND_RING_SIZE - 1)] = (sound_event_t){clock, type, address, value};
+    __atomic_store_n(&sound_head, head + 1, __ATOMIC_RELEASE);
+
+    if (((head + 1) & (SOUND_RING_SIZE / 2 - 1)) == 0)
+        xSemaphoreGive(sound_wake);
+}
+
+static void sound_drain(uint64_t clock)
+{
+    sound_push(clock, SOUND_RUN, 0, 0);
+    xSemaphoreGive(sound_wake);
+    while (__atomic_load_n(&sound_tail, __ATOMIC_ACQUIRE) != sound_head)
+        continue;
+}
+
+static inline uint64_t m68k_current_clock(void)
+{
+    return m68k_clock + m68k_cycles_run() * M68K_FREQ_DIVISOR;
+}
+
+void gwenesis_sound_sync(void)
+{
+    sound_drain(m68k_current_clock());
+}
+
+void gwenesis_sound_ym_write(unsigned int address, unsigned int value)
+{
+    sound_push(m68k_current_clock(), SOUND_YM_WRITE, address, value);
+}
+
+// The sound core is idle after sound_drain(), this puts it back in step with the 68K
+static void sound_realign(void)
+{
+    zclk = sound_clock = system_clock;
+}
+
 static bool save_state_handler(const char *filename)
 {
     if ((savestate_fp = fopen(filename, "wb")))
     {
+        sound_drain(system_clock);
         savestate_errors = 0;
         gwenesis_save_state();
         fclose(savestate_fp);
@@ -174,77 +241,108 @@ static bool save_state_handler(const char *filename)
 
 static bool load_state_handler(const char *filename)
 {
+    sound_drain(system_clock);
     if ((savestate_fp = fopen(filename, "rb")))
     {
         savestate_errors = 0;
         gwenesis_load_state();
         fclose(savestate_fp);
         if (savestate_errors == 0)
+        {
+            sound_realign();
             return true;
+        }
     }
     reset_emulation();
+    sound_realign();
     return false;
 }
 
 static bool reset_handler(bool hard)
 {
+    sound_drain(system_clock);
     reset_emulation();
+    sound_realign();
     return true;
 }
 
-static void sound_task(void *arg)
+static void sound_submit(void)
 {
-    sound_task_run = xQueueCreate(1, sizeof(uint64_t));
+    int carry = 0;
 
-    uint64_t system_clock;
-    size_t audio_index = 0;
+    if (audio_index == 0)
+        return;
 
-    while (true)
+    if (yfm_resample > 0)
     {
-        xQueuePeek(sound_task_run, &system_clock, portMAX_DELAY);
-        if (!z80_enabled)
-            zclk = system_clock * 2; // To infinity, and beyond!
-        z80_run(system_clock);
-        xQueueReceive(sound_task_run, &system_clock, portMAX_DELAY);
-
-        if (!yfm_enabled)
-            continue;
-
-        // This is essentially magic to get close enough. Not accurate at all.
-        size_t audio_step = 3 + (scan_line & 1);
-        YM2612Update(&audioBuffer[audio_index * 2], audio_step);
-        audio_index += audio_step;
-
-        // Submit at end of frame or whenever the buffer is full
-        if (scan_line == 261 || audio_index >= AUDIO_BUFFER_LENGTH - 4)
+        // Resampling deals with even number of samples, carry what's left
+        carry = (audio_index & 1) ? (audio_index - 1) : 0;
+        for (size_t i = 0; i < audio_index - 1; ++i)
         {
-            int carry = 0;
+            audioBuffer[i] = (audioBuffer[i*2] + audioBuffer[(i+1)*2]) >> 1;
+        }
+        audio_index >>= 1;
+    }
 
-            if (yfm_resample > 0)
-            {
-                // Resampling deals with even number of samples, carry what's left
-                carry = (audio_index & 1) ? (audio_index - 1) : 0;
-                for (size_t i = 0; i < audio_index - 1; ++i)
-                {
-                    audioBuffer[i] = (audioBuffer[i*2] + audioBuffer[(i+1)*2]) >> 1;
-                }
-                audio_index >>= 1;
-            }
+    rg_audio_submit((void*)audioBuffer, audio_index);
+    audio_index = 0;
 
-            rg_audio_submit((void*)audioBuffer, audio_index);
-            audio_index = 0;
+    if (carry)
+    {
+        audioBuffer[0] = audioBuffer[carry*2-1];
+        audioBuffer[1] = audioBuffer[carry*2-0];
+        audio_index = 1;
+    }
+}
 
-            if (carry)
-            {
-                audioBuffer[0] = audioBuffer[carry*2-1];
-                audioBuffer[1] = audioBuffer[carry*2-0];
-                audio_index = 1;
-            }
+static void sound_run(uint64_t clock)
+{
+    // Steps of at most one line keep the Z80's YM writes interleaved with sample generation
+    while (sound_clock < clock)
+    {
+        uint64_t target = RG_MIN(clock, sound_clock + VDP_CYCLES_PER_LINE);
+
+        if (z80_enabled)
+            z80_run(target);
+        else
+            zclk = target;
+
+        if (yfm_enabled)
+        {
+            size_t samples = target / YM_CYCLES_PER_SAMPLE - sound_clock / YM_CYCLES_PER_SAMPLE;
+            if (samples > 0)
+                YM2612Update(&audioBuffer[audio_index * 2], samples);
+            audio_index += samples;
+            if (audio_index >= AUDIO_BUFFER_LENGTH - 4)
+                sound_submit();
         }
+
+        sound_clock = target;
     }
+}
+
+static void sound_task(void *arg)
+{
+    while (true)
+    {
+        xSemaphoreTake(sound_wake, portMAX_DELAY);
 
-    vQueueDelete(sound_task_run);
-    sound_task_run = NULL;
+        while (sound_tail != __atomic_load_n(&sound_head, __ATOMIC_ACQUIRE))
+        {
+            sound_event_t *event = &sound_ring[sound_tail & (SOUND_RING_SIZE - 1)];
+
+            sound_run(event->clock);
+
+            if (event->type == SOUND_YM_WRITE)
+                YM2612Write(event->address, event->value);
+            else if (event->type == SOUND_Z80_IRQ)
+                z80_irq_line(event->value);
+            else if (event->type == SOUND_FRAME)
+                sound_submit();
+
+            __atomic_store_n(&sound_tail, sound_tail + 1, __ATOMIC_RELEASE);
+        }
+    }
 
     rg_task_delete(NULL);
 }
@@ -275,6 +373,7 @@ void app_main(void)
     updates[0].buffer = rg_alloc(320 * 240, MEM_FAST);
     // updates[1].buffer = rg_alloc(320 * 240 * 2, MEM_FAST);
 
+    sound_wake = xSemaphoreCreateBinary();
     rg_task_create("gen_sound", &sound_task, NULL, 2048, 7, 1);
     rg_audio_set_sample_rate(yfm_resample ? 26634 : 53267);
 
@@ -307,8 +406,6 @@ void app_main(void)
 
     uint32_t keymap[8] = {RG_KEY_UP, RG_KEY_DOWN, RG_KEY_LEFT, RG_KEY_RIGHT, RG_KEY_A, RG_KEY_B, RG_KEY_SELECT, RG_KEY_START};
     uint32_t joystick = 0, joystick_old;
-    uint64_t system_clock = 0;
-    uint32_t frames = 0;
 
     RG_LOGI("load_cartridge()\n");
     load_cartridge();
@@ -352,7 +449,10 @@ void app_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = (frames++ & 3) == 3;
+        bool drawFrame = rg_system_schedule_frame();
+        int renderTime = 0;
+
+        rg_system_frame_mark(RG_FRAME_PHASE_INPUT);
 
         int hint_counter = gwenesis_vdp_regs[10];
 
@@ -364,15 +464,21 @@ void app_main(void)
 
         for (scan_line = 0; scan_line < 262; scan_line++)
         {
+            m68k_clock = system_clock;
             system_clock += VDP_CYCLES_PER_LINE;
 
-            WAIT_FOR_Z80_RUN(); // m68k_run might call z80_sync, we don't want to conflict
             m68k_execute(VDP_CYCLES_PER_LINE / M68K_FREQ_DIVISOR);
             // system_clock -= m68k_cycles_remaining() * M68K_FREQ_DIVISOR;
-            xQueueSend(sound_task_run, &system_clock, portMAX_DELAY);
+            sound_push(system_clock, SOUND_RUN, 0, 0);
+            if ((scan_line % SOUND_KICK_LINES) == SOUND_KICK_LINES - 1)
+                xSemaphoreGive(sound_wake);
 
             if (drawFrame && scan_line < screen_height)
+            {
+                int64_t renderStart = rg_system_timer();
                 gwenesis_vdp_render_line(scan_line);
+                renderTime += rg_system_timer() - renderStart;
+            }
 
             // On these lines, the line counter interrupt is reloaded
             if ((scan_line == 0) || (scan_line > screen_height))
@@ -398,16 +504,20 @@ void app_main(void)
                     gwenesis_vdp_status |= STATUS_VIRQPENDING;
                     m68k_set_irq(6);
                 }
-                WAIT_FOR_Z80_RUN();
-                z80_irq_line(1);
+                sound_push(system_clock, SOUND_Z80_IRQ, 0, 1);
             }
             else if (scan_line == screen_height)
             {
-                WAIT_FOR_Z80_RUN();
-                z80_irq_line(0);
+                sound_push(system_clock, SOUND_Z80_IRQ, 0, 0);
             }
         }
 
+        sound_push(system_clock, SOUND_FRAME, 0, 0);
+        xSemaphoreGive(sound_wake);
+
+        rg_system_frame_add(RG_FRAME_PHASE_RENDER, renderTime);
+        rg_system_frame_mark(RG_FRAME_PHASE_EMULATE);
+
         if (drawFrame)
         {
             for (int i = 0; i < 256; ++i)
@@ -161,6 +161,7 @@ class CMikie : public CLynxBase
 
       void	ComLynxCable(int status);
       void	ComLynxRxData(int data);
+      int	ComLynxRxFree(void) {return UART_MAX_RX_QUEUE-mUART_Rx_waiting;};
       void	ComLynxTxLoopback(int data);
       void	ComLynxTxCallback(void (*function)(int data,ULONG objref),ULONG objref);
 
@@ -325,6 +325,7 @@ class CSystem : public CSystemBase
 
       void   ComLynxCable(int status) { mMikie->ComLynxCable(status); };
       void   ComLynxRxData(int data)  { mMikie->ComLynxRxData(data); };
+      int    ComLynxRxFree(void)      { return mMikie->ComLynxRxFree(); };
       void   ComLynxTxCallback(void (*function)(int data,ULONG objref),ULONG objref) { mMikie->ComLynxTxCallback(function,objref); };
 
       // Miscellaneous
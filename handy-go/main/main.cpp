@@ -21,9 +21,85 @@ static int dpad_mapped_up;
 static int dpad_mapped_down;
 static int dpad_mapped_left;
 static int dpad_mapped_right;
-// static bool netplay = false;
+
+#ifdef RG_ENABLE_NETPLAY
+// ComLynx bytes sent during a frame are exchanged at the start of the next one, up to
+// COMLYNX_MAX_BYTES per frame. Mikie's receive queue only holds UART_MAX_RX_QUEUE bytes, so
+// received bytes wait in comlynx_rx until the game has read enough of them to make room.
+#define COMLYNX_MAX_BYTES ((NETPLAY_SYNC_MAX_DATA - 1) / 2)
+
+typedef struct __attribute__((packed)) {
+    uint8_t count;
+    uint16_t data[COMLYNX_MAX_BYTES];
+} comlynx_frame_t;
+
+static uint16_t comlynx_fifo[256];
+static uint8_t comlynx_head, comlynx_tail;
+static uint16_t comlynx_rx[256];
+static uint8_t comlynx_rx_head, comlynx_rx_tail;
+static bool netplay = false;
+#endif
 // --- MAIN
 
+#ifdef RG_ENABLE_NETPLAY
+static void comlynx_tx_callback(int data, ULONG objref)
+{
+    if ((uint8_t)(comlynx_head + 1) != comlynx_tail)
+        comlynx_fifo[comlynx_head++] = data;
+    else
+        RG_LOGW("ComLynx: Transmit overrun!\n");
+}
+
+static void comlynx_attach(void)
+{
+    comlynx_head = comlynx_tail = 0;
+    comlynx_rx_head = comlynx_rx_tail = 0;
+    lynx->ComLynxCable(netplay);
+    lynx->ComLynxTxCallback(netplay ? &comlynx_tx_callback : NULL, 0);
+}
+
+static void comlynx_sync(void)
+{
+    comlynx_frame_t local = {0}, remote = {0};
+
+    while (comlynx_tail != comlynx_head && local.count < COMLYNX_MAX_BYTES)
+        local.data[local.count++] = comlynx_fifo[comlynx_tail++];
+
+    rg_netplay_sync(&local, &remote, sizeof(local));
+
+    if (rg_netplay_status() != NETPLAY_STATUS_CONNECTED)
+        return;
+
+    for (int i = 0; i < RG_MIN(remote.count, COMLYNX_MAX_BYTES); i++)
+    {
+        if ((uint8_t)(comlynx_rx_head + 1) != comlynx_rx_tail)
+            comlynx_rx[comlynx_rx_head++] = remote.data[i];
+        else
+            RG_LOGW("ComLynx: Receive overrun!\n");
+    }
+
+    for (int free = lynx->ComLynxRxFree(); free > 0 && comlynx_rx_tail != comlynx_rx_head; free--)
+        lynx->ComLynxRxData(comlynx_rx[comlynx_rx_tail++]);
+}
+
+static void event_handler(int event, void *arg)
+{
+    // Each player runs its own game, netplay is only a ComLynx cable between them
+    if (event == (RG_EVENT_TYPE_NETPLAY | NETPLAY_EVENT_STATUS_CHANGED))
+    {
+        bool new_netplay = (rg_netplay_status() == NETPLAY_STATUS_CONNECTED);
+
+        if (netplay && !new_netplay)
+            rg_gui_alert("Netplay", "ComLynx cable disconnected!");
+
+        netplay = new_netplay;
+
+        if (lynx)
+            comlynx_attach();
+    }
+}
+#endif
+
 static void set_display_mode(void)
 {
     display_rotation_t rotation = rg_display_get_rotation();
@@ -152,6 +228,9 @@ static bool reset_handler(bool hard)
     // This isn't nice but lynx->Reset() crashes...
     delete lynx;
     lynx = new CSystem(app->romPath, MIKIE_PIXEL_FORMAT_16BPP_565_BE, AUDIO_SAMPLE_RATE);
+#ifdef RG_ENABLE_NETPLAY
+    comlynx_attach();
+#endif
     return true;
 }
 
@@ -162,7 +241,11 @@ extern "C" void app_main(void)
         .saveState = &save_state_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
+#ifdef RG_ENABLE_NETPLAY
+        .event = &event_handler,
+#else
         .event = NULL,
+#endif
         .memRead = NULL,
         .memWrite = NULL,
     };
@@ -173,6 +256,10 @@ extern "C" void app_main(void)
 
     app = rg_system_init(AUDIO_SAMPLE_RATE, &handlers, options);
 
+#ifdef RG_ENABLE_NETPLAY
+    rg_netplay_set_link_mode(true);
+#endif
+
     // the HANDY_SCREEN_WIDTH * HANDY_SCREEN_WIDTH is deliberate because of rotation
     updates[0].buffer = (void*)rg_alloc(HANDY_SCREEN_WIDTH * HANDY_SCREEN_WIDTH * 2, MEM_FAST);
     updates[1].buffer = (void*)rg_alloc(HANDY_SCREEN_WIDTH * HANDY_SCREEN_WIDTH * 2, MEM_FAST);
@@ -199,9 +286,6 @@ extern "C" void app_main(void)
 
     set_display_mode();
 
-    float sampleTime = AUDIO_SAMPLE_RATE / 1000000.f;
-    long skipFrames = 0;
-    bool fullFrame = 0;
 
     // Start emulation
     while (1)
@@ -214,12 +298,11 @@ extern "C" void app_main(void)
                 rg_gui_game_menu();
             else
                 rg_gui_options_menu();
-            sampleTime = AUDIO_SAMPLE_RATE / 1000000.f * app->speed;
             rg_audio_set_sample_rate(app->sampleRate * app->speed);
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_system_schedule_frame();
         ULONG buttons = 0;
 
     	if (joystick & RG_KEY_UP)     buttons |= dpad_mapped_up;
@@ -233,13 +316,18 @@ extern "C" void app_main(void)
 
         lynx->SetButtonData(buttons);
 
+    #ifdef RG_ENABLE_NETPLAY
+        if (netplay)
+            comlynx_sync();
+    #endif
+
         lynx->UpdateFrame(drawFrame);
 
         if (drawFrame)
         {
             rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
 
-            fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
+            rg_display_queue_update(currentUpdate, previousUpdate);
 
             currentUpdate = previousUpdate;
             gPrimaryFrameBuffer = (UBYTE*)currentUpdate->buffer;
@@ -247,22 +335,6 @@ extern "C" void app_main(void)
 
         int elapsed = rg_system_timer() - startTime;
 
-        // See if we need to skip a frame to keep up
-        if (skipFrames == 0)
-        {
-            if (app->speed > 1.f)
-                skipFrames += (int)app->speed * 2;
-            // The Lynx uses a variable framerate so we use the count of generated audio samples as reference instead
-            else if (elapsed > ((gAudioBufferPointer/2) * sampleTime))
-                skipFrames += 1;
-            else if (drawFrame && fullFrame) // This could be avoided when scaling != full
-                skipFrames += 1;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
-
         rg_system_tick(elapsed);
 
         rg_audio_submit(audioBuffer, gAudioBufferPointer >> 1);
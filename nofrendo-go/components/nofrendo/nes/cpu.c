@@ -27,8 +27,9 @@
 static nes6502_t cpu;
 static mem_t *mem;
 
-// #define NES6502_JUMPTABLE
+#define NES6502_JUMPTABLE
 #define NES6502_FASTMEM
+#define NES6502_DECODE_CACHE
 
 
 #define ADD_CYCLES(x) \
@@ -51,17 +52,21 @@ static mem_t *mem;
 ** Addressing mode macros
 */
 
+/*
+** Operands are fetched along with the opcode (see FETCH_INSTRUCTION) and PC
+** already points to the next instruction when the handler runs.
+*/
+
 /* Immediate */
 #define IMMEDIATE_BYTE(value) \
 { \
-   value = fast_readbyte(PC++); \
+   value = (uint8) operand; \
 }
 
 /* Absolute */
 #define ABSOLUTE_ADDR(address) \
 { \
-   address = fast_readword(PC); \
-   PC += 2; \
+   address = operand; \
 }
 
 #define ABSOLUTE(address, value) \
@@ -281,7 +286,6 @@ static mem_t *mem;
    } \
    else \
    { \
-      PC++; \
       ADD_CYCLES(2); \
    } \
 }
@@ -560,7 +564,6 @@ static mem_t *mem;
 /* undocumented (double-NOP) */
 #define DOP(cycles) \
 { \
-   PC++; \
    ADD_CYCLES(cycles); \
 }
 
@@ -615,7 +618,7 @@ static mem_t *mem;
 
 #define JMP_INDIRECT() \
 { \
-   temp = fast_readword(PC); \
+   temp = operand; \
    /* bug in crossing page boundaries */ \
    if (0xFF == (temp & 0xFF)) \
       PC = (readbyte(temp & 0xFF00) << 8) | readbyte(temp); \
@@ -626,16 +629,16 @@ static mem_t *mem;
 
 #define JMP_ABSOLUTE() \
 { \
-   JUMP(PC); \
+   PC = operand; \
    ADD_CYCLES(3); \
 }
 
 #define JSR() \
 { \
-   PC++; \
-   PUSH(PC >> 8); \
-   PUSH(PC & 0xFF); \
-   JUMP(PC - 1); \
+   temp = PC - 1; \
+   PUSH(temp >> 8); \
+   PUSH(temp & 0xFF); \
+   PC = operand; \
    ADD_CYCLES(6); \
 }
 
@@ -976,7 +979,6 @@ static mem_t *mem;
 /* undocumented (triple-NOP) */
 #define TOP() \
 { \
-   PC += 2; \
    ADD_CYCLES(4); \
 }
 
@@ -1074,6 +1076,96 @@ static mem_t *mem;
 #endif /* !NES6502_FASTMEM */
 
 
+/*
+** Instruction decoding
+**
+** An instruction is packed as opcode | length << 8 | operand << 16, which is
+** never zero. With NES6502_DECODE_CACHE the decoded instructions of PRG-ROM
+** pages are kept around so that the fetch is a single load. The tables are
+** tagged with the ROM page they were decoded from, so a bank that is switched
+** out and back in finds its table again. Only when no table matches is the
+** least recently mapped one cleared and reused.
+*/
+
+static const uint8 opcode_length[256] =
+{
+   1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+   2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+   3, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+   2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+   1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+   2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+   1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+   2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+   2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+   2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+   2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+   2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+   2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+   2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+   2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+   2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+};
+
+static inline uint32 decode_instruction(uint32 address)
+{
+   uint32 opcode = fast_readbyte(address);
+   uint32 length = opcode_length[opcode];
+   uint32 operand = 0;
+
+   if (length == 3)
+      operand = fast_readword(address + 1);
+   else if (length == 2)
+      operand = fast_readbyte(address + 1);
+
+   return opcode | length << 8 | operand << 16;
+}
+
+#ifdef NES6502_DECODE_CACHE
+
+#define DECODE_FIRST_PAGE (0x8000 >> MEM_PAGESHIFT)
+#define DECODE_TABLES     (2 * (MEM_PAGECOUNT - DECODE_FIRST_PAGE))
+
+static uint32 *decode_cache;
+static uint32 *decode_pages[MEM_PAGECOUNT];
+static struct
+{
+   const uint8 *src; /* ROM page the table was decoded from */
+   uint32 last_used;
+   uint8 refs;       /* CPU pages currently using the table */
+} decode_tables[DECODE_TABLES];
+static uint32 decode_clock;
+
+static IRAM_ATTR uint32 decode_cache_miss(uint32 address, uint32 *page)
+{
+   uint32 decoded = decode_instruction(address);
+
+   /* Instructions spilling into the next page can't be kept */
+   if (page && (address & MEM_PAGEMASK) + (decoded >> 8 & 0xFF) <= MEM_PAGESIZE)
+      page[address & MEM_PAGEMASK] = decoded;
+
+   return decoded;
+}
+
+#define FETCH_INSTRUCTION() \
+{ \
+   uint32 *_page = decode_pages[(PC >> MEM_PAGESHIFT) & (MEM_PAGECOUNT - 1)]; \
+   if (!_page || !(decoded = _page[PC & MEM_PAGEMASK])) \
+      decoded = decode_cache_miss(PC, _page); \
+   operand = decoded >> 16; \
+}
+
+#else /* !NES6502_DECODE_CACHE */
+
+#define FETCH_INSTRUCTION() \
+{ \
+   decoded = decode_instruction(PC); \
+   operand = decoded >> 16; \
+}
+
+#endif /* !NES6502_DECODE_CACHE */
+
+
 #ifdef NES6502_DISASM
 #define DISASSEMBLE MESSAGE_INFO(nes6502_disasm(PC, COMBINE_FLAGS(), A, X, Y, S));
 #else
@@ -1083,18 +1175,20 @@ static mem_t *mem;
 
 #ifdef NES6502_JUMPTABLE
 
-#define OPCODE(xx, x...)  op##xx: x; OPCODE_NEXT
+#define OPCODE(xx, x...)  op##xx: PC += opcode_length[xx]; x; OPCODE_NEXT
 #define OPCODE_NEXT \
    if (remaining_cycles <= 0) break; \
    DISASSEMBLE; \
-   goto *opcode_table[fast_readbyte(PC++)];
+   FETCH_INSTRUCTION(); \
+   goto *opcode_table[decoded & 0xFF];
 
 #else /* !NES6502_JUMPTABLE */
 
-#define OPCODE(xx, x...)  case xx: x; break;
+#define OPCODE(xx, x...)  case xx: PC += opcode_length[xx]; x; break;
 #define OPCODE_NEXT \
    DISASSEMBLE;  \
-   switch (fast_readbyte(PC++))
+   FETCH_INSTRUCTION(); \
+   switch (decoded & 0xFF)
 
 #endif /* !NES6502_JUMPTABLE */
 
@@ -1130,6 +1224,7 @@ IRAM_ATTR int nes6502_execute(int cycles)
 {
    uint32 temp, addr; /* for macros */
    uint8 btemp, baddr; /* for macros */
+   uint32 decoded, operand; /* for macros */
    uint8 data;
 
    DECLARE_LOCAL_REGS();
@@ -1521,9 +1616,63 @@ void nes6502_burn(int cycles)
    cpu.burn_cycles += cycles;
 }
 
+/* Attach the decoded instructions of the bank now mapped in a page */
+IRAM_ATTR void nes6502_invalidate(uint32 page)
+{
+#ifdef NES6502_DECODE_CACHE
+   if (!decode_cache || page < DECODE_FIRST_PAGE || page >= MEM_PAGECOUNT)
+      return;
+
+   if (decode_pages[page])
+      decode_tables[(decode_pages[page] - decode_cache) / MEM_PAGESIZE].refs--;
+   decode_pages[page] = NULL;
+
+   /* Pages with read handlers must go through them every time */
+   if (!MEM_PAGE_IS_VALID_PTR(mem->pages_read[page]))
+      return;
+
+   const uint8 *src = mem->pages_read[page] + (page << MEM_PAGESHIFT);
+   int victim = -1;
+
+   for (int i = 0; i < DECODE_TABLES; i++)
+   {
+      if (decode_tables[i].src == src)
+      {
+         victim = i;
+         break;
+      }
+      if (decode_tables[i].refs == 0 && (victim < 0
+         || decode_tables[i].last_used < decode_tables[victim].last_used))
+         victim = i;
+   }
+
+   uint32 *table = decode_cache + victim * MEM_PAGESIZE;
+
+   if (decode_tables[victim].src != src)
+   {
+      memset(table, 0, MEM_PAGESIZE * sizeof(uint32));
+      decode_tables[victim].src = src;
+   }
+   decode_tables[victim].last_used = ++decode_clock;
+   decode_tables[victim].refs++;
+   decode_pages[page] = table;
+#else
+   UNUSED(page);
+#endif
+}
+
 /* Issue a CPU Reset */
 void nes6502_reset(void)
 {
+#ifdef NES6502_DECODE_CACHE
+   /* The ROM may have changed, forget what the tables were decoded from */
+   memset(decode_pages, 0, sizeof(decode_pages));
+   memset(decode_tables, 0, sizeof(decode_tables));
+#endif
+
+   for (int page = 0; page < MEM_PAGECOUNT; page++)
+      nes6502_invalidate(page);
+
    cpu.p_reg = Z_FLAG | R_FLAG | I_FLAG;  /* Reserved bit always 1 */
    cpu.pc_reg = readword(RESET_VECTOR);   /* Fetch reset vector */
    cpu.int_pending = false;               /* No pending interrupts */
@@ -1541,11 +1690,23 @@ nes6502_t *nes6502_init(mem_t *_mem)
 
    mem = _mem; // For FASTMEM
 
+#ifdef NES6502_DECODE_CACHE
+   if (!decode_cache)
+      decode_cache = calloc(DECODE_TABLES, MEM_PAGESIZE * sizeof(uint32));
+   if (!decode_cache)
+      MESSAGE_ERROR("nes6502: Not enough memory for the decode cache\n");
+#endif
+
    return &cpu;
 }
 
 /* Destroy a nes6502 object */
 void nes6502_shutdown(void)
 {
-   //
+#ifdef NES6502_DECODE_CACHE
+   memset(decode_pages, 0, sizeof(decode_pages));
+   memset(decode_tables, 0, sizeof(decode_tables));
+   free(decode_cache);
+   decode_cache = NULL;
+#endif
 }
@@ -73,6 +73,7 @@ void nes6502_irq(void);
 void nes6502_irq_clear(void);
 uint32 nes6502_getcycles(void);
 void nes6502_burn(int cycles);
+void nes6502_invalidate(uint32 page);
 
 nes6502_t *nes6502_init(mem_t *mem);
 void nes6502_reset(void);
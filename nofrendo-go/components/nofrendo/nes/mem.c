@@ -57,6 +57,8 @@ IRAM_ATTR void mem_setpage(uint32 page, uint8 *ptr)
    ASSERT(page < 32);
    ASSERT(ptr);
 
+   uint8 *old_ptr = mem.pages[page];
+
    mem.pages[page] = ptr - (page * MEM_PAGESIZE);
 
    if (!MEM_PAGE_HAS_HANDLERS(mem.pages_read[page]))
@@ -68,6 +70,11 @@ IRAM_ATTR void mem_setpage(uint32 page, uint8 *ptr)
    {
       mem.pages_write[page] = mem.pages[page];
    }
+
+   if (mem.pages[page] != old_ptr)
+   {
+      nes6502_invalidate(page);
+   }
 }
 
 /* Get 2KB memory page */
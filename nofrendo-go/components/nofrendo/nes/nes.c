@@ -34,6 +34,7 @@ nes_t *nes_getptr(void)
 void nes_emulate(bool draw)
 {
     int elapsed_cycles = 0;
+    int render_time = 0;
 
     if (nes.input_func)
     {
@@ -44,7 +45,16 @@ void nes_emulate(bool draw)
     {
         nes.cycles += nes.cycles_per_scanline;
 
-        ppu_scanline(nes.vidbuf, nes.scanline, draw);
+        if (draw && nes.scanline < NES_SCREEN_HEIGHT)
+        {
+            int64_t start = rg_system_timer();
+            ppu_scanline(nes.vidbuf, nes.scanline, draw);
+            render_time += rg_system_timer() - start;
+        }
+        else
+        {
+            ppu_scanline(nes.vidbuf, nes.scanline, draw);
+        }
 
         if (nes.scanline == 241)
         {
@@ -85,6 +95,9 @@ void nes_emulate(bool draw)
 
     nes.scanline = 0;
 
+    // Reported as nested time, rg_system_frame_mark removes it from the emulation phase
+    rg_system_frame_add(RG_FRAME_PHASE_RENDER, render_time);
+
     if (draw && nes.blit_func)
     {
         nes.blit_func(nes.vidbuf);
@@ -45,6 +45,22 @@
 /* the NES PPU */
 static ppu_t ppu;
 
+/* Decoded pattern rows of the 512 tiles in $0000-$1FFF. Each entry is tagged with
+** the CHR data it came from, so bank switches are picked up on the next lookup.
+*/
+typedef struct
+{
+   const uint8 *src;
+   uint16 rows[2][8]; /* get_patpix() of every row, normal and horizontally flipped */
+} chr_tile_t;
+
+static chr_tile_t *chr_cache;
+static uint8 bit_reverse[256];
+
+/* Sprites covering each visible line, as a 64bit mask in OAM order */
+static uint32 oam_lines[240][2];
+static bool oam_dirty = true;
+
 
 #ifndef PPU_MEM_READ
 INLINE uint8 PPU_MEM_READ(uint32 x)
@@ -61,6 +77,17 @@ void ppu_setcontext(ppu_t *src_ppu)
    ASSERT(src_ppu);
    ppu = *src_ppu;
    ppu_setnametables(ppu.nt1, ppu.nt2, ppu.nt3, ppu.nt4);
+   ppu_invalidate();
+}
+
+/* Drop the decoded CHR tiles and sprite line masks, for when CHR-RAM or OAM
+** were changed behind the PPU's back (state loads)
+*/
+void ppu_invalidate(void)
+{
+   if (chr_cache)
+      memset(chr_cache, 0, 512 * sizeof(chr_tile_t));
+   oam_dirty = true;
 }
 
 void ppu_getcontext(ppu_t *dest_ppu)
@@ -149,11 +176,33 @@ INLINE void ppu_oamdma(uint8 value)
          ppu.oam[oam_loc] = mem_getbyte(cpu_address++);
    }
 
+   oam_dirty = true;
+
    /* make the CPU spin for DMA cycles */
    nes6502_burn(513);
    // nes6502_release();
 }
 
+/* CHR-RAM was written, drop the tile from every window that holds it. That includes
+** windows that have since been switched to another bank: the entry would be used
+** again if they switch back. Banks are 1K aligned, so the tile has the same index
+** within a window wherever it's mapped and there is one candidate per window.
+*/
+static void chr_invalidate(uint32 address)
+{
+   const uint8 *src = &ppu.page[address >> 10][address & ~0xF];
+   int tile = (address & 0x3F0) >> 4;
+
+   if (!chr_cache)
+      return;
+
+   for (int page = 0; page < 8; page++)
+   {
+      if (chr_cache[(page << 6) | tile].src == src)
+         chr_cache[(page << 6) | tile].src = NULL;
+   }
+}
+
 /* Read from $2000-$2007 */
 IRAM_ATTR uint8 ppu_read(uint32 address)
 {
@@ -230,6 +279,8 @@ IRAM_ATTR void ppu_write(uint32 address, uint8 value)
    case PPU_CTRL0:
       ppu.ctrl0 = value;
 
+      if (ppu.obj_height != ((value & PPU_CTRL0F_OBJ16) ? 16 : 8))
+         oam_dirty = true;
       ppu.obj_height = (value & PPU_CTRL0F_OBJ16) ? 16 : 8;
       ppu.bg_base = (value & PPU_CTRL0F_BGADDR) ? 0x1000 : 0;
       ppu.obj_base = (value & PPU_CTRL0F_OBJADDR) ? 0x1000 : 0;
@@ -256,6 +307,7 @@ IRAM_ATTR void ppu_write(uint32 address, uint8 value)
 
    case PPU_OAMDATA:
       ppu.oam[ppu.oam_addr++] = value;
+      oam_dirty = true;
       break;
 
    case PPU_SCROLL:
@@ -304,6 +356,8 @@ IRAM_ATTR void ppu_write(uint32 address, uint8 value)
             MESSAGE_DEBUG("VRAM write to $%04X, scanline %d\n",
                            ppu.vaddr, NES_CURRENT_SCANLINE);
             PPU_MEM_WRITE(ppu.vaddr, 0xFF); /* corrupt */
+            if (ppu.vaddr < 0x2000)
+               chr_invalidate(ppu.vaddr);
          }
          else
          {
@@ -313,6 +367,9 @@ IRAM_ATTR void ppu_write(uint32 address, uint8 value)
                ppu.vaddr -= 0x1000;
 
             PPU_MEM_WRITE(addr, value);
+
+            if (addr < 0x2000)
+               chr_invalidate(addr);
          }
       }
       else
@@ -365,46 +422,65 @@ void ppu_setvreadfunc(ppu_vreadfunc_t func)
 }
 
 /* rendering routines */
-INLINE uint32 get_patpix(uint32 tile_addr)
+INLINE uint32 interleave_pattern(uint8 pat1, uint8 pat2)
 {
-   uint8 pat1 = PPU_MEM_READ(tile_addr);
-   uint8 pat2 = PPU_MEM_READ(tile_addr + 8);
    return ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1)
         | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
 }
 
-INLINE void build_tile_colors(bool flip, uint32 pattern, uint8 *colors)
+INLINE uint32 get_patpix(uint32 tile_addr)
+{
+   return interleave_pattern(PPU_MEM_READ(tile_addr), PPU_MEM_READ(tile_addr + 8));
+}
+
+static void decode_chr_tile(chr_tile_t *tile, const uint8 *src)
 {
-   /* swap pixels around if our tile is flipped */
-   if (flip)
+   for (int row = 0; row < 8; row++)
    {
-      colors[7] = (pattern >> 14) & 3;
-      colors[6] = (pattern >> 6) & 3;
-      colors[5] = (pattern >> 12) & 3;
-      colors[4] = (pattern >> 4) & 3;
-      colors[3] = (pattern >> 10) & 3;
-      colors[2] = (pattern >> 2) & 3;
-      colors[1] = (pattern >> 8) & 3;
-      colors[0] = pattern & 3;
+      tile->rows[0][row] = interleave_pattern(src[row], src[row + 8]);
+      tile->rows[1][row] = interleave_pattern(bit_reverse[src[row]], bit_reverse[src[row + 8]]);
    }
-   else
+   tile->src = src;
+}
+
+/* Pattern row at addr, with the pixels already swapped around if flip is set */
+INLINE uint32 get_chr_row(uint32 addr, int flip)
+{
+   uint32 tile_addr = addr & 0x1FF0;
+   const uint8 *src = &ppu.page[tile_addr >> 10][tile_addr];
+
+   if (!chr_cache)
    {
-      colors[0] = (pattern >> 14) & 3;
-      colors[1] = (pattern >> 6) & 3;
-      colors[2] = (pattern >> 12) & 3;
-      colors[3] = (pattern >> 4) & 3;
-      colors[4] = (pattern >> 10) & 3;
-      colors[5] = (pattern >> 2) & 3;
-      colors[6] = (pattern >> 8) & 3;
-      colors[7] = pattern & 3;
+      src += addr & 7;
+      if (flip)
+         return interleave_pattern(bit_reverse[src[0]], bit_reverse[src[8]]);
+      return interleave_pattern(src[0], src[8]);
    }
+
+   chr_tile_t *tile = &chr_cache[tile_addr >> 4];
+   if (tile->src != src)
+      decode_chr_tile(tile, src);
+
+   return tile->rows[flip][addr & 7];
+}
+
+INLINE void build_tile_colors(uint32 pattern, uint8 *colors)
+{
+   colors[0] = (pattern >> 14) & 3;
+   colors[1] = (pattern >> 6) & 3;
+   colors[2] = (pattern >> 12) & 3;
+   colors[3] = (pattern >> 4) & 3;
+   colors[4] = (pattern >> 10) & 3;
+   colors[5] = (pattern >> 2) & 3;
+   colors[6] = (pattern >> 8) & 3;
+   colors[7] = pattern & 3;
 }
 
 /* we render a scanline of graphics first so we know exactly
 ** where the sprite 0 strike is going to occur (in terms of
 ** cpu cycles), using the relation that 3 pixels == 1 cpu cycle
 */
-INLINE void check_strike(uint8 *surface, uint8 attrib, uint32 pattern)
+INLINE void check_strike(uint8 *surface, uint32 pattern)
 {
    uint8 colors[8];
 
@@ -416,7 +492,7 @@ INLINE void check_strike(uint8 *surface, uint8 attrib, uint32 pattern)
    if (0 == pattern)
       return;
 
-   build_tile_colors(attrib & OAMF_HFLIP, pattern, colors);
+   build_tile_colors(pattern, colors);
 
    for (int i = 0; i < 8; i++)
    {
@@ -450,7 +526,7 @@ INLINE void draw_oamtile(uint8 *surface, uint8 attrib, uint32 pattern, const uin
    if (0 == pattern)
       return;
 
-   build_tile_colors(attrib & OAMF_HFLIP, pattern, colors);
+   build_tile_colors(pattern, colors);
 
    /* draw the character */
    if (attrib & OAMF_BEHIND)
@@ -507,7 +583,7 @@ INLINE void ppu_renderbg(uint8 *vidbuf)
          ppu.latchfunc(ppu.bg_base, tile_index);
 
       /* Fetch tile and draw it */
-      draw_bgtile(bmp_ptr, get_patpix(bg_offset + (tile_index << 4)), ppu.palette + col_high);
+      draw_bgtile(bmp_ptr, get_chr_row(bg_offset + (tile_index << 4), 0), ppu.palette + col_high);
       bmp_ptr += 8;
 
       x_tile++;
@@ -541,88 +617,119 @@ INLINE void ppu_renderbg(uint8 *vidbuf)
    }
 }
 
+/* Sort the sprites into per-line buckets. OAM is usually only DMA'd once per
+** frame, this saves checking all 64 entries on every line.
+*/
+static void build_oam_lines(void)
+{
+   memset(oam_lines, 0, sizeof(oam_lines));
+
+   for (int sprite_num = 0; sprite_num < 64; sprite_num++)
+   {
+      ppu_obj_t *sprite = (ppu_obj_t *)ppu.oam + sprite_num;
+      int sprite_y = sprite->y_loc + 1;
+
+      if ((0 == sprite_y) || (sprite_y >= 240))
+         continue;
+
+      int last = MIN(sprite_y + ppu.obj_height, 240);
+      for (int line = sprite_y; line < last; line++)
+         oam_lines[line][sprite_num >> 5] |= 1u << (sprite_num & 31);
+   }
+
+   oam_dirty = false;
+}
+
 /* TODO: fetch valid OAM a scanline before, like the Real Thing */
 INLINE void ppu_renderoam(uint8 *vidbuf, int scanline, bool draw)
 {
    if (!ppu.obj_on)
       return;
 
+   if (oam_dirty)
+      build_oam_lines();
+
    /* Save left hand column */
    uint32 savecol1 = ((uint32 *) vidbuf)[0];
    uint32 savecol2 = ((uint32 *) vidbuf)[1];
 
    int sprite_height = ppu.obj_height;
    int sprite_offset = ppu.obj_base;
+   int count = 0;
 
-   for (int sprite_num = 0, count = 0; sprite_num < 64; sprite_num++)
+   for (int half = 0; half < 2; half++)
    {
-      ppu_obj_t *sprite = (ppu_obj_t *)ppu.oam + sprite_num;
+      uint32 mask = oam_lines[scanline][half];
 
-      int sprite_y = sprite->y_loc + 1;
-      int tile_index = sprite->tile;
+      while (mask)
+      {
+         int sprite_num = (half << 5) | __builtin_ctz(mask);
+         ppu_obj_t *sprite = (ppu_obj_t *)ppu.oam + sprite_num;
+         int sprite_y = sprite->y_loc + 1;
+         int tile_index = sprite->tile;
+         int tile_addr, y_offset;
 
-      /* Check to see if sprite is out of range */
-      if ((sprite_y > scanline) || (sprite_y <= (scanline - sprite_height))
-          || (0 == sprite_y) || (sprite_y >= 240))
-         continue;
+         mask &= mask - 1;
 
-      /* Handle $FD/$FE magic tile CHR-ROM switching (MMC2/MMC4) */
-      if (ppu.latchfunc && (tile_index == 0xFD || tile_index == 0xFE))
-         ppu.latchfunc(sprite_offset, tile_index);
+         /* Handle $FD/$FE magic tile CHR-ROM switching (MMC2/MMC4) */
+         if (ppu.latchfunc && (tile_index == 0xFD || tile_index == 0xFE))
+            ppu.latchfunc(sprite_offset, tile_index);
 
-      int tile_addr, y_offset;
+         /* 8x16 even sprites use $0000, odd use $1000 */
+         if (16 == sprite_height)
+            tile_addr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);
+         else
+            tile_addr = sprite_offset + (tile_index << 4);
 
-      /* 8x16 even sprites use $0000, odd use $1000 */
-      if (16 == sprite_height)
-         tile_addr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);
-      else
-         tile_addr = sprite_offset + (tile_index << 4);
+         /* Calculate offset (line within the sprite) */
+         y_offset = scanline - sprite_y;
+         if (y_offset > 7)
+            y_offset += 8;
 
-      /* Calculate offset (line within the sprite) */
-      y_offset = scanline - sprite_y;
-      if (y_offset > 7)
-         y_offset += 8;
+         /* Account for vertical flippage */
+         if (sprite->attr & OAMF_VFLIP)
+         {
+            if (16 == sprite_height)
+               y_offset -= 23;
+            else
+               y_offset -= 7;
 
-      /* Account for vertical flippage */
-      if (sprite->attr & OAMF_VFLIP)
-      {
-         if (16 == sprite_height)
-            y_offset -= 23;
+            tile_addr -= y_offset;
+         }
          else
-            y_offset -= 7;
+         {
+            tile_addr += y_offset;
+         }
 
-         tile_addr -= y_offset;
-      }
-      else
-      {
-         tile_addr += y_offset;
-      }
+         uint32 pattern = get_chr_row(tile_addr, (sprite->attr & OAMF_HFLIP) ? 1 : 0);
 
-      /* Check for a strike on sprite 0 if strike flag isn't set */
-      if (sprite_num == 0 && !ppu.strikeflag)
-      {
-         check_strike(draw ? vidbuf + sprite->x_loc : NULL, sprite->attr, get_patpix(tile_addr));
-      }
+         /* Check for a strike on sprite 0 if strike flag isn't set */
+         if (sprite_num == 0 && !ppu.strikeflag)
+         {
+            check_strike(draw ? vidbuf + sprite->x_loc : NULL, pattern);
+         }
 
-      /* If we don't draw to buffer then we're done after sprite 0 */
-      if (!draw)
-         return;
+         /* If we don't draw to buffer then we're done after sprite 0 */
+         if (!draw)
+            return;
 
-      /* Fetch tile and draw it */
-      draw_oamtile(
-         vidbuf + sprite->x_loc,
-         sprite->attr,
-         get_patpix(tile_addr),
-         ppu.palette + 16 + ((sprite->attr & 3) << 2));
-
-      /* maximum of 8 sprites per scanline */
-      if (OPT(PPU_LIMIT_SPRITES) && ++count == PPU_MAXSPRITE)
-      {
-         ppu.stat |= PPU_STATF_MAXSPRITE;
-         break;
+         /* Fetch tile and draw it */
+         draw_oamtile(
+            vidbuf + sprite->x_loc,
+            sprite->attr,
+            pattern,
+            ppu.palette + 16 + ((sprite->attr & 3) << 2));
+
+         /* maximum of 8 sprites per scanline */
+         if (OPT(PPU_LIMIT_SPRITES) && ++count == PPU_MAXSPRITE)
+         {
+            ppu.stat |= PPU_STATF_MAXSPRITE;
+            goto done;
+         }
       }
    }
 
+done:
    /* Restore lefthand column */
    if (!ppu.left_obj_on)
    {
@@ -732,12 +839,28 @@ void ppu_reset()
    ppu.latch = 0;
    ppu.vram_accessible = true;
    ppu.last_scanline = NES_SCANLINES - 1;
+
+   ppu_invalidate();
 }
 
 ppu_t *ppu_init(void)
 {
    memset(&ppu, 0, sizeof(ppu_t));
 
+   for (int i = 0; i < 256; i++)
+   {
+      uint8 b = i;
+      b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+      b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+      b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+      bit_reverse[i] = b;
+   }
+
+   if (!chr_cache)
+      chr_cache = calloc(512, sizeof(chr_tile_t));
+   if (!chr_cache)
+      MESSAGE_WARN("PPU: Unable to allocate the pattern cache!\n");
+
    ppu_setopt(PPU_DRAW_BACKGROUND, true);
    ppu_setopt(PPU_DRAW_SPRITES, true);
    ppu_setopt(PPU_LIMIT_SPRITES, true);
@@ -747,7 +870,8 @@ ppu_t *ppu_init(void)
 
 void ppu_shutdown(void)
 {
-   //
+   free(chr_cache);
+   chr_cache = NULL;
 }
 
 
@@ -157,6 +157,7 @@ void ppu_setvreadfunc(ppu_vreadfunc_t func);
 
 void ppu_getcontext(ppu_t *dest_ppu);
 void ppu_setcontext(ppu_t *src_ppu);
+void ppu_invalidate(void);
 
 /* IO */
 uint8 ppu_read(uint32 address);
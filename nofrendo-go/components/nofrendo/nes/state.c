@@ -116,27 +116,19 @@ static bool memory_zone_dirty(const void *ptr, size_t size)
 }
 
 
-int state_save(const char* fn)
+int state_write(FILE *file)
 {
    uint32 numberOfBlocks = 0;
    uint8 buffer[512];
    nes_t *machine = nes_getptr();
-   FILE *file;
-
-   if (!(file = fopen(fn, "wb")))
-   {
-       MESSAGE_ERROR("state_save: file '%s' could not be opened.\n", fn);
-       return -1; //goto _error;
-   }
-
-   MESSAGE_INFO("state_save: file '%s' opened.\n", fn);
+   long start = ftell(file);
 
    _fwrite("SNSS\x00\x00\x00\x05", 8);
 
 
    /****************************************************/
 
-   MESSAGE_INFO("  - Saving base block\n");
+   MESSAGE_DEBUG("Saving base block\n");
 
    buffer[0] = machine->cpu->a_reg;
    buffer[1] = machine->cpu->x_reg;
@@ -173,7 +165,7 @@ int state_save(const char* fn)
 
    /****************************************************/
 
-   MESSAGE_INFO("  - Saving info block\n");
+   MESSAGE_DEBUG("Saving info block\n");
 
    _fwrite("INFO\x00\x00\x00\x01\x00\x00\x01\x00", 12);
    _fwrite(&buffer, 0x100);
@@ -182,7 +174,7 @@ int state_save(const char* fn)
 
    /****************************************************/
 
-   MESSAGE_INFO("  - Saving sound block\n");
+   MESSAGE_DEBUG("Saving sound block\n");
 
    buffer[0x00] = machine->apu->rectangle[0].regs[0];
    buffer[0x01] = machine->apu->rectangle[0].regs[1];
@@ -213,7 +205,7 @@ int state_save(const char* fn)
 
    if (memory_zone_dirty(machine->cart->chr_ram, 0x2000 * machine->cart->chr_ram_banks))
    {
-      MESSAGE_INFO("  - Saving VRAM block\n");
+      MESSAGE_DEBUG("Saving VRAM block\n");
 
       _fwrite("VRAM\x00\x00\x00\x01\x00\x00\x20\x00", 12);
       _fwrite(machine->cart->chr_ram, 0x2000 * machine->cart->chr_ram_banks);
@@ -225,7 +217,7 @@ int state_save(const char* fn)
 
    if (memory_zone_dirty(machine->cart->prg_ram, 0x2000 * machine->cart->prg_ram_banks))
    {
-      MESSAGE_INFO("  - Saving SRAM block\n");
+      MESSAGE_DEBUG("Saving SRAM block\n");
 
       // Byte 0 = SRAM enabled (unused)
       // Length is always $2001
@@ -239,7 +231,7 @@ int state_save(const char* fn)
 
    if (machine->mapper->number > 0)
    {
-      MESSAGE_INFO("  - Saving mapper block\n");
+      MESSAGE_DEBUG("Saving mapper block\n");
 
       for (int i = 0; i < 4; i++)
       {
@@ -271,52 +263,42 @@ int state_save(const char* fn)
    /****************************************************/
 
    // Update number of blocks
-   fseek(file, 4, SEEK_SET);
+   long end = ftell(file);
+   fseek(file, start + 4, SEEK_SET);
    numberOfBlocks = swap32(numberOfBlocks);
    _fwrite(&numberOfBlocks, 4);
-
-   fclose(file);
-
-   MESSAGE_INFO("state_save: Game saved!\n");
+   fseek(file, end, SEEK_SET);
 
    return 0;
 
 _error:
-   MESSAGE_ERROR("state_save: Save failed!\n");
-   fclose(file);
    return -1;
 }
 
 
-int state_load(const char* fn)
+int state_read(FILE *file)
 {
    uint8 buffer[512];
 
    nes_t *machine = nes_getptr();
-   FILE *file;
-
-   if (!(file = fopen(fn, "rb")))
-   {
-       MESSAGE_ERROR("state_load: file '%s' could not be opened.\n", fn);
-       return -1; //goto _error;
-  }
+   long start = ftell(file);
 
    _fread(buffer, 8);
 
    if (memcmp(buffer, "SNSS", 4) != 0)
    {
-      MESSAGE_ERROR("state_load: file '%s' is not a save file.\n", fn);
+      MESSAGE_ERROR("state_load: not a save file.\n");
       goto _error;
    }
 
    size_t numberOfBlocks = swap32(*((uint32*)&buffer[4]));
    size_t nextBlock = 8;
 
-   MESSAGE_INFO("state_load: file '%s' opened, blocks=%d.\n", fn, numberOfBlocks);
+   MESSAGE_DEBUG("blocks=%d.\n", numberOfBlocks);
 
    for (size_t blk = 0; blk < numberOfBlocks; blk++)
    {
-      fseek(file, nextBlock, SEEK_SET);
+      fseek(file, start + nextBlock, SEEK_SET);
       _fread(buffer, 12);
 
       unsigned blockVersion = swap32(*((uint32*)&buffer[4]));
@@ -330,7 +312,7 @@ int state_load(const char* fn)
 
       if (memcmp(buffer, "BASR", 4) == 0)
       {
-         MESSAGE_INFO("  - Found base block\n");
+         MESSAGE_DEBUG("Found base block\n");
 
          _fread(buffer, 9);
 
@@ -374,7 +356,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "VRAM", 4) == 0)
       {
-         MESSAGE_INFO("  - Found VRAM block\n");
+         MESSAGE_DEBUG("Found VRAM block\n");
 
          if (machine->cart->chr_ram_banks < (blockLength / ROM_CHR_BANK_SIZE))
          {
@@ -390,7 +372,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "SRAM", 4) == 0)
       {
-         MESSAGE_INFO("  - Found SRAM block\n");
+         MESSAGE_DEBUG("Found SRAM block\n");
 
          if (machine->cart->prg_ram_banks < ((blockLength-1) / ROM_PRG_BANK_SIZE))
          {
@@ -407,7 +389,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "MPRD", 4) == 0)
       {
-         MESSAGE_INFO("  - Found mapper block\n");
+         MESSAGE_DEBUG("Found mapper block\n");
 
          _fread(buffer, 0x98);
 
@@ -434,7 +416,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "SOUN", 4) == 0)
       {
-         MESSAGE_INFO("  - Found sound block\n");
+         MESSAGE_DEBUG("Found sound block\n");
 
          _fread(buffer, 0x16);
 
@@ -449,7 +431,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "INFO", 4) == 0)
       {
-         MESSAGE_INFO("  - Found info block\n");
+         MESSAGE_DEBUG("Found info block\n");
 
          _fread(buffer, 0x100);
 
@@ -465,15 +447,59 @@ int state_load(const char* fn)
       }
    }
 
-   /* close file, we're done */
+   /* CHR-RAM and OAM were read straight into memory, the PPU's caches don't know */
+   ppu_invalidate();
+   return 0;
+
+_error:
+   ppu_invalidate();
+   return -1;
+}
+
+
+int state_save(const char* fn)
+{
+   FILE *file;
+
+   if (!(file = fopen(fn, "wb")))
+   {
+       MESSAGE_ERROR("state_save: file '%s' could not be opened.\n", fn);
+       return -1;
+   }
+
+   MESSAGE_INFO("state_save: file '%s' opened.\n", fn);
+
+   int ret = state_write(file);
    fclose(file);
 
-   MESSAGE_INFO("state_load: Game restored\n");
+   if (ret < 0)
+      MESSAGE_ERROR("state_save: Save failed!\n");
+   else
+      MESSAGE_INFO("state_save: Game saved!\n");
 
-   return 0;
+   return ret;
+}
 
-_error:
-   MESSAGE_ERROR("state_load: Load failed!\n");
+
+int state_load(const char* fn)
+{
+   FILE *file;
+
+   if (!(file = fopen(fn, "rb")))
+   {
+       MESSAGE_ERROR("state_load: file '%s' could not be opened.\n", fn);
+       return -1;
+   }
+
+   MESSAGE_INFO("state_load: file '%s' opened.\n", fn);
+
+   int ret = state_read(file);
    fclose(file);
-   return -1;
+
+   if (ret < 0)
+      MESSAGE_ERROR("state_load: Load failed!\n");
+   else
+      MESSAGE_INFO("state_load: Game restored\n");
+
+   return ret;
 }
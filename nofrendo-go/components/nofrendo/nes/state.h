@@ -25,3 +25,5 @@
 
 int state_load(const char *fn);
 int state_save(const char *fn);
+int state_read(FILE *file);
+int state_write(FILE *file);
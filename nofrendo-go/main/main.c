@@ -15,7 +15,6 @@ static rg_app_t *app;
 static uint32_t joystick1;
 static uint32_t *localJoystick = &joystick1;
 
-static int fullFrame = 0;
 static int overscan = true;
 static int autocrop = 0;
 static int palette = 0;
@@ -23,8 +22,8 @@ static int crop_h, crop_v;
 static nes_t *nes;
 
 #ifdef RG_ENABLE_NETPLAY
-static uint32_t *remoteJoystick = &joystick2;
 static uint32_t joystick2;
+static uint32_t *remoteJoystick = &joystick2;
 
 static bool netplay = false;
 #endif
@@ -43,7 +42,7 @@ static void event_handler(int event, void *arg)
 
     switch (event)
     {
-    case NETPLAY_EVENT_STATUS_CHANGED:
+    case RG_EVENT_TYPE_NETPLAY | NETPLAY_EVENT_STATUS_CHANGED:
         new_netplay = (rg_netplay_status() == NETPLAY_STATUS_CONNECTED);
 
         if (netplay && !new_netplay)
@@ -99,12 +98,50 @@ static bool load_state_handler(const char *filename)
     return true;
 }
 
+static bool save_stream_handler(FILE *fp)
+{
+    return state_write(fp) == 0;
+}
+
+static bool load_stream_handler(FILE *fp)
+{
+    return state_read(fp) == 0;
+}
+
 static bool reset_handler(bool hard)
 {
     nes_reset(hard);
     return true;
 }
 
+static void update_input(int player, uint32_t joystick)
+{
+    int buttons = 0;
+
+    if (joystick & RG_KEY_START)  buttons |= NES_PAD_START;
+    if (joystick & RG_KEY_SELECT) buttons |= NES_PAD_SELECT;
+    if (joystick & RG_KEY_UP)     buttons |= NES_PAD_UP;
+    if (joystick & RG_KEY_RIGHT)  buttons |= NES_PAD_RIGHT;
+    if (joystick & RG_KEY_DOWN)   buttons |= NES_PAD_DOWN;
+    if (joystick & RG_KEY_LEFT)   buttons |= NES_PAD_LEFT;
+    if (joystick & RG_KEY_A)      buttons |= NES_PAD_A;
+    if (joystick & RG_KEY_B)      buttons |= NES_PAD_B;
+
+    input_update(player, buttons);
+}
+
+#ifdef RG_ENABLE_NETPLAY
+// Re-emulates a past frame after a misprediction, nothing must be drawn or played
+static void netplay_replay_handler(void *local_data, void *remote_data)
+{
+    memcpy(localJoystick, local_data, sizeof(*localJoystick));
+    memcpy(remoteJoystick, remote_data, sizeof(*remoteJoystick));
+    update_input(0, joystick1);
+    update_input(1, joystick2);
+    nes_emulate(false);
+}
+#endif
+
 
 static void set_display_mode(void)
 {
@@ -217,7 +254,7 @@ static void blit_screen(uint8 *bmp)
     // A rolling average should be used for autocrop == 1, it causes jitter in some games...
     // int crop_h = (autocrop == 2) || (autocrop == 1 && nes->ppu->left_bg_counter > 210) ? 8 : 0;
     currentUpdate->buffer = NES_SCREEN_GETPTR(bmp, crop_h, crop_v);
-    fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
+    rg_display_queue_update(currentUpdate, previousUpdate);
     previousUpdate = currentUpdate;
     currentUpdate = &updates[currentUpdate == &updates[0]];
 }
@@ -244,6 +281,8 @@ void app_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateStream = &load_stream_handler,
+        .saveStateStream = &save_stream_handler,
         .reset = &reset_handler,
         .event = &event_handler,
         .screenshot = &screenshot_handler,
@@ -258,6 +297,10 @@ void app_main(void)
 
     app = rg_system_init(AUDIO_SAMPLE_RATE, &handlers, options);
 
+#ifdef RG_ENABLE_NETPLAY
+    rg_netplay_set_replay_handler(&netplay_replay_handler);
+#endif
+
     overscan = rg_settings_get_number(NS_APP, SETTING_OVERSCAN, 1);
     autocrop = rg_settings_get_number(NS_APP, SETTING_AUTOCROP, 0);
     palette = rg_settings_get_number(NS_APP, SETTING_PALETTE, 0);
@@ -296,7 +339,7 @@ void app_main(void)
         rg_emu_load_state(app->saveSlot);
     }
 
-    int skipFrames = 0;
+    int nsfFrames = 0;
     int nsfPlayer = nes->cart->mapper_number == 31;
 
     while (true)
@@ -315,57 +358,29 @@ void app_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames && !nsfPlayer;
-        int buttons = 0;
-
-        if (joystick1 & RG_KEY_START)  buttons |= NES_PAD_START;
-        if (joystick1 & RG_KEY_SELECT) buttons |= NES_PAD_SELECT;
-        if (joystick1 & RG_KEY_UP)     buttons |= NES_PAD_UP;
-        if (joystick1 & RG_KEY_RIGHT)  buttons |= NES_PAD_RIGHT;
-        if (joystick1 & RG_KEY_DOWN)   buttons |= NES_PAD_DOWN;
-        if (joystick1 & RG_KEY_LEFT)   buttons |= NES_PAD_LEFT;
-        if (joystick1 & RG_KEY_A)      buttons |= NES_PAD_A;
-        if (joystick1 & RG_KEY_B)      buttons |= NES_PAD_B;
-        input_update(0, buttons);
+        bool drawFrame = rg_system_schedule_frame() && !nsfPlayer;
 
     #ifdef RG_ENABLE_NETPLAY
         if (netplay)
         {
+            // In rollback mode this may re-emulate a few frames before returning
             rg_netplay_sync(localJoystick, remoteJoystick, sizeof(*localJoystick));
-            uint buttons = 0;
-            if (joystick2 & RG_KEY_START)  buttons |= NES_PAD_START;
-            if (joystick2 & RG_KEY_SELECT) buttons |= NES_PAD_SELECT;
-            if (joystick2 & RG_KEY_UP)     buttons |= NES_PAD_UP;
-            if (joystick2 & RG_KEY_RIGHT)  buttons |= NES_PAD_RIGHT;
-            if (joystick2 & RG_KEY_DOWN)   buttons |= NES_PAD_DOWN;
-            if (joystick2 & RG_KEY_LEFT)   buttons |= NES_PAD_LEFT;
-            if (joystick2 & RG_KEY_A)      buttons |= NES_PAD_A;
-            if (joystick2 & RG_KEY_B)      buttons |= NES_PAD_B;
-            input_update(1, buttons);
+            update_input(1, joystick2);
         }
     #endif
 
+        update_input(0, joystick1);
+
+        rg_system_frame_mark(RG_FRAME_PHASE_INPUT);
+
         nes_emulate(drawFrame);
 
+        rg_system_frame_mark(RG_FRAME_PHASE_EMULATE);
+
         int elapsed = rg_system_timer() - startTime;
 
-        if (skipFrames == 0)
-        {
-            int frameTime = 1000000 / (nes->refresh_rate * app->speed);
-            if (elapsed > frameTime - 2000) // It takes about 2ms to copy the audio buffer
-                skipFrames = (elapsed + frameTime / 2) / frameTime;
-            else if (drawFrame && fullFrame) // This could be avoided when scaling != full
-                skipFrames = 1;
-            else if (nsfPlayer)
-                skipFrames = 10, nsf_draw_overlay();
-
-            if (app->speed > 1.f) // This is a hack until we account for audio speed...
-                skipFrames += (int)app->speed;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
+        if (nsfPlayer && nsfFrames++ % 10 == 0)
+            nsf_draw_overlay();
 
         // Tick before submitting audio/syncing
         rg_system_tick(elapsed);
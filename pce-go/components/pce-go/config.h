@@ -9,3 +9,6 @@
 #define ENABLE_IO_TRACING      0
 
 #define USE_MEM_MACROS         0
+
+// Dispatch opcodes with computed gotos instead of a switch (GCC extension)
+#define USE_THREADED_DISPATCH  1
@@ -6,7 +6,18 @@
 #include "pce-go.h"
 #include "pce.h"
 
+#if USE_THREADED_DISPATCH
+// Each handler jumps straight to the next one through dispatch_table
+#define OPCODE(n, f) case n: op_##n: f; DISPATCH();
+#define DISPATCH() {										\
+	if (Cycles >= max_cycles) return;						\
+	opcode = imm_operand(CPU.PC);							\
+	TRACE_CPU("0x%4X: %s\n", CPU.PC, opcodes[opcode].name);	\
+	goto *dispatch_table[opcode];							\
+}
+#else
 #define OPCODE(n, f) case n: f; break;
+#endif
 #define Cycles PCE.Cycles
 
 h6280_t CPU;
@@ -66,6 +77,27 @@ h6280_run(int max_cycles)
 		interrupt(irq);
 	}
 
+#if USE_THREADED_DISPATCH
+	static const void *dispatch_table[256] = {
+		&&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07, &&op_0x08, &&op_0x09, &&op_0x0A, &&op_illegal, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+		&&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17, &&op_0x18, &&op_0x19, &&op_0x1A, &&op_illegal, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27, &&op_0x28, &&op_0x29, &&op_0x2A, &&op_illegal, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_illegal, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37, &&op_0x38, &&op_0x39, &&op_0x3A, &&op_illegal, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47, &&op_0x48, &&op_0x49, &&op_0x4A, &&op_illegal, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57, &&op_0x58, &&op_0x59, &&op_0x5A, &&op_illegal, &&op_illegal, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+		&&op_0x60, &&op_0x61, &&op_0x62, &&op_illegal, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67, &&op_0x68, &&op_0x69, &&op_0x6A, &&op_illegal, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77, &&op_0x78, &&op_0x79, &&op_0x7A, &&op_illegal, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87, &&op_0x88, &&op_0x89, &&op_0x8A, &&op_illegal, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97, &&op_0x98, &&op_0x99, &&op_0x9A, &&op_illegal, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+		&&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7, &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_illegal, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+		&&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7, &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_illegal, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+		&&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7, &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_illegal, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+		&&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7, &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_illegal, &&op_illegal, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+		&&op_0xE0, &&op_0xE1, &&op_illegal, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7, &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_illegal, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+		&&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7, &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_illegal, &&op_illegal, &&op_0xFD, &&op_0xFE, &&op_0xFF,
+	};
+#endif
+
 	/* Run for roughly one scanline */
 	while (Cycles < max_cycles)
 	{
@@ -326,9 +358,15 @@ h6280_run(int max_cycles)
 			OPCODE(0xFF, bbs(7));				// BBS7 $ZZ,$rr
 
 			default:
+#if USE_THREADED_DISPATCH
+			op_illegal:
+#endif
 				// Illegal opcodes are treated as NOP
 				MESSAGE_DEBUG("Illegal opcode 0x%02X at pc=0x%04X!\n", opcode, CPU.PC);
 				nop();
+#if USE_THREADED_DISPATCH
+				DISPATCH();
+#endif
 		}
 	}
 }
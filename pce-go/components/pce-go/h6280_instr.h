@@ -527,6 +527,57 @@ OPCODE_FUNC asl_zpx(void)
 	Cycles += 6;
 }
 
+// Called after a taken branch that moved PC by `jump`. IRQs are only taken between h6280_run()
+// calls, so a loop that branches to itself or only polls RAM or the VDC status register can't
+// exit before the next scanline. In that case we burn the remaining cycles right away.
+static inline void
+idle_loop_skip(int jump)
+{
+	UWORD pc = CPU.PC;
+	UWORD addr;
+	int len;
+
+	if (jump > 0 || jump < -5)
+		return;
+
+	if (jump < 0)
+	{
+		switch (imm_operand(pc))
+		{
+		case 0xA5: // LDA $ZZ
+		case 0x24: // BIT $ZZ
+		case 0xC5: // CMP $ZZ
+			len = 2;
+			break;
+		case 0xAD: // LDA $hhll
+		case 0x2C: // BIT $hhll
+		case 0xCD: // CMP $hhll
+			addr = pce_read16(pc + 1);
+			if (PageR[addr >> 13] == PCE.IOAREA && (addr & 0x1F03) != 0)
+				return;
+			len = 3;
+			break;
+		default:
+			return;
+		}
+
+		switch (imm_operand(pc + len))
+		{
+		case 0x29: // AND #$nn
+		case 0xC9: // CMP #$nn
+			len += 2;
+			break;
+		}
+
+		// The loop must only contain the instructions above and the branch
+		if (len != -jump)
+			return;
+	}
+
+	if (Cycles < PCE.MaxCycles)
+		Cycles = PCE.MaxCycles;
+}
+
 OPCODE_FUNC bbr(UBYTE bit)
 {
 	CPU.P &= ~FL_T;
@@ -537,8 +588,10 @@ OPCODE_FUNC bbr(UBYTE bit)
 	}
 	else
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 2) + 3;
+		SBYTE rel = imm_operand(CPU.PC + 2);
+		CPU.PC += rel + 3;
 		Cycles += 8;
+		idle_loop_skip(rel + 3);
 	}
 }
 
@@ -547,8 +600,10 @@ OPCODE_FUNC bbs(UBYTE bit)
 	CPU.P &= ~FL_T;
 	if (zp_operand(CPU.PC + 1) & (1 << bit))
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 2) + 3;
+		SBYTE rel = imm_operand(CPU.PC + 2);
+		CPU.PC += rel + 3;
 		Cycles += 8;
+		idle_loop_skip(rel + 3);
 	}
 	else
 	{
@@ -567,8 +622,10 @@ OPCODE_FUNC bcc(void)
 	}
 	else
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+		SBYTE rel = imm_operand(CPU.PC + 1);
+		CPU.PC += rel + 2;
 		Cycles += 4;
+		idle_loop_skip(rel + 2);
 	}
 }
 
@@ -577,8 +634,10 @@ OPCODE_FUNC bcs(void)
 	CPU.P &= ~FL_T;
 	if (CPU.P & FL_C)
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+		SBYTE rel = imm_operand(CPU.PC + 1);
+		CPU.PC += rel + 2;
 		Cycles += 4;
+		idle_loop_skip(rel + 2);
 	}
 	else
 	{
@@ -592,8 +651,10 @@ OPCODE_FUNC beq(void)
 	CPU.P &= ~FL_T;
 	if (CPU.P & FL_Z)
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+		SBYTE rel = imm_operand(CPU.PC + 1);
+		CPU.PC += rel + 2;
 		Cycles += 4;
+		idle_loop_skip(rel + 2);
 	}
 	else
 	{
@@ -647,8 +708,10 @@ OPCODE_FUNC bmi(void)
 	CPU.P &= ~FL_T;
 	if (CPU.P & FL_N)
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+		SBYTE rel = imm_operand(CPU.PC + 1);
+		CPU.PC += rel + 2;
 		Cycles += 4;
+		idle_loop_skip(rel + 2);
 	}
 	else
 	{
@@ -667,8 +730,10 @@ OPCODE_FUNC bne(void)
 	}
 	else
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+		SBYTE rel = imm_operand(CPU.PC + 1);
+		CPU.PC += rel + 2;
 		Cycles += 4;
+		idle_loop_skip(rel + 2);
 	}
 }
 
@@ -682,16 +747,20 @@ OPCODE_FUNC bpl(void)
 	}
 	else
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+		SBYTE rel = imm_operand(CPU.PC + 1);
+		CPU.PC += rel + 2;
 		Cycles += 4;
+		idle_loop_skip(rel + 2);
 	}
 }
 
 OPCODE_FUNC bra(void)
 {
+	SBYTE rel = imm_operand(CPU.PC + 1);
 	CPU.P &= ~FL_T;
-	CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+	CPU.PC += rel + 2;
 	Cycles += 4;
+	idle_loop_skip(rel + 2);
 }
 
 OPCODE_FUNC brk(void)
@@ -723,8 +792,10 @@ OPCODE_FUNC bvc(void)
 	}
 	else
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+		SBYTE rel = imm_operand(CPU.PC + 1);
+		CPU.PC += rel + 2;
 		Cycles += 4;
+		idle_loop_skip(rel + 2);
 	}
 }
 
@@ -733,8 +804,10 @@ OPCODE_FUNC bvs(void)
 	CPU.P &= ~FL_T;
 	if (CPU.P & FL_V)
 	{
-		CPU.PC += (SBYTE)imm_operand(CPU.PC + 1) + 2;
+		SBYTE rel = imm_operand(CPU.PC + 1);
+		CPU.PC += rel + 2;
 		Cycles += 4;
+		idle_loop_skip(rel + 2);
 	}
 	else
 	{
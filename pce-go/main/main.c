@@ -24,7 +24,7 @@ static int current_height = 0;
 static int current_width = 0;
 static int overscan = false;
 static int downsample = false;
-static int skipFrames = 0;
+static bool drawFrame = true;
 static uint8_t *framebuffers[2];
 
 static bool emulationPaused = false; // This should probably be a mutex
@@ -79,33 +79,20 @@ uint8_t *osd_gfx_framebuffer(int width, int height)
         current_width = width;
         current_height = height;
     }
-    return skipFrames ? NULL : currentUpdate->buffer;
+    return drawFrame ? currentUpdate->buffer : NULL;
 }
 
 void osd_vsync(void)
 {
     static int64_t lasttime, prevtime;
 
-    if (skipFrames == 0)
+    if (drawFrame)
     {
         rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
         rg_display_queue_update(currentUpdate, NULL);
         currentUpdate = previousUpdate;
     }
 
-    // See if we need to skip a frame to keep up
-    if (skipFrames == 0)
-    {
-        if (app->speed > 1.f)
-            skipFrames = app->speed * 2.5f;
-        else
-            skipFrames = 1;
-    }
-    else if (skipFrames > 0)
-    {
-        skipFrames--;
-    }
-
     int32_t frameTime = 1000000 / 60 / app->speed;
     int64_t curtime = rg_system_timer();
     int32_t sleep = frameTime - (curtime - lasttime);
@@ -118,12 +105,10 @@ void osd_vsync(void)
     {
         usleep(sleep);
     }
-    else if (sleep < -(frameTime / 2))
-    {
-        skipFrames++;
-    }
 
+    // The scheduler sees how late we are through the busy time we report
     rg_system_tick(curtime - prevtime);
+    drawFrame = rg_system_schedule_frame();
 
     prevtime = rg_system_timer();
     lasttime += frameTime;
@@ -38,6 +38,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <setjmp.h>
 #ifdef _MSC_VER
 #define    F_OK    0    /* Check for file existence */
 #define    W_OK    2    /* Check for write permission */
@@ -130,6 +131,11 @@ boolean         singledemo;           // quit after playing a demo from cmdline
 wbstartstruct_t wminfo;               // parms for world map / intermission
 boolean         haswolflevels = false;// jff 4/18/98 wolf levels present
 static byte     *savebuffer;          // CPhipps - static
+static byte     *savebuffer_static;   // Reserved by G_SetSaveBuffer, heap is usually full by save time
+static size_t   savebuffer_static_size;
+static jmp_buf  savegame_abort;       // CheckSaveGame gives up here when the buffer can't grow
+static boolean  savegame_indexed;     // Thinker prev pointers hold indices, see P_ThinkerToIndex
+static char     savegamepath[PATH_MAX+1]; // Replaces the slot file name when set
 int             autorun = false;      // always running?          // phares
 int             totalleveltimes;      // CPhipps - total time for all completed levels
 int		longtics;
@@ -1445,6 +1451,7 @@ void G_LoadGame(int slot, boolean command)
     special_event = BT_SPECIAL | (BTS_LOADGAME & BT_SPECIALMASK) |
       ((slot << BTS_SAVESHIFT) & BTS_SAVEMASK);
     forced_loadgame = netgame; // CPhipps - always force load netgames
+    savegamepath[0] = 0;
   } else {
     // Do the old thing, immediate load
     gameaction = ga_loadgame;
@@ -1454,17 +1461,73 @@ void G_LoadGame(int slot, boolean command)
     // Don't stay in netgame state if loading single player save
     // while watching multiplayer demo
     netgame = false;
+    savegamepath[0] = 0;
   }
   command_loadgame = command;
   R_SmoothPlaying_Reset(NULL); // e6y
 }
 
+// Loads a save from an arbitrary path at the next tic, like G_LoadGame with a command
+boolean G_LoadGameFromFile(const char *name)
+{
+  if (access(name, R_OK) != 0 || strlen(name) >= sizeof(savegamepath))
+    return false;
+
+  strcpy(savegamepath, name);
+  gameaction = ga_loadgame;
+  forced_loadgame = false;
+  command_loadgame = false;
+  demoplayback = false;
+  netgame = false;
+  R_SmoothPlaying_Reset(NULL);
+  return true;
+}
+
+void G_SetSaveBuffer(void *buffer, size_t size)
+{
+  savebuffer_static = buffer;
+  savebuffer_static_size = buffer ? size : 0;
+}
+
+// Reads a savegame into the reserved buffer if it fits, otherwise on the zone heap
+static int G_ReadSaveBuffer(const char *name)
+{
+  FILE *fp = fopen(name, "rb");
+  long length = -1;
+
+  if (!fp)
+    return -1;
+
+  fseek(fp, 0, SEEK_END);
+  length = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  if (length > 0 && (size_t)length <= savebuffer_static_size)
+  {
+    savebuffer = savebuffer_static;
+    if (fread(savebuffer, length, 1, fp) != 1)
+      length = -1;
+    fclose(fp);
+    return length;
+  }
+
+  fclose(fp);
+  return M_ReadFile(name, &savebuffer);
+}
+
+static void G_FreeSaveBuffer(void)
+{
+  if (savebuffer && savebuffer != savebuffer_static)
+    Z_Free(savebuffer);
+  savebuffer = save_p = NULL;
+}
+
 // killough 5/15/98:
 // Consistency Error when attempting to load savegame.
 
 static void G_LoadGameErr(const char *msg)
 {
-  Z_Free(savebuffer);                // Free the savegame buffer
+  G_FreeSaveBuffer();                // Free the savegame buffer
   M_ForcedLoadGame(msg);             // Print message asking for 'Y' to force
   if (command_loadgame)              // If this was a command-line -loadgame
     {
@@ -1509,10 +1572,13 @@ void G_DoLoadGame(void)
   char name[PATH_MAX+1];     // killough 3/22/98
   int savegame_compatibility = -1;
 
-  G_SaveGameName(name,sizeof(name),savegameslot, demoplayback);
+  if (savegamepath[0])
+    strcpy(name, savegamepath);
+  else
+    G_SaveGameName(name,sizeof(name),savegameslot, demoplayback);
   gameaction = ga_nothing;
 
-  length = M_ReadFile(name, &savebuffer);
+  length = G_ReadSaveBuffer(name);
   if (length<=0)
     I_Error("Couldn't read file %s: %s", name, "(Unknown Error)");
   save_p = savebuffer + SAVESTRINGSIZE;
@@ -1610,7 +1676,8 @@ void G_DoLoadGame(void)
     I_Error ("G_DoLoadGame: Bad savegame");
 
   // done
-  Z_Free (savebuffer);
+  G_FreeSaveBuffer();
+  savegamepath[0] = 0;
 
   if (setsizeneeded)
     R_ExecuteSetViewSize ();
@@ -1674,8 +1741,27 @@ void (CheckSaveGame)(size_t size, const char* file, int line)
 
   size += 1024;  // breathing room
   if (pos+size > savegamesize)
-    save_p = (savebuffer = realloc(savebuffer,
-           savegamesize += (size+1023) & ~1023)) + pos;
+  {
+    byte *buffer;
+
+    savegamesize += (size+1023) & ~1023;
+    if (savebuffer == savebuffer_static)
+    {
+      if ((buffer = malloc(savegamesize))) // Outgrew the reserved buffer
+        memcpy(buffer, savebuffer, pos);
+    }
+    else
+      buffer = realloc(savebuffer, savegamesize);
+
+    if (!buffer)
+    {
+      lprintf(LO_WARN, "CheckSaveGame: Out of memory (%u bytes)\n", (unsigned)savegamesize);
+      longjmp(savegame_abort, 1);
+    }
+
+    savebuffer = buffer;
+    save_p = savebuffer + pos;
+  }
 }
 
 /* killough 3/22/98: form savegame name in one location
@@ -1688,23 +1774,34 @@ void G_SaveGameName(char *name, size_t size, int slot, boolean demoplayback)
   snprintf(name, size, "%s/sav%d-%d.dsg", basesavegame, gamemission, slot);
 }
 
-static void G_DoSaveGame (boolean menu)
+static boolean G_WriteSaveGame(const char *name, const char *description)
 {
-  lprintf(LO_INFO, "G_DoSaveGame... \n");
-
-  char name[PATH_MAX+1];
   char name2[VERSIONSIZE];
-  char *description;
+  boolean success;
   int  length, i;
 
-  gameaction = ga_nothing; // cph - cancel savegame at top of this function,
-    // in case later problems cause a premature exit
-
-  G_SaveGameName(name,sizeof(name),savegameslot, demoplayback && !menu);
-
-  description = savedescription;
+  if (savebuffer_static)
+  {
+    savegamesize = savebuffer_static_size;
+    save_p = savebuffer = savebuffer_static;
+  }
+  else
+  {
+    savegamesize = SAVEGAMESIZE;
+    save_p = savebuffer = malloc(savegamesize);
+  }
 
-  save_p = savebuffer = malloc(savegamesize);
+  // Out of memory, put the thinkers back and give up without touching the file
+  if (!savebuffer || setjmp(savegame_abort))
+  {
+    if (savegame_indexed)
+      P_IndexToThinker();
+    savegame_indexed = false;
+    if (savebuffer != savebuffer_static)
+      free(savebuffer);
+    savebuffer = save_p = NULL;
+    return false;
+  }
 
   CheckSaveGame(SAVESTRINGSIZE+VERSIONSIZE+sizeof(uint_64_t));
   memcpy (save_p, description, SAVESTRINGSIZE);
@@ -1787,6 +1884,7 @@ static void G_DoSaveGame (boolean menu)
   // This is so we can save the index of the mobj_t of the thinker that
   // caused a sound, referenced by sector_t->soundtarget.
   P_ThinkerToIndex();
+  savegame_indexed = true;
 
   P_ArchiveWorld();
   Z_CheckHeap();
@@ -1796,6 +1894,7 @@ static void G_DoSaveGame (boolean menu)
   // for symmetry with the P_ThinkerToIndex call above.
 
   P_IndexToThinker();
+  savegame_indexed = false;
 
   Z_CheckHeap();
   P_ArchiveSpecials();
@@ -1808,13 +1907,42 @@ static void G_DoSaveGame (boolean menu)
   length = save_p - savebuffer;
 
   Z_CheckHeap();
-  doom_printf( "%s", M_WriteFile(name, savebuffer, length)
-         ? s_GGSAVED /* Ty - externalised */
-         : "Game save failed!"); // CPhipps - not externalised
+  success = M_WriteFile(name, savebuffer, length);
 
-  free(savebuffer);  // killough
+  if (savebuffer != savebuffer_static)
+    free(savebuffer);  // killough
   savebuffer = save_p = NULL;
 
+  return success;
+}
+
+// Saves immediately to an arbitrary path, only valid between tics
+boolean G_SaveGameToFile(const char *name, const char *description)
+{
+  char desc[SAVESTRINGSIZE] = {0};
+
+  if (gamestate != GS_LEVEL || demoplayback || !usergame)
+    return false;
+
+  strncpy(desc, description, SAVESTRINGSIZE - 1);
+  return G_WriteSaveGame(name, desc);
+}
+
+static void G_DoSaveGame (boolean menu)
+{
+  lprintf(LO_INFO, "G_DoSaveGame... \n");
+
+  char name[PATH_MAX+1];
+
+  gameaction = ga_nothing; // cph - cancel savegame at top of this function,
+    // in case later problems cause a premature exit
+
+  G_SaveGameName(name,sizeof(name),savegameslot, demoplayback && !menu);
+
+  doom_printf( "%s", G_WriteSaveGame(name, savedescription)
+         ? s_GGSAVED /* Ty - externalised */
+         : "Game save failed!"); // CPhipps - not externalised
+
   savedescription[0] = 0;
 }
 
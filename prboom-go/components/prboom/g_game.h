@@ -53,6 +53,9 @@ void G_LoadGame(int slot, boolean is_command); // killough 5/15/98
 void G_ForcedLoadGame(void);           // killough 5/15/98: forced loadgames
 void G_DoLoadGame(void);
 void G_SaveGame(int slot, char *description); // Called by M_Responder.
+boolean G_SaveGameToFile(const char *name, const char *description);
+boolean G_LoadGameFromFile(const char *name);
+void G_SetSaveBuffer(void *buffer, size_t size);
 void G_BeginRecording(void);
 // CPhipps - const on these string params
 void G_RecordDemo(const char *name);          // Only called by startup code.
@@ -37,6 +37,12 @@
 #include "config.h"
 #endif
 
+#ifdef RG_TARGET_SDL2
+#include <sys/mman.h>
+#else
+#include <esp_partition.h>
+#endif
+
 #include "doomstat.h"
 #include "d_net.h"
 #include "doomtype.h"
@@ -112,6 +118,84 @@ char *AddDefaultExtension(char *path, const char *ext)
 //  with multiple lumps.
 // Other files are single lumps with the base filename
 //  for the lump name.
+//
+// W_MapFile
+// Maps the WAD read-only so that lumps can be used in place, without a copy
+// or a zone allocation. On device this only works if the same WAD was also
+// flashed to a data partition labelled after it (e.g. "doom1" for doom1.wad), which
+// `rg_tool.py --with-wad` adds to the image.
+// Returns false if the file must be read through stdio instead.
+//
+static boolean W_MapFile(wadfile_info_t *wadfile)
+{
+#ifdef RG_TARGET_SDL2
+  void *data = mmap(NULL, wadfile->size, PROT_READ, MAP_SHARED, fileno(wadfile->handle), 0);
+  if (data == MAP_FAILED)
+    return false;
+  wadfile->data = data;
+  return true;
+#else
+  const esp_partition_t *partition;
+  spi_flash_mmap_handle_t handle;
+  const void *data;
+  char label[9] = {0};
+  byte header[64];
+
+  ExtractFileBase(wadfile->name, label);
+  for (char *c = label; *c; c++)
+    *c = tolower(*c);
+
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (!partition || partition->size < wadfile->size)
+    return false;
+
+  // The flash MMU window is only a few MB, big IWADs will fail here
+  if (esp_partition_mmap(partition, 0, wadfile->size, SPI_FLASH_MMAP_DATA, &data, &handle) != ESP_OK)
+  {
+    lprintf(LO_WARN, "W_MapFile: partition %s is too large to map\n", label);
+    return false;
+  }
+
+  // Make sure the partition still holds the same WAD as the file. The header alone isn't
+  // enough (an older version of the WAD can have the same one), so the lump directory
+  // is compared too. It's usually at the end of the file, so this also catches most size changes.
+  W_Read(header, sizeof(header), 0, wadfile);
+  if (memcmp(header, data, sizeof(header)) == 0)
+  {
+    const wadinfo_t *info = (const wadinfo_t *)header;
+    size_t start = 0, end = wadfile->size, pos;
+    byte buffer[512];
+    boolean valid;
+
+    if (!strncmp(info->identification, "IWAD", 4) || !strncmp(info->identification, "PWAD", 4))
+    {
+      start = LONG(info->infotableofs);
+      end = start + LONG(info->numlumps) * sizeof(filelump_t);
+    }
+
+    valid = start <= end && end <= wadfile->size;
+
+    for (pos = start; valid && pos < end; pos += sizeof(buffer))
+    {
+      size_t len = MIN(sizeof(buffer), end - pos);
+      W_Read(buffer, len, pos, wadfile);
+      if (memcmp(buffer, (const byte *)data + pos, len) != 0)
+        valid = false;
+    }
+
+    if (valid)
+    {
+      wadfile->data = data;
+      return true;
+    }
+  }
+
+  lprintf(LO_WARN, "W_MapFile: partition %s doesn't match %s\n", label, wadfile->name);
+  spi_flash_munmap(handle);
+  return false;
+#endif
+}
+
 //
 // Reload hack removed by Lee Killough
 // CPhipps - source is an enum
@@ -135,6 +219,12 @@ static void W_AddFile(wadfile_info_t *wadfile)
     {
       fseek(wadfile->handle, 0, SEEK_END);
       wadfile->size = ftell(wadfile->handle);
+
+      if (W_MapFile(wadfile))
+      {
+        fclose(wadfile->handle);
+        wadfile->handle = NULL;
+      }
     }
   }
 
@@ -452,8 +542,9 @@ const void *W_CacheLumpNum(int lump)
 
   if (!l->ptr)
   {
-    // Bypass caching if we have the WAD mapped in memory
-    if (l->wadfile && l->wadfile->data)
+    // Bypass caching if we have the WAD mapped in memory. Unaligned lumps
+    // are still copied because the game reads shorts and ints from them.
+    if (l->wadfile && l->wadfile->data && !(l->position & 3))
       return l->wadfile->data + l->position;
     W_ReadLump(Z_Malloc(W_LumpLength(lump), PU_STATIC, &l->ptr), lump);
     l->locks = 0;
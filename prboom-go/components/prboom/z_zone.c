@@ -51,15 +51,32 @@
 
 #include "doomstat.h"
 #include "lprintf.h"
+#include "g_game.h"
 #include "z_zone.h"
 
 #define CHUNK_SIZE 4        // Minimum chunk size at which blocks are allocated
 #define ZONEID  0x931d4a11  // signature for block header
 
+// RG: Level blocks without an owner never outlive the level, so instead of going
+// through malloc they are carved out of an arena that is dropped all at once in
+// Z_FreeTags. Small ones (thinkers, mobjs) are recycled through size-class pools
+// because they come and go during play, and bigger ones freed early (Z_Realloc)
+// are reused first-fit by the next level allocations that fit.
+#define ARENA_CHUNK_SIZE 0x8000
+#define ARENA_ALIGN      (sizeof(void *) > CHUNK_SIZE ? sizeof(void *) : CHUNK_SIZE)
+#define POOL_CLASSES     5
+
+enum {
+  ZK_HEAP = 0,  // malloc'd, linked in blockbytag
+  ZK_ARENA,     // Bumped from the level arena, not linked
+  ZK_POOL,      // Recycled through pool_free, not linked
+};
+
 typedef struct memblock
 {
   uint32_t zoneid;
-  uint32_t tag: 10;
+  uint32_t tag: 8;
+  uint32_t kind:2;
   uint32_t size:22;
 
   struct memblock *next,*prev;
@@ -72,38 +89,65 @@ typedef struct memblock
 
 } memblock_t;
 
+typedef struct arenachunk
+{
+  struct arenachunk *next;
+  size_t size, used;
+} arenachunk_t;
+
 /* size of block header
  * cph - base on sizeof(memblock_t), which can be larger than CHUNK_SIZE on
  * 64bit architectures */
 static const size_t HEADER_SIZE = (sizeof(memblock_t)+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1);
+static const size_t ARENA_HEADER_SIZE = (sizeof(arenachunk_t)+ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
 
-static memblock_t *blockbytag[PU_MAX];
-
-#ifdef INSTRUMENTED
+// Sizes include the block header
+static const size_t pool_sizes[POOL_CLASSES] = {32, 64, 128, 256, 512};
 
-// statistics for evaluating performance
-static int active_memory = 0;
-static int purgable_memory = 0;
-
-static void Z_DrawStats(void)            // Print allocation statistics
+static memblock_t *blockbytag[PU_MAX];
+static memblock_t *pool_free[POOL_CLASSES];
+static arenachunk_t *arena;
+static memblock_t *arena_free;      // Freed ZK_ARENA blocks, until the level ends
+static size_t cache_budget; // Bytes of PU_CACHE to keep at most, 0 is no limit
+
+static struct {
+  size_t active, purgable;       // Heap bytes by purgability
+  size_t arena, arena_peak;      // Arena bytes reserved
+  size_t pooled;                 // Pool bytes in use
+  size_t peak;                   // Peak of all the above
+  unsigned allocs, frees;
+  unsigned evictions;
+  size_t evicted;
+} stats;
+
+#define IS_LEVEL_TAG(tag) ((tag) == PU_LEVEL || (tag) == PU_LEVSPEC)
+
+void Z_DrawStats(void)            // Print allocation statistics
 {
   if (gamestate != GS_LEVEL)
     return;
 
-    unsigned long total_memory = active_memory + purgable_memory;
-    double s = 100.0 / total_memory;
-
-    doom_printf("%-5i\t%6.01f%%\tstatic\n"
-            "%-5i\t%6.01f%%\tpurgable\n"
-            "%-5li\t\ttotal\n",
-            active_memory,
-            active_memory*s,
-            purgable_memory,
-            purgable_memory*s,
-            total_memory
-            );
+  doom_printf("%-7u static\n"
+              "%-7u cache (%u evicted in %u)\n"
+              "%-7u arena, %u pooled\n"
+              "%-7u peak, %u allocs\n",
+              (unsigned)stats.active,
+              (unsigned)stats.purgable, (unsigned)stats.evicted, stats.evictions,
+              (unsigned)stats.arena, (unsigned)stats.pooled,
+              (unsigned)stats.peak, stats.allocs);
 }
 
+static inline void Z_UpdatePeak(void)
+{
+  size_t total = stats.active + stats.purgable + stats.arena;
+  if (total > stats.peak)
+    stats.peak = total;
+  if (stats.arena > stats.arena_peak)
+    stats.arena_peak = stats.arena;
+}
+
+#ifdef INSTRUMENTED
+
 #ifdef HEAPDUMP
 
 #ifndef HEAPDUMP_DIR
@@ -158,9 +202,9 @@ void Z_DumpMemory(void)
       block=block->next;
     }
   }
-  fprintf(fp, "malloc %d, cache %d, free %d, total %d\n",
-    total_malloc, total_cache, total_free,
-    total_malloc + total_cache + total_free);
+  fprintf(fp, "malloc %d, cache %d, free %d, arena %d, total %d\n",
+    total_malloc, total_cache, total_free, stats.arena,
+    total_malloc + total_cache + total_free + stats.arena);
   fclose(fp);
 }
 #endif
@@ -177,12 +221,163 @@ void Z_Close(void)
 
 void Z_Init(void)
 {
-  // Nothing to do
+  memset(&stats, 0, sizeof(stats));
+}
+
+void Z_SetCacheBudget(size_t bytes)
+{
+  cache_budget = bytes;
+}
+
+static void Z_LinkBlock(memblock_t *block, int tag)
+{
+  if (!blockbytag[tag])
+  {
+    blockbytag[tag] = block;
+    block->next = block->prev = block;
+  }
+  else
+  {
+    blockbytag[tag]->prev->next = block;
+    block->prev = blockbytag[tag]->prev;
+    block->next = blockbytag[tag];
+    blockbytag[tag]->prev = block;
+  }
+}
+
+static void Z_UnlinkBlock(memblock_t *block)
+{
+  if (block == block->next)
+    blockbytag[block->tag] = NULL;
+  else
+    if (blockbytag[block->tag] == block)
+      blockbytag[block->tag] = block->next;
+  block->prev->next = block->next;
+  block->next->prev = block->prev;
+}
+
+// Frees the least recently used cache block. Blocks are appended to the PU_CACHE
+// list when they are unlocked and leave it when they are locked again, so the
+// head is always the oldest.
+static boolean Z_EvictCache(void)
+{
+  memblock_t *block = blockbytag[PU_CACHE];
+
+  if (!block)
+    return false;
+
+  stats.evictions++;
+  stats.evicted += block->size;
+#ifdef INSTRUMENTED
+  (Z_Free)((char *) block + HEADER_SIZE, __FILE__, __LINE__);
+#else
+  (Z_Free)((char *) block + HEADER_SIZE);
+#endif
+  return true;
+}
+
+// Makes room for incoming bytes of cache within the budget
+static void Z_TrimCache(size_t incoming)
+{
+  if (cache_budget)
+    while (stats.purgable + incoming > cache_budget && Z_EvictCache())
+      ;
+}
+
+static void *Z_SystemMalloc(size_t size)
+{
+  void *ptr;
+  while (!(ptr = (malloc)(size)))
+  {
+    // RG: Don't nuke the whole cache at once!
+    if (!Z_EvictCache())
+      return NULL;
+  }
+  return ptr;
+}
+
+static void *Z_ArenaAlloc(size_t size)
+{
+  size = (size+ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
+
+  if (!arena || arena->used + size > arena->size)
+  {
+    // Big blocks get a chunk of their own, slotted behind the current one so that
+    // its free space isn't wasted
+    size_t chunk_size = size > ARENA_CHUNK_SIZE / 2 ? size : ARENA_CHUNK_SIZE;
+    arenachunk_t *chunk = Z_SystemMalloc(ARENA_HEADER_SIZE + chunk_size);
+
+    if (!chunk)
+      return NULL;
+
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    stats.arena += ARENA_HEADER_SIZE + chunk_size;
+
+    if (arena && chunk_size != ARENA_CHUNK_SIZE)
+    {
+      chunk->next = arena->next;
+      arena->next = chunk;
+    }
+    else
+    {
+      chunk->next = arena;
+      arena = chunk;
+    }
+
+    if (chunk != arena)
+    {
+      chunk->used = size;
+      return (char *)chunk + ARENA_HEADER_SIZE;
+    }
+  }
+
+  void *ptr = (char *)arena + ARENA_HEADER_SIZE + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+static void Z_ArenaReset(void)
+{
+  while (arena)
+  {
+    arenachunk_t *next = arena->next;
+    (free)(arena);
+    arena = next;
+  }
+  memset(pool_free, 0, sizeof(pool_free));
+  arena_free = NULL;
+  stats.arena = 0;
+  stats.pooled = 0;
+}
+
+// Takes a freed arena block of at least size bytes, without wasting more than half of it
+static memblock_t *Z_ArenaReuse(size_t size)
+{
+  for (memblock_t **prev = &arena_free; *prev; prev = &(*prev)->next)
+  {
+    memblock_t *block = *prev;
+    if (block->size >= size && block->size <= size * 2)
+    {
+      *prev = block->next;
+      return block;
+    }
+  }
+  return NULL;
+}
+
+static int Z_PoolClass(size_t size)
+{
+  for (int i = 0; i < POOL_CLASSES; i++)
+    if (size <= pool_sizes[i])
+      return i;
+  return -1;
 }
 
 void *(Z_Malloc)(size_t size, int tag, void **user DA(const char *file, int line))
 {
   memblock_t *block = NULL;
+  int kind = ZK_HEAP;
 
 #ifdef INSTRUMENTED
 #ifdef CHECKHEAP
@@ -202,42 +397,60 @@ void *(Z_Malloc)(size_t size, int tag, void **user DA(const char *file, int line
 
   size = (size+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1);  // round to chunk size
 
-  while (!(block = (malloc)(size + HEADER_SIZE))) {
-    if (!blockbytag[PU_CACHE])
-      I_Error ("Z_Malloc: Failure trying to allocate %lu bytes"
-#ifdef INSTRUMENTED
-               "\nSource: %s:%d"
-#endif
-               ,(unsigned long) size
-#ifdef INSTRUMENTED
-               , file, line
-#endif
-      );
-    // RG: Don't nuke the whole cache at once!
-    (Z_FreeTags)(PU_CACHE, PU_CACHE, 2);
-  }
-
-  if (!blockbytag[tag])
+  if (IS_LEVEL_TAG(tag) && !user)
   {
-    blockbytag[tag] = block;
-    block->next = block->prev = block;
+    int class = Z_PoolClass(size + HEADER_SIZE);
+    if (class >= 0)
+    {
+      if ((block = pool_free[class]))
+        pool_free[class] = block->next;
+      else
+        block = Z_ArenaAlloc(pool_sizes[class]);
+      size = pool_sizes[class] - HEADER_SIZE;
+      stats.pooled += pool_sizes[class];
+      kind = ZK_POOL;
+    }
+    else
+    {
+      if ((block = Z_ArenaReuse(size)))
+        size = block->size;
+      else
+        block = Z_ArenaAlloc(size + HEADER_SIZE);
+      kind = ZK_ARENA;
+    }
   }
   else
   {
-    blockbytag[tag]->prev->next = block;
-    block->prev = blockbytag[tag]->prev;
-    block->next = blockbytag[tag];
-    blockbytag[tag]->prev = block;
+    if (tag == PU_CACHE)
+      Z_TrimCache(size + HEADER_SIZE);
+    block = Z_SystemMalloc(size + HEADER_SIZE);
   }
 
-  block->size = size;
-
+  if (!block)
+    I_Error ("Z_Malloc: Failure trying to allocate %lu bytes"
 #ifdef INSTRUMENTED
-  if (tag >= PU_PURGELEVEL)
-    purgable_memory += block->size;
-  else
-    active_memory += block->size;
+             "\nSource: %s:%d"
+#endif
+             ,(unsigned long) size
+#ifdef INSTRUMENTED
+             , file, line
 #endif
+    );
+
+  block->size = size;
+  block->kind = kind;
+
+  if (kind == ZK_HEAP)
+  {
+    Z_LinkBlock(block, tag);
+    if (tag >= PU_PURGELEVEL)
+      stats.purgable += block->size;
+    else
+      stats.active += block->size;
+  }
+
+  stats.allocs++;
+  Z_UpdatePeak();
 
 #ifdef INSTRUMENTED
   block->file = file;
@@ -286,25 +499,36 @@ void (Z_Free)(void *p DA(const char *file, int line))
   if (block->user)            // Nullify user if one exists
     *block->user = NULL;
 
-  if (block == block->next)
-    blockbytag[block->tag] = NULL;
-  else
-    if (blockbytag[block->tag] == block)
-      blockbytag[block->tag] = block->next;
-  block->prev->next = block->next;
-  block->next->prev = block->prev;
+  stats.frees++;
 
 #ifdef INSTRUMENTED
-  if (block->tag >= PU_PURGELEVEL)
-    purgable_memory -= block->size;
-  else
-    active_memory -= block->size;
-
   /* scramble memory -- weed out any bugs */
-  memset(block, gametic & 0xff, block->size + HEADER_SIZE);
+  memset((char *) block + HEADER_SIZE, gametic & 0xff, block->size);
 #endif
 
-  (free)(block);
+  if (block->kind == ZK_POOL)
+  {
+    int class = Z_PoolClass(block->size + HEADER_SIZE);
+    block->next = pool_free[class];
+    pool_free[class] = block;
+    stats.pooled -= pool_sizes[class];
+  }
+  else if (block->kind == ZK_HEAP)
+  {
+    Z_UnlinkBlock(block);
+
+    if (block->tag >= PU_PURGELEVEL)
+      stats.purgable -= block->size;
+    else
+      stats.active -= block->size;
+
+    (free)(block);
+  }
+  else // ZK_ARENA, its memory goes back to the system when the level ends
+  {
+    block->next = arena_free;
+    arena_free = block;
+  }
 
 #ifdef INSTRUMENTED
       Z_DrawStats();           // print memory allocation stats
@@ -320,6 +544,10 @@ void (Z_FreeTags)(int lowtag, int hightag, int max DA(const char *file, int line
   lowtag = MAX(lowtag, PU_FREE+1);
   hightag = MIN(hightag, PU_MAX-1);
 
+  // Arena and pool blocks have no owner to notify, so they are dropped in one go
+  if (max < 0 && lowtag <= PU_LEVEL && hightag >= PU_LEVSPEC)
+    Z_ArenaReset();
+
   for (;lowtag <= hightag; hightag--)
   {
     if (!blockbytag[hightag])
@@ -372,40 +600,31 @@ void (Z_ChangeTag)(void *ptr, int tag DA(const char *file, int line))
 #endif
             );
 
-  if (block == block->next)
-    blockbytag[block->tag] = NULL;
-  else
-    if (blockbytag[block->tag] == block)
-      blockbytag[block->tag] = block->next;
-  block->prev->next = block->next;
-  block->next->prev = block->prev;
-
-  if (!blockbytag[tag])
-  {
-    blockbytag[tag] = block;
-    block->next = block->prev = block;
-  }
-  else
+  if (block->kind != ZK_HEAP)
   {
-    blockbytag[tag]->prev->next = block;
-    block->prev = blockbytag[tag]->prev;
-    block->next = blockbytag[tag];
-    blockbytag[tag]->prev = block;
+    // The arena goes away with the level, its blocks can't be promoted
+    if (!IS_LEVEL_TAG(tag))
+      I_Error ("Z_ChangeTag: level block can't become tag %d", tag);
+    block->tag = tag;
+    return;
   }
 
-#ifdef INSTRUMENTED
+  Z_UnlinkBlock(block);
+
   if (block->tag < PU_PURGELEVEL && tag >= PU_PURGELEVEL)
   {
-    active_memory -= block->size;
-    purgable_memory += block->size;
+    Z_TrimCache(block->size);
+    stats.active -= block->size;
+    stats.purgable += block->size;
   }
   else
     if (block->tag >= PU_PURGELEVEL && tag < PU_PURGELEVEL)
     {
-      active_memory += block->size;
-      purgable_memory -= block->size;
+      stats.active += block->size;
+      stats.purgable -= block->size;
     }
-#endif
+
+  Z_LinkBlock(block, tag);
 
   block->tag = tag;
 }
@@ -78,6 +78,8 @@ enum {
 
 void (Z_Init)(void);
 void (Z_Close)(void);
+void (Z_DrawStats)(void);
+void (Z_SetCacheBudget)(size_t bytes);
 void (Z_CheckHeap)(DAC(const char *,int));   // killough 3/22/98: add file/line info
 void (Z_ChangeTag)(void *ptr, int tag DA(const char *, int));
 void (Z_FreeTags)(int lowtag, int hightag, int max DA(const char *, int));
@@ -41,6 +41,7 @@
 #include <midifile.h>
 #include <oplplayer.h>
 #include <rg_system.h>
+#include <esp_heap_caps.h>
 
 // 22050 reduces perf by almost 15% but 11025 sounds awful on the G32...
 #ifdef RG_TARGET_MRGC_G32
@@ -51,6 +52,7 @@
 
 #define AUDIO_BUFFER_LENGTH (AUDIO_SAMPLE_RATE / TICRATE + 1)
 #define NUM_MIX_CHANNELS 8
+#define SAVE_BUFFER_SIZE 0x20000
 
 static rg_video_update_t update;
 static rg_app_t *app;
@@ -70,14 +72,17 @@ typedef struct {
 
 typedef struct {
     const doom_sfx_t *sfx;
-    size_t pos;
-    float factor;
+    uint32_t pos;   // 16.16 position in sfx->samples
+    uint32_t step;  // 16.16 increment per output sample
+    int32_t left;   // Gains, 0-254
+    int32_t right;
     int starttic;
 } channel_t;
 
 static channel_t channels[NUM_MIX_CHANNELS];
 static const doom_sfx_t *sfx[NUMSFX];
 static rg_audio_sample_t mixbuffer[AUDIO_BUFFER_LENGTH];
+static int32_t mixaccum[AUDIO_BUFFER_LENGTH * 2];
 static const music_player_t *music_player = &opl_synth_player;
 static bool musicPlaying = false;
 
@@ -100,6 +105,9 @@ static const struct {int mask; int *key;} keymap[] = {
 };
 
 static const char *SETTING_GAMMA = "Gamma";
+static const char *SETTING_CACHE = "LumpCache";
+
+static const int cache_budgets[] = {0, 512, 1024, 2048, 4096}; // In KB, 0 is no limit
 
 
 static rg_gui_event_t gamma_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
@@ -127,6 +135,42 @@ static rg_gui_event_t gamma_update_cb(rg_gui_option_t *option, rg_gui_event_t ev
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t cache_budget_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    int budget = rg_settings_get_number(NS_APP, SETTING_CACHE, 0);
+    int count = RG_COUNT(cache_budgets);
+    int index = 0;
+
+    while (index < count - 1 && cache_budgets[index] != budget)
+        index++;
+
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        index = (index + (event == RG_DIALOG_PREV ? count - 1 : 1)) % count;
+        budget = cache_budgets[index];
+        rg_settings_set_number(NS_APP, SETTING_CACHE, budget);
+        Z_SetCacheBudget(budget * 1024);
+    }
+
+    if (budget)
+        sprintf(option->value, "%dKB", budget);
+    else
+        strcpy(option->value, "No limit");
+
+    return RG_DIALOG_VOID;
+}
+
+static rg_gui_event_t zone_stats_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    // Printed on the HUD, so close the menu to show it
+    if (event == RG_DIALOG_ENTER)
+    {
+        Z_DrawStats();
+        return RG_DIALOG_CLOSE;
+    }
+    return RG_DIALOG_VOID;
+}
+
 
 void I_StartFrame(void)
 {
@@ -205,8 +249,19 @@ const char *I_DoomExeDir(void)
     return RG_BASE_PATH_ROMS "/doom";
 }
 
+static inline void set_channel_params(channel_t *chan, int volume, int seperation)
+{
+    // Same curve as vanilla: seperation is 0 (left) to 255 (right), volume is 0-127
+    seperation = RG_MAX(0, RG_MIN(seperation, 254));
+    volume = RG_MAX(0, RG_MIN(volume, 127));
+    chan->left = ((254 - seperation) * volume) / 127;
+    chan->right = (seperation * volume) / 127;
+}
+
 void I_UpdateSoundParams(int handle, int volume, int seperation, int pitch)
 {
+    if (handle >= 0 && handle < NUM_MIX_CHANNELS)
+        set_channel_params(&channels[handle], volume, seperation);
 }
 
 int I_StartSound(int sfxid, int channel, int vol, int sep, int pitch, int priority)
@@ -244,10 +299,14 @@ int I_StartSound(int sfxid, int channel, int vol, int sep, int pitch, int priori
         }
     }
 
+    // The mixer skips channels without an sfx, so set it last
     channel_t *chan = &channels[slot];
-    chan->sfx = sfx[sfxid];
-    chan->factor = (float)chan->sfx->samplerate / AUDIO_SAMPLE_RATE;
+    chan->sfx = NULL;
+    chan->step = ((uint32_t)sfx[sfxid]->samplerate << 16) / AUDIO_SAMPLE_RATE;
     chan->pos = 0;
+    chan->starttic = gametic;
+    set_channel_params(chan, vol, sep);
+    chan->sfx = sfx[sfxid];
 
     return slot;
 }
@@ -272,67 +331,77 @@ bool I_AnySoundStillPlaying(void)
     return false;
 }
 
+// Mixes a whole buffer per channel instead of the other way around. Each sfx is
+// resampled with a 16.16 step into 32bit accumulators, which are then saturated
+// on top of the music block.
+static void mix_channel(channel_t *chan, int32_t *out, int count)
+{
+    const doom_sfx_t *sfx = chan->sfx;
+    const int32_t left = chan->left, right = chan->right;
+    const uint32_t step = chan->step;
+    const uint32_t end = (uint32_t)sfx->length << 16;
+    uint32_t pos = chan->pos;
+
+    if (pos >= end)
+    {
+        chan->sfx = NULL;
+        return;
+    }
+
+    // Number of output samples left in the sfx, so the inner loop needs no bounds check
+    uint32_t remaining = (end - pos + step - 1) / step;
+    if (remaining < count)
+        count = remaining;
+
+    for (int i = 0; i < count; i++)
+    {
+        int sample = sfx->samples[pos >> 16] - 128;
+        *out++ += sample * left;
+        *out++ += sample * right;
+        pos += step;
+    }
+
+    // Don't clobber a sound started by the game while we were mixing
+    if (chan->sfx == sfx)
+    {
+        chan->pos = pos;
+        if (pos >= end)
+            chan->sfx = NULL;
+    }
+}
+
 static void soundTask(void *arg)
 {
     while (1)
     {
         int16_t *audioBuffer = (int16_t *)mixbuffer;
-        int16_t *audioBufferEnd = audioBuffer + AUDIO_BUFFER_LENGTH * 2;
-        int16_t stream[2];
+        bool haveSfx = false;
 
-        while (audioBuffer < audioBufferEnd)
-        {
-            int totalSample = 0;
-            int totalSources = 0;
-            int sample;
+        if (musicPlaying && snd_MusicVolume > 0)
+            music_player->render(mixbuffer, AUDIO_BUFFER_LENGTH); // Volume is applied by the synth
+        else
+            memset(mixbuffer, 0, sizeof(mixbuffer));
 
-            if (snd_SfxVolume > 0)
+        if (snd_SfxVolume > 0)
+        {
+            for (int i = 0; i < NUM_MIX_CHANNELS; i++)
             {
-                for (int i = 0; i < NUM_MIX_CHANNELS; i++)
-                {
-                    channel_t *chan = &channels[i];
-                    if (!chan->sfx)
-                        continue;
-
-                    size_t pos = (size_t)(chan->pos++ * chan->factor);
-
-                    if (pos >= chan->sfx->length)
-                    {
-                        chan->sfx = NULL;
-                    }
-                    else if ((sample = chan->sfx->samples[pos]))
-                    {
-                        totalSample += sample - 127;
-                        totalSources++;
-                    }
-                }
-
-                totalSample <<= 7;
-                totalSample /= (16 - snd_SfxVolume);
+                if (!channels[i].sfx)
+                    continue;
+                if (!haveSfx)
+                    memset(mixaccum, 0, sizeof(mixaccum));
+                mix_channel(&channels[i], mixaccum, AUDIO_BUFFER_LENGTH);
+                haveSfx = true;
             }
+        }
 
-            if (musicPlaying && snd_MusicVolume > 0)
+        if (haveSfx)
+        {
+            for (int i = 0; i < AUDIO_BUFFER_LENGTH * 2; i++)
             {
-                music_player->render(&stream, 1); // It returns 2 (stereo) 16bits values per sample
-                sample = stream[0]; // [0] and [1] are the same value
-                if (sample > 0)
-                {
-                    totalSample += sample / (16 - snd_MusicVolume);
-                    if (totalSources == 0)
-                        totalSources = 1;
-                }
+                int sample = audioBuffer[i] + mixaccum[i];
+                audioBuffer[i] = RG_MAX(-32768, RG_MIN(sample, 32767));
             }
-
-            if (totalSources > 0)
-                totalSample /= totalSources;
-
-            if (totalSample > 32767)
-                totalSample = 32767;
-            else if (totalSample < -32768)
-                totalSample = -32768;
-
-            *audioBuffer++ = totalSample;
-            *audioBuffer++ = totalSample;
         }
 
         rg_audio_submit(mixbuffer, AUDIO_BUFFER_LENGTH);
@@ -417,6 +486,13 @@ void I_StartTic(void)
     uint32_t changed = prev_joystick ^ joystick;
     event_t event = {0};
 
+    // The first tic is the earliest point where the game can accept a load
+    if (app->bootFlags & RG_BOOT_RESUME)
+    {
+        app->bootFlags &= ~RG_BOOT_RESUME;
+        rg_emu_load_state(app->saveSlot);
+    }
+
     // Long press on menu will open retro-go's menu if needed, instead of DOOM's.
     // This is still needed to quit (DOOM 2) and for the debug menu. We'll unify that mess soon...
     if (joystick & (RG_KEY_MENU|RG_KEY_OPTION))
@@ -473,14 +549,14 @@ static bool screenshot_handler(const char *filename, int width, int height)
 
 static bool save_state_handler(const char *filename)
 {
-    rg_gui_alert("Not implemented", "Please use the in-game menu");
-    return false;
+    // This is called from I_StartTic so the world is in a consistent state
+    return G_SaveGameToFile(filename, "Quick Save");
 }
 
 static bool load_state_handler(const char *filename)
 {
-    rg_gui_alert("Not implemented", "Please use the in-game menu");
-    return false;
+    // The load itself is deferred to the next G_Ticker
+    return G_LoadGameFromFile(filename);
 }
 
 static bool reset_handler(bool hard)
@@ -519,6 +595,8 @@ void app_main()
     };
     const rg_gui_option_t options[] = {
         {0, "Gamma Boost", "0/5", 1, &gamma_update_cb},
+        {0, "Lump cache", "-", 1, &cache_budget_cb},
+        {0, "Zone stats", NULL, 1, &zone_stats_cb},
         RG_DIALOG_CHOICE_LAST
     };
 
@@ -527,6 +605,10 @@ void app_main()
 
     update.buffer = rg_alloc(SCREENHEIGHT*SCREENWIDTH, MEM_FAST);
 
+    // Reserve the save buffer now, by the time the user saves the heap is full of lumps.
+    // It's only a head start, without PSRAM saving falls back to malloc (and may fail cleanly).
+    G_SetSaveBuffer(heap_caps_malloc(SAVE_BUFFER_SIZE, MALLOC_CAP_SPIRAM), SAVE_BUFFER_SIZE);
+
     const char *save = RG_BASE_PATH_SAVES "/doom";
     const char *iwad = NULL;
     const char *pwad = NULL;
@@ -558,5 +640,6 @@ void app_main()
     rg_display_clear(C_BLACK);
 
     Z_Init();
+    Z_SetCacheBudget(rg_settings_get_number(NS_APP, SETTING_CACHE, 0) * 1024);
     D_DoomMain();
 }
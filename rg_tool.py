@@ -97,10 +97,17 @@ def find_symbol(elf_file, addr):
 symbols_cache = dict()
 
 
-def analyze_profile(frames):
+def analyze_profile(frames, sections=[]):
     flatten = True # False is currently not working correctly
     tree = dict()
 
+    # Sections are named by the app, they don't need symbol lookups
+    if sections:
+        debug_print("%-20s %-47s %-10s %s" % ("Thread", "Section", "Calls", "Time"))
+        for thread, name, num_calls, run_time in sorted(sections, key=lambda x: x[3], reverse=True):
+            debug_print("%-20s %-47s %-10d %dms" % (thread, name, num_calls, run_time / 1000))
+        debug_print("")
+
     for caller, callee, num_calls, run_time in frames:
         branch = '*' if flatten else caller.name + "@" + os.path.basename(caller.source)
         if branch not in tree:
@@ -146,7 +153,12 @@ def build_firmware(apps, device_type):
     subprocess.run(args, check=True)
 
 
-def build_image(apps, device_type):
+def wad_partition_name(wad_file):
+    # Must match what prboom's W_MapFile looks for: the lowercase base name, at most 8 characters
+    return os.path.splitext(os.path.basename(wad_file))[0][:8].lower()
+
+
+def build_image(apps, device_type, wad_files=[]):
     print("Building image with: %s\n" % " ".join(apps))
     image_file = ("%s_%s_%s.img" % (PROJECT_NAME, PROJECT_VER, device_type)).lower()
     image_data = bytearray(b"\xFF" * 0x10000)
@@ -166,6 +178,14 @@ def build_image(apps, device_type):
         table_ota += 1
         image_data += data + b"\xFF" * (part_size - len(data))
 
+    # WADs flashed to their own data partition can be mapped by prboom-go instead of read from the SD card
+    for wad_file in wad_files:
+        with open(wad_file, "rb") as f:
+            data = f.read()
+        part_size = math.ceil(len(data) / 0x10000) * 0x10000
+        table_csv.append("%s, data, 0x40, %d, %d" % (wad_partition_name(wad_file), len(image_data), part_size))
+        image_data += data + b"\xFF" * (part_size - len(data))
+
     try:
         cwd = os.path.join(os.getcwd(), list(apps)[0])
         subprocess.run("idf.py bootloader", stdout=subprocess.DEVNULL, shell=True, check=True, cwd=cwd)
@@ -240,6 +260,7 @@ def monitor_app(app, port, baudrate=115200):
     # To do: detect ctrl+r ctrl+c etc
 
     profile_frames = list()
+    profile_sections = list()
 
     line_bytes = b''
     while 1:
@@ -269,8 +290,13 @@ def monitor_app(app, port, baudrate=115200):
                 if rg_debug_ns == "PROF":
                     if rg_debug_cmd == "BEGIN":
                         profile_frames.clear()
+                        profile_sections.clear()
                     if rg_debug_cmd == "END":
-                        analyze_profile(profile_frames)
+                        analyze_profile(profile_frames, profile_sections)
+                    if rg_debug_cmd == "SECTION":
+                        m = re.match(r"([^\t]*)\t([^\t]+)\t(\d+)\t(\d+)", rg_debug_arg)
+                        if m:
+                            profile_sections.append([m.group(1), m.group(2), int(m.group(3)), int(m.group(4))])
                     if rg_debug_cmd == "DATA":
                         m = re.match(r"([x0-9a-f]+)\s([x0-9a-f]+)\s(\d+)\s(\d+)", rg_debug_arg)
                         if m:
@@ -305,6 +331,9 @@ parser.add_argument(
 parser.add_argument(
     "--with-netplay", action="store_const", const=True, help="Build with netplay enabled"
 )
+parser.add_argument(
+    "--with-wad", action="append", default=[], help="Add a WAD data partition for prboom-go (build-img, flash)"
+)
 parser.add_argument(
     "--port", default=DEFAULT_PORT, help="Serial port to use for flash and monitor"
 )
@@ -338,7 +367,7 @@ if command in ["build-fw", "release"]:
 
 if command in ["build-img", "release"]:
     print("=== Step: Packing ===\n")
-    build_image(apps, args.target)
+    build_image(apps, args.target, args.with_wad)
 
 if command in ["flash", "run", "profile"]:
     print("=== Step: Flashing ===\n")
@@ -352,6 +381,9 @@ if command in ["flash", "run", "profile"]:
         for app in apps:
             print("Flashing app '%s'" % app)
             pt.write_partition(parttool.PartitionName(app), os.path.join(app, "build", app + ".bin"))
+        for wad_file in args.with_wad:
+            print("Flashing WAD '%s'" % wad_file)
+            pt.write_partition(parttool.PartitionName(wad_partition_name(wad_file)), wad_file)
     except Exception as e:
         print("Error: {}".format(e))
         if "does not exist" in str(e):
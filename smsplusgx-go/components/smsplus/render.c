@@ -40,6 +40,16 @@ void (*render_obj)(int line) = NULL;
 /* Pointer to output buffer */
 uint8 *linebuf;
 
+/* Decoded pattern cache, 64 bytes per tile and flip variant (NULL when disabled) */
+static uint8 *bg_pattern_cache;
+static uint32 bg_cache_size;
+static uint16 bg_cache_flip_mask;
+
+/* Patterns modified since the cache was last updated */
+uint8 bg_name_dirty[0x200];
+uint16 bg_name_list[0x200];
+uint16 bg_list_index;
+
 /* Pixel 8-bit color tables */
 static uint8 sms_cram_expand_table[4];
 static uint8 gg_cram_expand_table[16];
@@ -200,6 +210,9 @@ static inline void write_dword(void *address, uint32 data)
 
 void render_shutdown(void)
 {
+  free(bg_pattern_cache);
+  bg_pattern_cache = NULL;
+  bg_cache_size = 0;
 }
 
 /* Initialize the rendering data */
@@ -302,6 +315,25 @@ void render_init(void)
   }
   bp_lut = _bp_lut;
 
+  /* Allocate the decoded pattern cache within the configured budget */
+  uint32 cache_size = 0;
+  if (option.tile_cache >= TILE_CACHE_FULL)
+    cache_size = TILE_CACHE_FULL;
+  else if (option.tile_cache >= TILE_CACHE_PLAIN)
+    cache_size = TILE_CACHE_PLAIN;
+
+  if (cache_size != bg_cache_size)
+  {
+    render_shutdown();
+    if (cache_size && (bg_pattern_cache = malloc(cache_size)))
+      bg_cache_size = cache_size;
+    else if (cache_size)
+      MESSAGE_WARN("Failed to allocate %d bytes for the tile cache\n", (int)cache_size);
+  }
+  /* Flipped tiles are decoded on the fly when only plain ones fit */
+  bg_cache_flip_mask = (bg_cache_size == TILE_CACHE_FULL) ? 0 : 0x600;
+  render_invalidate_cache();
+
   sms_cram_expand_table[0] =  0;
   sms_cram_expand_table[1] = (5 << 3)  + (1 << 2);
   sms_cram_expand_table[2] = (15 << 3) + (1 << 2);
@@ -328,6 +360,9 @@ void render_reset(void)
     palette_sync(i);
   }
 
+  /* VRAM was cleared */
+  render_invalidate_cache();
+
   /* Pick default render routine */
   if (vdp.reg[0] & 4)
   {
@@ -362,6 +397,60 @@ void render_reset(void)
   }
 }
 
+/* Mark every pattern dirty, eg after VRAM was replaced wholesale */
+void render_invalidate_cache(void)
+{
+  int i;
+
+  for(i = 0; i < 0x200; i++)
+  {
+    bg_name_list[i] = i;
+    bg_name_dirty[i] = 0xFF;
+  }
+  bg_list_index = 0x200;
+}
+
+/* Decode the dirty pattern rows into the cache */
+static void update_bg_pattern_cache(void)
+{
+  int i, x, y;
+
+  for(i = 0; i < bg_list_index; i++)
+  {
+    int name = bg_name_list[i];
+    int dirty = bg_name_dirty[name];
+
+    bg_name_dirty[name] = 0;
+
+    if (!bg_pattern_cache)
+      continue;
+
+    uint8 *dst = &bg_pattern_cache[name << 6];
+
+    for(y = 0; y < 8; y++)
+    {
+      if(!(dirty & (1 << y)))
+        continue;
+
+      const uint16 *ptr = (uint16 *)&vdp.vram[(name << 5) | (y << 2)];
+      const uint32 temp = (bp_lut[*ptr] >> 2) | (bp_lut[*(ptr+1)]);
+
+      for(x = 0; x < 8; x++)
+      {
+        uint8 c = (temp >> (x << 2)) & 0x0F;
+        dst[0x00000 | (y << 3) | (x)] = c;
+        if (bg_cache_flip_mask == 0)
+        {
+          dst[0x08000 | (y << 3) | (x ^ 7)] = c;
+          dst[0x10000 | ((y ^ 7) << 3) | (x)] = c;
+          dst[0x18000 | ((y ^ 7) << 3) | (x ^ 7)] = c;
+        }
+      }
+    }
+  }
+  bg_list_index = 0;
+}
+
 static int prev_line = -1;
 static int skip_render = 0;
 
@@ -391,6 +480,10 @@ IRAM_ATTR void render_line(int line)
   /* Point to current line in output buffer */
   linebuf = &internal_buffer[0];
 
+  /* Bring the pattern cache up to date with VRAM */
+  if (bg_list_index)
+    update_bg_pattern_cache();
+
   /* Sprite limit flag is set at the beginning of the line */
   if (vdp.spr_ovr)
   {
@@ -497,6 +590,9 @@ __attribute__((optimize("unroll-loops")))
 static inline void* tile_get(int attr, int line)
 {
     // ---p cvhn nnnn nnnn
+    if (bg_pattern_cache && !(attr & bg_cache_flip_mask))
+        return &bg_pattern_cache[((attr & 0x7FF) << 6) | (line << 3)];
+
     const uint16 name = attr & 0x1ff;
     const uint16 y = (attr & 0x400) ? (line ^ 7) : line;
     const uint16* ptr = (uint16*)&vdp.vram[(name << 5) | (y << 2) | (0)];
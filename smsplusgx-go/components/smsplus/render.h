@@ -33,14 +33,31 @@
 /* Used for blanking a line in whole or in part */
 #define BACKDROP_COLOR      (0x10 | (vdp.reg[7] & 0x0F))
 
+/* Decoded pattern cache sizes: all four flip variants, or unflipped tiles only */
+#define TILE_CACHE_FULL     (0x20000)
+#define TILE_CACHE_PLAIN    (0x08000)
+
+/* Mark a pattern row dirty after a VRAM write */
+#define MARK_BG_DIRTY(addr)                                   \
+{                                                             \
+  int name = (addr >> 5) & 0x1FF;                             \
+  if(bg_name_dirty[name] == 0)                                \
+    bg_name_list[bg_list_index++] = name;                     \
+  bg_name_dirty[name] |= (1 << ((addr >> 2) & 7));            \
+}
+
 extern void (*render_bg)(int line);
 extern void (*render_obj)(int line);
 extern const uint8 *vc_table[3];
 extern uint8 *linebuf;
+extern uint8 bg_name_dirty[0x200];
+extern uint16 bg_name_list[0x200];
+extern uint16 bg_list_index;
 
 extern void render_shutdown(void);
 extern void render_init(void);
 extern void render_reset(void);
+extern void render_invalidate_cache(void);
 extern void render_mode(int skip);
 extern void render_line(int line);
 extern void render_bg_sms(int line);
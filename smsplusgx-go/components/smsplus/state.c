@@ -93,6 +93,7 @@ void system_load_state(void *mem)
 
   /*** Set vdp state ***/
   fread(&vdp, sizeof(vdp), 1, mem);
+  render_invalidate_cache();
 
   /** restore video & audio settings (needed if timing changed) ***/
   vdp_init();
@@ -113,6 +113,7 @@ typedef struct
   uint8 use_bios;
   uint8 spritelimit;
   uint8 extra_gg;
+  uint32 tile_cache;  /* Decoded pattern cache budget in bytes (0 = off) */
 } option_t;
 
 /* Global variables */
@@ -297,7 +297,12 @@ void vdp_write(int offset, uint8 data)
       case 0: /* VRAM write */
       case 1: /* VRAM write */
       case 2: /* VRAM write */
-        vdp.vram[(vdp.addr & 0x3FFF)] = data;
+        index = (vdp.addr & 0x3FFF);
+        if (data != vdp.vram[index])
+        {
+          vdp.vram[index] = data;
+          MARK_BG_DIRTY(index);
+        }
         vdp.buffer = data;
         break;
 
@@ -369,6 +374,8 @@ uint8 vdp_read(int offset)
 
 void gg_vdp_write(int offset, uint8 data)
 {
+  int index;
+
   if (((z80_get_elapsed_cycles() + 1) / CYCLES_PER_LINE) > vdp.line)
   {
     /* render next line now BEFORE updating register */
@@ -408,7 +415,12 @@ void gg_vdp_write(int offset, uint8 data)
       case 0: /* VRAM write */
       case 1: /* VRAM write */
       case 2: /* VRAM write */
-        vdp.vram[(vdp.addr & 0x3FFF)] = data;
+        index = (vdp.addr & 0x3FFF);
+        if (data != vdp.vram[index])
+        {
+          vdp.vram[index] = data;
+          MARK_BG_DIRTY(index);
+        }
         vdp.buffer = data;
         break;
 
@@ -437,6 +449,8 @@ void gg_vdp_write(int offset, uint8 data)
 
 void tms_write(int offset, int data)
 {
+  int index;
+
   if (offset & 1) /* Control port */
   {
     if(vdp.pending == 0)
@@ -471,7 +485,12 @@ void tms_write(int offset, int data)
       case 1: /* VRAM write */
       case 2: /* VRAM write */
       case 3: /* VRAM write */
-        vdp.vram[(vdp.addr & 0x3FFF)] = data;
+        index = (vdp.addr & 0x3FFF);
+        if (data != vdp.vram[index])
+        {
+          vdp.vram[index] = data;
+          MARK_BG_DIRTY(index);
+        }
         break;
     }
     vdp.addr = (vdp.addr + 1) & 0x3FFF;
@@ -28,7 +28,7 @@ static void event_handler(int event, void *arg)
 
    switch (event)
    {
-      case NETPLAY_EVENT_STATUS_CHANGED:
+      case RG_EVENT_TYPE_NETPLAY | NETPLAY_EVENT_STATUS_CHANGED:
          new_netplay = (rg_netplay_status() == NETPLAY_STATUS_CONNECTED);
 
          if (netplay && !new_netplay)
@@ -90,17 +90,121 @@ static bool load_state_handler(const char *filename)
     return false;
 }
 
+static bool save_stream_handler(FILE *fp)
+{
+    system_save_state(fp);
+    return !ferror(fp);
+}
+
+static bool load_stream_handler(FILE *fp)
+{
+    system_load_state(fp);
+    return !ferror(fp);
+}
+
 static bool reset_handler(bool hard)
 {
     system_reset();
     return true;
 }
 
+static void update_pad(int player, uint32_t joystick)
+{
+    if (joystick & RG_KEY_UP)    input.pad[player] |= INPUT_UP;
+    if (joystick & RG_KEY_DOWN)  input.pad[player] |= INPUT_DOWN;
+    if (joystick & RG_KEY_LEFT)  input.pad[player] |= INPUT_LEFT;
+    if (joystick & RG_KEY_RIGHT) input.pad[player] |= INPUT_RIGHT;
+    if (joystick & RG_KEY_A)     input.pad[player] |= INPUT_BUTTON2;
+    if (joystick & RG_KEY_B)     input.pad[player] |= INPUT_BUTTON1;
+
+    if (IS_SMS)
+    {
+        if (joystick & RG_KEY_START)  input.system |= INPUT_PAUSE;
+        if (joystick & RG_KEY_SELECT) input.system |= INPUT_START;
+    }
+    else if (IS_GG)
+    {
+        if (joystick & RG_KEY_START)  input.system |= INPUT_START;
+        if (joystick & RG_KEY_SELECT) input.system |= INPUT_PAUSE;
+    }
+}
+
+static void update_keypad(uint32_t joystick)
+{
+    coleco.keypad[0] = 0xff;
+    coleco.keypad[1] = 0xff;
+
+    // 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, *, #
+    switch (cart.crc)
+    {
+        case 0x798002a2:    // Frogger
+        case 0x32b95be0:    // Frogger
+        case 0x9cc3fabc:    // Alcazar
+        case 0x964db3bc:    // Fraction Fever
+            if (joystick & RG_KEY_START)
+            {
+                coleco.keypad[0] = 10; // *
+            }
+            break;
+
+        case 0x1796de5e:    // Boulder Dash
+        case 0x5933ac18:    // Boulder Dash
+        case 0x6e5c4b11:    // Boulder Dash
+            if (joystick & RG_KEY_START)
+            {
+                coleco.keypad[0] = 11; // #
+            }
+
+            if ((joystick & RG_KEY_START) && (joystick & RG_KEY_LEFT))
+            {
+                coleco.keypad[0] = 1;
+            }
+            break;
+        case 0x109699e2:    // Dr. Seuss's Fix-Up The Mix-Up Puzzler
+        case 0x614bb621:    // Decathlon
+            if (joystick & RG_KEY_START)
+            {
+                coleco.keypad[0] = 1;
+            }
+            if ((joystick & RG_KEY_START) && (joystick & RG_KEY_LEFT))
+            {
+                coleco.keypad[0] = 10; // *
+            }
+            break;
+
+        default:
+            if (joystick & RG_KEY_START)
+            {
+                coleco.keypad[0] = 1;
+            }
+            break;
+    }
+}
+
+#ifdef RG_ENABLE_NETPLAY
+// Re-emulates a past frame after a misprediction, nothing must be drawn or played
+static void netplay_replay_handler(void *local_data, void *remote_data)
+{
+    memcpy(localJoystick, local_data, sizeof(*localJoystick));
+    memcpy(remoteJoystick, remote_data, sizeof(*remoteJoystick));
+    input.pad[0] = 0x00;
+    input.pad[1] = 0x00;
+    input.system = 0x00;
+    update_pad(0, joystick1);
+    update_pad(1, joystick2);
+    if (!IS_SMS && !IS_GG)
+        update_keypad(joystick1);
+    system_frame(1);
+}
+#endif
+
 void app_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateStream = &load_stream_handler,
+        .saveStateStream = &save_stream_handler,
         .event = &event_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
@@ -108,6 +212,10 @@ void app_main(void)
 
     app = rg_system_init(AUDIO_SAMPLE_RATE, &handlers, NULL);
 
+#ifdef RG_ENABLE_NETPLAY
+    rg_netplay_set_replay_handler(&netplay_replay_handler);
+#endif
+
     updates[0].buffer = rg_alloc(SMS_WIDTH * SMS_HEIGHT, MEM_FAST);
     updates[1].buffer = rg_alloc(SMS_WIDTH * SMS_HEIGHT, MEM_FAST);
 
@@ -141,7 +249,6 @@ void app_main(void)
         rg_emu_load_state(app->saveSlot);
     }
 
-    int skipFrames = 0;
     int copyPalette = 0;
 
     while (true)
@@ -158,8 +265,7 @@ void app_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
-        bool fullFrame = true;
+        bool drawFrame = rg_system_schedule_frame();
 
         input.pad[0] = 0x00;
         input.pad[1] = 0x00;
@@ -168,104 +274,25 @@ void app_main(void)
         #ifdef RG_ENABLE_NETPLAY
         if (netplay)
         {
+            // In rollback mode this may re-emulate a few frames before returning
             rg_netplay_sync(localJoystick, remoteJoystick, sizeof(*localJoystick));
-
-            uint32_t joystick = *remoteJoystick;
-
-            if (joystick & RG_KEY_UP)    input.pad[1] |= INPUT_UP;
-            if (joystick & RG_KEY_DOWN)  input.pad[1] |= INPUT_DOWN;
-            if (joystick & RG_KEY_LEFT)  input.pad[1] |= INPUT_LEFT;
-            if (joystick & RG_KEY_RIGHT) input.pad[1] |= INPUT_RIGHT;
-            if (joystick & RG_KEY_A)     input.pad[1] |= INPUT_BUTTON2;
-            if (joystick & RG_KEY_B)     input.pad[1] |= INPUT_BUTTON1;
-            if (IS_SMS)
-            {
-                if (joystick & RG_KEY_START)  input.system |= INPUT_PAUSE;
-                if (joystick & RG_KEY_SELECT) input.system |= INPUT_START;
-            }
-            else if (IS_GG)
-            {
-                if (joystick & RG_KEY_START)  input.system |= INPUT_START;
-                if (joystick & RG_KEY_SELECT) input.system |= INPUT_PAUSE;
-            }
+            update_pad(1, joystick2);
         }
         #endif
 
-        uint32_t joystick = *localJoystick;
+        uint32_t joystick = joystick1;
 
-        if (joystick & RG_KEY_UP)    input.pad[0] |= INPUT_UP;
-        if (joystick & RG_KEY_DOWN)  input.pad[0] |= INPUT_DOWN;
-        if (joystick & RG_KEY_LEFT)  input.pad[0] |= INPUT_LEFT;
-        if (joystick & RG_KEY_RIGHT) input.pad[0] |= INPUT_RIGHT;
-        if (joystick & RG_KEY_A)     input.pad[0] |= INPUT_BUTTON2;
-        if (joystick & RG_KEY_B)     input.pad[0] |= INPUT_BUTTON1;
+        update_pad(0, joystick);
 
-        if (IS_SMS)
-        {
-            if (joystick & RG_KEY_START)  input.system |= INPUT_PAUSE;
-            if (joystick & RG_KEY_SELECT) input.system |= INPUT_START;
-        }
-        else if (IS_GG)
-        {
-            if (joystick & RG_KEY_START)  input.system |= INPUT_START;
-            if (joystick & RG_KEY_SELECT) input.system |= INPUT_PAUSE;
-        }
-        else // Coleco
+        if (!IS_SMS && !IS_GG) // Coleco
         {
-            coleco.keypad[0] = 0xff;
-            coleco.keypad[1] = 0xff;
-
             if (joystick & RG_KEY_SELECT)
             {
                 rg_input_wait_for_key(RG_KEY_SELECT, false);
                 system_reset();
             }
 
-            // 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, *, #
-            switch (cart.crc)
-            {
-                case 0x798002a2:    // Frogger
-                case 0x32b95be0:    // Frogger
-                case 0x9cc3fabc:    // Alcazar
-                case 0x964db3bc:    // Fraction Fever
-                    if (joystick & RG_KEY_START)
-                    {
-                        coleco.keypad[0] = 10; // *
-                    }
-                    break;
-
-                case 0x1796de5e:    // Boulder Dash
-                case 0x5933ac18:    // Boulder Dash
-                case 0x6e5c4b11:    // Boulder Dash
-                    if (joystick & RG_KEY_START)
-                    {
-                        coleco.keypad[0] = 11; // #
-                    }
-
-                    if ((joystick & RG_KEY_START) && (joystick & RG_KEY_LEFT))
-                    {
-                        coleco.keypad[0] = 1;
-                    }
-                    break;
-                case 0x109699e2:    // Dr. Seuss's Fix-Up The Mix-Up Puzzler
-                case 0x614bb621:    // Decathlon
-                    if (joystick & RG_KEY_START)
-                    {
-                        coleco.keypad[0] = 1;
-                    }
-                    if ((joystick & RG_KEY_START) && (joystick & RG_KEY_LEFT))
-                    {
-                        coleco.keypad[0] = 10; // *
-                    }
-                    break;
-
-                default:
-                    if (joystick & RG_KEY_START)
-                    {
-                        coleco.keypad[0] = 1;
-                    }
-                    break;
-            }
+            update_keypad(joystick);
         }
 
         system_frame(!drawFrame);
@@ -283,29 +310,13 @@ void app_main(void)
                 memcpy(currentUpdate->palette, previousUpdate->palette, 512);
                 copyPalette = false;
             }
-            fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
+            rg_display_queue_update(currentUpdate, previousUpdate);
             currentUpdate = &updates[currentUpdate == &updates[0]]; // Swap
             bitmap.data = currentUpdate->buffer - bitmap.viewport.x;
         }
 
         int elapsed = rg_system_timer() - startTime;
 
-        // See if we need to skip a frame to keep up
-        if (skipFrames == 0)
-        {
-            int frameTime = 1000000 / (app->refreshRate * app->speed);
-            if (elapsed > frameTime - 2000) // It takes about 2ms to copy the audio buffer
-                skipFrames = (elapsed + frameTime / 2) / frameTime;
-            else if (drawFrame && fullFrame) // This could be avoided when scaling != full
-                skipFrames = 1;
-            if (app->speed > 1.f) // This is a hack until we account for audio speed...
-                skipFrames += (int)app->speed;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
-
         // Tick before submitting audio/syncing
         rg_system_tick(elapsed);
 
@@ -12,6 +12,7 @@
 namespace SNES
 {
 	#include "smp.hpp"
+	#include "sdsp.hpp"
 } // namespace SNES
 
 static const int APU_NUMERATOR_NTSC = 15664;
@@ -42,24 +43,35 @@ namespace spc
 
 extern "C" {
 
+// Counts are in 16bit values, two per stereo frame. Mixing may happen on another
+// thread than the SMP as long as it isn't reset or restored at the same time.
 bool8 S9xMixSamples(uint8 *dest, int sample_count)
 {
-	return true;
+	if (Settings.Mute)
+	{
+		memset(dest, 0, sample_count * 2);
+		return (TRUE);
+	}
+
+	SNES::dsp.mix((int16 *)dest, sample_count / 2);
+
+	return (TRUE);
 }
 
 int S9xGetSampleCount(void)
 {
-	return -1;
+	return SNES::dsp.available() * 2;
 }
 
 void S9xClearSamples(void)
 {
-
+	SNES::dsp.flush();
 }
 
 void S9xLandSamples(void)
 {
-
+	if (spc::callback)
+		spc::callback(spc::callback_data);
 }
 
 bool8 S9xSoundSync(void)
@@ -76,6 +88,7 @@ void S9xSetSamplesAvailableCallback(apu_callback callback, void *data)
 {
 	spc::callback = callback;
 	spc::callback_data = data;
+	SNES::dsp.set_callback(callback, data);
 }
 
 static void UpdatePlaybackRate(void)
@@ -96,6 +109,8 @@ bool8 S9xSoundInit(int buffer_ms)
 	if (!S9xInitAPU())
 		return FALSE;
 
+	spc::sound_enabled = TRUE;
+
 	UpdatePlaybackRate();
 
 	return TRUE;
@@ -103,12 +118,18 @@ bool8 S9xSoundInit(int buffer_ms)
 
 void S9xSetSoundControl(uint8 voice_switch)
 {
-
+	SNES::dsp.set_mute_mask(~voice_switch);
 }
 
 void S9xSetSoundMute(bool8 mute)
 {
+	bool8 was_muted = Settings.Mute;
+
 	Settings.Mute = mute || !spc::sound_enabled;
+
+	// Register writes weren't logged while muted
+	if (was_muted && !Settings.Mute)
+		SNES::dsp.flush();
 }
 
 void S9xToggleSoundChannel(int c)
@@ -136,7 +157,9 @@ void S9xDeinitAPU(void)
 void S9xAPUExecute(void)
 {
 	int cycles = (spc::ratio_numerator * (CPU.Cycles - spc::reference_time) + spc::remainder);
+	SNES::dsp.smp_time += cycles / spc::ratio_denominator;
 	SNES::smp.execute(cycles / spc::ratio_denominator);
+	SNES::dsp.publish(SNES::smp.clock);
 	spc::remainder = (cycles % spc::ratio_denominator);
 	spc::reference_time = CPU.Cycles;
 }
@@ -183,6 +206,7 @@ void S9xResetAPU(void)
 	spc::remainder = 0;
 
 	SNES::smp.power();
+	SNES::dsp.power();
 
 	S9xClearSamples();
 }
@@ -193,6 +217,7 @@ void S9xSoftResetAPU(void)
 	spc::remainder = 0;
 
 	SNES::smp.reset();
+	SNES::dsp.reset();
 
 	S9xClearSamples();
 }
@@ -202,7 +227,6 @@ void S9xAPUSaveState(uint8 *block)
 	uint8 *ptr = block;
 
 	SNES::smp.save_state(&ptr);
-	// SNES::dsp.save_state(&ptr);
 
 	SET_LE32(ptr, spc::reference_time);
 	ptr += sizeof(int32);
@@ -212,6 +236,8 @@ void S9xAPUSaveState(uint8 *block)
 	ptr += sizeof(int32);
 	memcpy(ptr, SNES::smp.registers, 4);
 	ptr += sizeof(int32);
+	// The DSP comes last, older states have zeroes here
+	SNES::dsp.save_state(&ptr);
 
 	memset(ptr, 0, SPC_SAVE_STATE_BLOCK_SIZE - (ptr - block));
 }
@@ -221,7 +247,6 @@ void S9xAPULoadState(uint8 *block)
 	uint8 *ptr = block;
 
 	SNES::smp.load_state(&ptr);
-	// SNES::dsp.load_state(&ptr);
 
 	spc::reference_time = GET_LE32(ptr);
 	ptr += sizeof(int32);
@@ -230,6 +255,8 @@ void S9xAPULoadState(uint8 *block)
 	// SNES::dsp.clock = GET_LE32(ptr);
 	ptr += sizeof(int32);
 	memcpy(SNES::smp.registers, ptr, 4);
+	ptr += sizeof(int32);
+	SNES::dsp.load_state(&ptr);
 }
 
 }
@@ -0,0 +1,645 @@
+#include <math.h>
+#include "../snes9x.h"
+#include "apu.h"
+
+namespace SNES
+{
+#include "smp.hpp"
+#include "sdsp.hpp"
+
+DSP dsp;
+
+#define CLAMP16(io) { if ((int16)(io) != (io)) (io) = ((io) >> 31) ^ 0x7FFF; }
+
+// Global registers
+enum
+{
+	r_mvoll = 0x0C, r_mvolr = 0x1C, r_evoll = 0x2C, r_evolr = 0x3C,
+	r_kon   = 0x4C, r_koff  = 0x5C, r_flg   = 0x6C, r_endx  = 0x7C,
+	r_efb   = 0x0D, r_pmon  = 0x2D, r_non   = 0x3D, r_eon   = 0x4D,
+	r_dir   = 0x5D, r_esa   = 0x6D, r_edl   = 0x7D, r_fir   = 0x0F,
+};
+
+// Voice registers
+enum
+{
+	v_voll = 0, v_volr, v_pitchl, v_pitchh, v_srcn, v_adsr0, v_adsr1, v_gain, v_envx, v_outx,
+};
+
+// Envelope and noise rates, in samples at 32kHz
+static const int simple_counter_range = 2048 * 5 * 3;
+
+static const uint16 counter_rates[32] =
+{
+	simple_counter_range + 1, // never fires
+	2048, 1536, 1280, 1024, 768, 640, 512, 384, 320, 256, 192, 160, 128, 96, 80,
+	64, 48, 40, 32, 24, 20, 16, 12, 10, 8, 6, 5, 4, 3, 2, 1
+};
+
+static const uint16 counter_offsets[32] =
+{
+	1, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536,
+	0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 0, 0
+};
+
+// 4-tap gaussian interpolation kernel. This is generated rather than copied from the
+// hardware ROM, it matches its shape and gain (taps sum to ~2048) but not every bit.
+static int16 gauss[512];
+
+// Decoded BRR blocks, indexed by address and validated against the raw bytes and
+// the two history samples the filters depend on.
+struct BrrCacheEntry
+{
+	uint16 addr;
+	int16 p1, p2;
+	uint8 raw[9];
+	bool valid;
+	int16 out[16];
+};
+
+static const int brr_cache_size = 256;
+static BrrCacheEntry *brr_cache;
+
+// p1 and p2 are the last two samples as stored in the voice buffer. Like the hardware, the
+// filters use the older one halved.
+static void decode_brr(const uint8 *block, int p1, int p2, int16 *out)
+{
+	int header = block[0];
+	int shift = header >> 4;
+	int filter = header & 0x0C;
+
+	p2 >>= 1;
+
+	for (int i = 0; i < 16; i++)
+	{
+		int s = (int16)(block[1 + (i >> 1)] << (8 + ((i & 1) << 2))) >> 12;
+
+		s = (s << shift) >> 1;
+		if (shift >= 0xD)
+			s = (s >> 25) << 11; // -2048 or 0
+
+		if (filter == 0x04)
+		{
+			s += p1 >> 1;
+			s += (-p1) >> 5;
+		}
+		else if (filter == 0x08)
+		{
+			s += p1;
+			s -= p2;
+			s += p2 >> 4;
+			s += (p1 * -3) >> 6;
+		}
+		else if (filter == 0x0C)
+		{
+			s += p1;
+			s -= p2;
+			s += (p1 * -13) >> 7;
+			s += (p2 * 3) >> 4;
+		}
+
+		CLAMP16(s);
+		s = (int16)(s * 2);
+
+		p2 = p1 >> 1;
+		p1 = s;
+		out[i] = s;
+	}
+}
+
+void DSP::power()
+{
+	for (int i = 0; i < 512; i++)
+	{
+		double x = (512 - i) / 256.0;
+		gauss[i] = (int16)(1295.0 * exp(-x * x / 0.796) + 0.5);
+	}
+
+	memset(&m, 0, sizeof(m));
+	memset(regs, 0, sizeof(regs));
+	smp_time = 0;
+	reset();
+}
+
+void DSP::reset()
+{
+	for (int i = 0; i < 8; i++)
+	{
+		m.voice[i].env_mode = env_release;
+		m.voice[i].env = 0;
+		m.voice[i].kon_delay = 0;
+	}
+
+	m.regs[r_flg] = regs[r_flg] = 0xE0;
+	m.noise = 0x4000;
+	m.counter = 0;
+	m.every_other = 1;
+	m.echo_offset = 0;
+	m.echo_length = 0;
+	m.kon = m.new_kon = 0;
+
+	flush();
+}
+
+void DSP::flush()
+{
+	// Pending writes are dropped, and none are logged while muted, but regs always has
+	// the latest values. The mixer must not resume with stale registers.
+	memcpy(m.regs, regs, sizeof(m.regs));
+	log_head = log_tail = 0;
+	ready_time = mix_time = smp_time;
+}
+
+uint8 DSP::read(unsigned addr)
+{
+	return regs[addr & 0x7F];
+}
+
+void DSP::write(unsigned addr, uint8 data, int32 smp_clock)
+{
+	regs[addr] = data;
+
+	// ENDX is cleared by a key on or any write, the SMP must see that immediately
+	if (addr == r_kon)
+		regs[r_endx] &= ~data;
+	else if (addr == r_endx)
+		regs[r_endx] = 0;
+
+	// Nothing is mixing, flush() will bring the mixer up to date when sound comes back
+	if (Settings.Mute)
+		return;
+
+	// The log is full, give the mixer what it needs to drain it
+	if (log_head - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE) >= log_size)
+	{
+		publish(smp_clock);
+		while (log_head - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE) >= log_size)
+			if (callback) callback(callback_data);
+	}
+
+	Write *w = &log[log_head & (log_size - 1)];
+	w->time = smp_time + smp_clock;
+	w->addr = addr;
+	w->data = data;
+	__atomic_store_n(&log_head, log_head + 1, __ATOMIC_RELEASE);
+
+	if ((log_head & (log_size / 2 - 1)) == 0 && callback)
+		callback(callback_data);
+}
+
+void DSP::publish(int32 smp_clock)
+{
+	__atomic_store_n(&ready_time, smp_time + smp_clock, __ATOMIC_RELEASE);
+}
+
+int DSP::available()
+{
+	int period = (Settings.SoundPlaybackRate <= 16000) ? 64 : 32;
+	int32 pending = __atomic_load_n(&ready_time, __ATOMIC_ACQUIRE) - mix_time;
+
+	// The mixer fell far behind (audio was muted, or the task starved), skip ahead
+	// rather than play back a long burst of stale audio.
+	if (pending > 32 * 8000)
+	{
+		while (log_tail != __atomic_load_n(&log_head, __ATOMIC_ACQUIRE))
+		{
+			Write *w = &log[log_tail & (log_size - 1)];
+			apply(w->addr, w->data);
+			__atomic_store_n(&log_tail, log_tail + 1, __ATOMIC_RELEASE);
+		}
+		memcpy(m.regs, regs, sizeof(m.regs));
+		mix_time += pending;
+		pending = 0;
+	}
+
+	return pending > 0 ? pending / period : 0;
+}
+
+void DSP::set_mute_mask(uint8 mask)
+{
+	mute_mask = mask;
+}
+
+void DSP::set_callback(void (*callback)(void *), void *data)
+{
+	this->callback = callback;
+	this->callback_data = data;
+}
+
+void DSP::apply(unsigned addr, uint8 data)
+{
+	m.regs[addr] = data;
+
+	if (addr == r_kon)
+		m.new_kon = data;
+	else if (addr == r_endx)
+		m.endx = regs[r_endx] = 0;
+}
+
+void DSP::key_on(Voice &v, int vbit)
+{
+	const uint8 *entry = &smp.apuram[(m.regs[r_dir] * 0x100 + m.regs[(&v - m.voice) * 0x10 + v_srcn] * 4) & 0xFFFF];
+
+	v.brr_addr = GET_LE16(entry);
+	v.buf[16] = v.buf[17] = v.buf[18] = 0;
+	v.kon_delay = 5;
+	v.env_mode = env_attack;
+	v.env = 0;
+	v.hidden_env = 0;
+	m.endx &= ~vbit;
+	next_block(v, vbit);
+	v.interp_pos = 0;
+}
+
+void DSP::next_block(Voice &v, int vbit)
+{
+	uint8 block[9];
+	int addr = v.brr_addr;
+
+	for (int i = 0; i < 9; i++)
+		block[i] = smp.apuram[(addr + i) & 0xFFFF];
+
+	v.buf[0] = v.buf[16];
+	v.buf[1] = v.buf[17];
+	v.buf[2] = v.buf[18];
+
+	int p1 = v.buf[18], p2 = v.buf[17];
+
+	if (brr_cache)
+	{
+		BrrCacheEntry *entry = &brr_cache[((addr * 0x9E3779B1u) >> 24) & (brr_cache_size - 1)];
+		if (!entry->valid || entry->addr != addr || entry->p1 != p1 || entry->p2 != p2
+			|| memcmp(entry->raw, block, 9) != 0)
+		{
+			decode_brr(block, p1, p2, entry->out);
+			memcpy(entry->raw, block, 9);
+			entry->addr = addr;
+			entry->p1 = p1;
+			entry->p2 = p2;
+			entry->valid = true;
+		}
+		memcpy(&v.buf[3], entry->out, sizeof(entry->out));
+	}
+	else
+	{
+		decode_brr(block, p1, p2, &v.buf[3]);
+	}
+
+	if (block[0] & 1) // End of sample
+	{
+		const uint8 *entry = &smp.apuram[(m.regs[r_dir] * 0x100 + m.regs[(&v - m.voice) * 0x10 + v_srcn] * 4 + 2) & 0xFFFF];
+		v.brr_addr = GET_LE16(entry);
+		m.endx |= vbit;
+		if (!(block[0] & 2)) // No loop, the voice is silenced right away
+		{
+			v.env_mode = env_release;
+			v.env = 0;
+		}
+	}
+	else
+	{
+		v.brr_addr = addr + 9;
+	}
+}
+
+void DSP::run_envelope(Voice &v, int vbit)
+{
+	const uint8 *vregs = &m.regs[(&v - m.voice) * 0x10];
+	int env = v.env;
+
+	if (v.env_mode == env_release)
+	{
+		if ((env -= 0x8) < 0)
+			env = 0;
+		v.env = env;
+		return;
+	}
+
+	int rate;
+	int env_data = vregs[v_adsr1];
+
+	if (vregs[v_adsr0] & 0x80) // ADSR
+	{
+		if (v.env_mode >= env_decay)
+		{
+			env--;
+			env -= env >> 8;
+			rate = env_data & 0x1F;
+			if (v.env_mode == env_decay)
+				rate = (vregs[v_adsr0] >> 3 & 0x0E) + 0x10;
+		}
+		else // env_attack
+		{
+			rate = (vregs[v_adsr0] & 0x0F) * 2 + 1;
+			env += rate < 31 ? 0x20 : 0x400;
+		}
+	}
+	else // GAIN
+	{
+		env_data = vregs[v_gain];
+		int mode = env_data >> 5;
+		if (mode < 4) // Direct
+		{
+			env = env_data * 0x10;
+			rate = 31;
+		}
+		else
+		{
+			rate = env_data & 0x1F;
+			if (mode == 4) // Linear decrease
+			{
+				env -= 0x20;
+			}
+			else if (mode < 6) // Exponential decrease
+			{
+				env--;
+				env -= env >> 8;
+			}
+			else // Linear increase, two slopes for mode 7
+			{
+				env += 0x20;
+				if (mode > 6 && (unsigned)v.hidden_env >= 0x600)
+					env += 0x8 - 0x20;
+			}
+		}
+	}
+
+	// Sustain level
+	if ((env >> 8) == (env_data >> 5) && v.env_mode == env_decay)
+		v.env_mode = env_sustain;
+
+	v.hidden_env = env;
+
+	// Linear decrease going negative also ends up here
+	if ((unsigned)env > 0x7FF)
+	{
+		env = (env < 0 ? 0 : 0x7FF);
+		if (v.env_mode == env_attack)
+			v.env_mode = env_decay;
+	}
+
+	if (((unsigned)m.counter + counter_offsets[rate]) % counter_rates[rate] == 0)
+		v.env = env;
+}
+
+// One 32kHz tick of everything that isn't resampling: counters, noise, key on/off and envelopes
+void DSP::run_control()
+{
+	if (--m.counter < 0)
+		m.counter = simple_counter_range - 1;
+
+	int noise_rate = m.regs[r_flg] & 0x1F;
+	if (((unsigned)m.counter + counter_offsets[noise_rate]) % counter_rates[noise_rate] == 0)
+	{
+		int feedback = (m.noise << 13) ^ (m.noise << 14);
+		m.noise = (feedback & 0x4000) ^ (m.noise >> 1);
+	}
+
+	// KON and KOFF are only sampled every other tick
+	int kon = 0;
+	if ((m.every_other ^= 1) != 0)
+	{
+		m.new_kon &= ~m.kon;
+		m.kon = kon = m.new_kon;
+		m.koff = m.regs[r_koff];
+	}
+
+	for (int i = 0, vbit = 1; i < 8; i++, vbit <<= 1)
+	{
+		Voice &v = m.voice[i];
+
+		if (kon & vbit)
+			key_on(v, vbit);
+
+		if (m.koff & vbit)
+			v.env_mode = env_release;
+
+		if (m.regs[r_flg] & 0x80) // Soft reset
+		{
+			v.env_mode = env_release;
+			v.env = 0;
+		}
+
+		if (v.kon_delay)
+			v.kon_delay--;
+		else
+			run_envelope(v, vbit);
+	}
+}
+
+int DSP::interpolate(const Voice &v, int method)
+{
+	const int16 *in = &v.buf[v.interp_pos >> 12];
+	int out;
+
+	if (method == DSP_INTERPOLATION_GAUSSIAN)
+	{
+		int offset = (v.interp_pos >> 4) & 0xFF;
+		const int16 *fwd = gauss + 255 - offset;
+		const int16 *rev = gauss + offset;
+
+		out  = (fwd[0]   * in[0]) >> 11;
+		out += (fwd[256] * in[1]) >> 11;
+		out += (rev[256] * in[2]) >> 11;
+		out = (int16)out;
+		out += (rev[0]   * in[3]) >> 11;
+		CLAMP16(out);
+	}
+	else if (method == DSP_INTERPOLATION_LINEAR)
+	{
+		out = in[1] + (((in[2] - in[1]) * (v.interp_pos & 0xFFF)) >> 12);
+	}
+	else
+	{
+		out = in[1];
+	}
+
+	return out & ~1;
+}
+
+void DSP::run_sample(int16 *out, int step)
+{
+	const int method = Settings.InterpolationMethod;
+	const bool echo = Settings.SoundEcho;
+	int main_l = 0, main_r = 0;
+	int echo_l = 0, echo_r = 0;
+	int prev_out = 0;
+
+	for (int i = 0; i < step; i++)
+		run_control();
+
+	for (int i = 0, vbit = 1; i < 8; i++, vbit <<= 1)
+	{
+		Voice &v = m.voice[i];
+		uint8 *vregs = &m.regs[i * 0x10];
+		int pitch = ((vregs[v_pitchh] & 0x3F) << 8) | vregs[v_pitchl];
+		int output = 0;
+
+		if ((m.regs[r_pmon] & vbit) && i > 0)
+			pitch += ((prev_out >> 5) * pitch) >> 10;
+
+		if (!v.kon_delay)
+		{
+			int sample = (m.regs[r_non] & vbit) ? (int16)(m.noise * 2) : interpolate(v, method);
+			output = ((sample * v.env) >> 11) & ~1;
+
+			v.interp_pos += pitch * step;
+			while (v.interp_pos >= (16 << 12))
+			{
+				v.interp_pos -= 16 << 12;
+				next_block(v, vbit);
+			}
+		}
+
+		regs[i * 0x10 + v_envx] = m.regs[i * 0x10 + v_envx] = v.env >> 4;
+		regs[i * 0x10 + v_outx] = m.regs[i * 0x10 + v_outx] = output >> 8;
+		prev_out = output;
+
+		if (mute_mask & vbit)
+			continue;
+
+		int l = (output * (int8)vregs[v_voll]) >> 7;
+		int r = (output * (int8)vregs[v_volr]) >> 7;
+
+		main_l += l;
+		main_r += r;
+		CLAMP16(main_l);
+		CLAMP16(main_r);
+
+		if (m.regs[r_eon] & vbit)
+		{
+			echo_l += l;
+			echo_r += r;
+			CLAMP16(echo_l);
+			CLAMP16(echo_r);
+		}
+	}
+
+	regs[r_endx] |= m.endx;
+	m.endx = 0;
+
+	main_l = (main_l * (int8)m.regs[r_mvoll]) >> 7;
+	main_r = (main_r * (int8)m.regs[r_mvolr]) >> 7;
+
+	if (echo)
+	{
+		uint8 *echo_ptr = &smp.apuram[(m.regs[r_esa] * 0x100 + m.echo_offset) & 0xFFFF];
+
+		if (m.echo_offset == 0)
+			m.echo_length = (m.regs[r_edl] & 0x0F) * 0x800;
+
+		// The history is kept oldest first, the FIR taps are applied newest last
+		memmove(&m.echo_hist[0], &m.echo_hist[1], sizeof(m.echo_hist[0]) * 7);
+		m.echo_hist[7][0] = (int16)GET_LE16(echo_ptr) >> 1;
+		m.echo_hist[7][1] = (int16)GET_LE16(echo_ptr + 2) >> 1;
+
+		int fir_l = 0, fir_r = 0;
+		for (int i = 0; i < 7; i++)
+		{
+			fir_l += (m.echo_hist[i][0] * (int8)m.regs[r_fir + i * 0x10]) >> 6;
+			fir_r += (m.echo_hist[i][1] * (int8)m.regs[r_fir + i * 0x10]) >> 6;
+		}
+		fir_l = (int16)fir_l + ((m.echo_hist[7][0] * (int8)m.regs[r_fir + 0x70]) >> 6);
+		fir_r = (int16)fir_r + ((m.echo_hist[7][1] * (int8)m.regs[r_fir + 0x70]) >> 6);
+		CLAMP16(fir_l);
+		CLAMP16(fir_r);
+		fir_l &= ~1;
+		fir_r &= ~1;
+
+		main_l += (fir_l * (int8)m.regs[r_evoll]) >> 7;
+		main_r += (fir_r * (int8)m.regs[r_evolr]) >> 7;
+
+		if (!(m.regs[r_flg] & 0x20))
+		{
+			echo_l += (fir_l * (int8)m.regs[r_efb]) >> 7;
+			echo_r += (fir_r * (int8)m.regs[r_efb]) >> 7;
+			CLAMP16(echo_l);
+			CLAMP16(echo_r);
+		}
+
+		// At a reduced rate each sample stands for several 32kHz slots of the buffer
+		for (int i = 0; i < step; i++)
+		{
+			if (!(m.regs[r_flg] & 0x20))
+			{
+				echo_ptr = &smp.apuram[(m.regs[r_esa] * 0x100 + m.echo_offset) & 0xFFFF];
+				SET_LE16(echo_ptr, echo_l & ~1);
+				SET_LE16(echo_ptr + 2, echo_r & ~1);
+			}
+			m.echo_offset += 4;
+			if (m.echo_offset >= (m.echo_length ? m.echo_length : 4))
+			{
+				m.echo_offset = 0;
+				break;
+			}
+		}
+	}
+
+	CLAMP16(main_l);
+	CLAMP16(main_r);
+
+	if (m.regs[r_flg] & 0x40) // Mute
+		main_l = main_r = 0;
+
+	if (Settings.ReverseStereo)
+	{
+		out[0] = main_r;
+		out[1] = main_l;
+	}
+	else if (Settings.Stereo)
+	{
+		out[0] = main_l;
+		out[1] = main_r;
+	}
+	else
+	{
+		out[0] = out[1] = (main_l + main_r) >> 1;
+	}
+}
+
+void DSP::mix(int16 *out, int count)
+{
+	int step = (Settings.SoundPlaybackRate <= 16000) ? 2 : 1;
+
+	if (Settings.SoundBRRCache && !brr_cache)
+		brr_cache = (BrrCacheEntry *)calloc(brr_cache_size, sizeof(BrrCacheEntry));
+	else if (!Settings.SoundBRRCache && brr_cache)
+		free(brr_cache), brr_cache = NULL;
+
+	for (int i = 0; i < count; i++, out += 2)
+	{
+		// Apply the register writes that happened before this sample
+		while (log_tail != __atomic_load_n(&log_head, __ATOMIC_ACQUIRE))
+		{
+			Write *w = &log[log_tail & (log_size - 1)];
+			if ((int32)(w->time - mix_time) > 0)
+				break;
+			apply(w->addr, w->data);
+			__atomic_store_n(&log_tail, log_tail + 1, __ATOMIC_RELEASE);
+		}
+
+		run_sample(out, step);
+		mix_time += 32 * step;
+	}
+}
+
+void DSP::save_state(uint8 **block)
+{
+	memcpy(*block, &m, sizeof(m));
+	*block += sizeof(m);
+}
+
+void DSP::load_state(uint8 **block)
+{
+	memcpy(&m, *block, sizeof(m));
+	*block += sizeof(m);
+
+	// Save states from before the DSP was emulated have nothing here
+	if (m.noise == 0)
+		power();
+
+	memcpy(regs, m.regs, sizeof(regs));
+	flush();
+}
+
+} // namespace SNES
@@ -0,0 +1,86 @@
+// S-DSP: 8 BRR voices with ADSR/GAIN envelopes, noise, pitch modulation and echo.
+//
+// The SMP side only updates a register shadow and logs timestamped writes, the
+// samples are produced by mix() which is meant to run on another core.
+
+class DSP
+{
+public:
+	uint8 regs[128];   // Registers as seen by the SMP
+	uint32 smp_time;   // SMP clock at the end of the current smp.execute()
+
+	void power();
+	void reset();
+	void flush();
+
+	uint8 read(unsigned addr);
+	void write(unsigned addr, uint8 data, int32 smp_clock);
+	void publish(int32 smp_clock);
+
+	int available();
+	void mix(int16 *out, int count);
+	void set_mute_mask(uint8 mask);
+	void set_callback(void (*callback)(void *), void *data);
+
+	void load_state(uint8 **);
+	void save_state(uint8 **);
+
+private:
+	enum { env_release, env_attack, env_decay, env_sustain };
+
+	struct Voice
+	{
+		int16 buf[3 + 16]; // Last 3 samples of the previous block, then the current block
+		int32 interp_pos;  // 4.12 position within the current block
+		int32 env;
+		int32 hidden_env;
+		uint16 brr_addr;
+		uint8 kon_delay;
+		uint8 env_mode;
+	};
+
+	// Everything the mixer owns, saved as-is in save states
+	struct State
+	{
+		uint8 regs[128];
+		Voice voice[8];
+		int16 echo_hist[8][2];
+		uint16 echo_offset;
+		uint16 echo_length;
+		int32 counter;
+		int32 noise;
+		uint8 every_other;
+		uint8 kon;
+		uint8 new_kon;
+		uint8 koff;
+		uint8 endx;
+	} m;
+
+	struct Write
+	{
+		uint32 time;
+		uint8 addr;
+		uint8 data;
+	};
+
+	static const int log_size = 1024; // Must be a power of two
+	Write log[log_size];
+	uint32 log_head, log_tail;
+
+	uint32 ready_time; // SMP clock up to which the log is complete
+	uint32 mix_time;   // SMP clock of the next sample to mix
+	uint8 mute_mask;   // Set by the frontend, kept across power()
+
+	void (*callback)(void *);
+	void *callback_data;
+
+	void apply(unsigned addr, uint8 data);
+	void run_control();
+	void run_envelope(Voice &v, int vbit);
+	void key_on(Voice &v, int vbit);
+	void next_block(Voice &v, int vbit);
+	int interpolate(const Voice &v, int method);
+	void run_sample(int16 *out, int step);
+};
+
+extern DSP dsp;
@@ -3,6 +3,7 @@
 namespace SNES
 {
 #include "smp.hpp"
+#include "sdsp.hpp"
 
 SMP smp;
 
@@ -183,7 +184,7 @@ IRAM_ATTR unsigned SMP::op_read(unsigned addr)
 		case 0xf2:
 			return status.dsp_addr;
 		case 0xf3:
-			return 0; // dsp.read(status.dsp_addr & 0x7f);
+			return dsp.read(status.dsp_addr & 0x7f);
 		case 0xf4:
 		case 0xf5:
 		case 0xf6:
@@ -277,7 +278,7 @@ IRAM_ATTR void SMP::op_write(unsigned addr, uint8 data)
 		case 0xf3:
 			if (status.dsp_addr & 0x80)
 				break;
-			// dsp.write(status.dsp_addr, data);
+			dsp.write(status.dsp_addr, data, clock);
 			break;
 
 		case 0xf4:
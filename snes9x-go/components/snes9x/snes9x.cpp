@@ -7,6 +7,7 @@
 #include "snes9x.h"
 #include "memmap.h"
 #include "controls.h"
+#include "apu/apu.h"
 
 struct SSettings Settings;
 char String[513];
@@ -23,6 +24,9 @@ void S9xInitSettings(void)
 	Settings.SoundInputRate             =  31950;
 	Settings.Mute                       =  false;
 	Settings.DynamicRateLimit           =  5;
+	Settings.InterpolationMethod        =  DSP_INTERPOLATION_GAUSSIAN;
+	Settings.SoundEcho                  =  true;
+	Settings.SoundBRRCache              =  false;
 
 	// Display
 	Settings.Transparency               =  true;
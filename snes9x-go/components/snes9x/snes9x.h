@@ -201,6 +201,9 @@ struct SSettings
 	bool8	ReverseStereo;
 	bool8	Mute;
 	int32	DynamicRateLimit;
+	int32	InterpolationMethod;
+	bool8	SoundEcho;
+	bool8	SoundBRRCache;
 
 	bool8	SupportHiRes;
 	bool8	Transparency;
@@ -1,3 +1,5 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <rg_system.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -15,23 +17,26 @@
 
 #include "keymap.h"
 
-#define AUDIO_SAMPLE_RATE (22050)
+#define AUDIO_SAMPLE_RATE (32000)
 #define AUDIO_BUFFER_LENGTH (AUDIO_SAMPLE_RATE / 50)
 
-// static short audioBuffer[AUDIO_BUFFER_LENGTH * 2];
+static rg_audio_sample_t audioBuffer[AUDIO_BUFFER_LENGTH];
+static SemaphoreHandle_t audio_wake;
+static SemaphoreHandle_t audio_lock;
+static int audio_mode = 1;
 
 static rg_video_update_t updates[2];
 static rg_video_update_t *currentUpdate = &updates[0];
 
 static rg_app_t *app;
 
-static uint32_t frames_counter = 0;
 
 static int keymap_id = 0;
 static keymap_t keymap;
 
 static const char *SETTING_NOTIFIED = "notified";
 static const char *SETTING_KEYMAP = "keymap";
+static const char *SETTING_AUDIO = "audio";
 // --- MAIN
 
 
@@ -76,6 +81,72 @@ void S9xExit(void)
 	exit(0);
 }
 
+static void audio_samples_cb(void *arg)
+{
+	xSemaphoreGive(audio_wake);
+}
+
+static void audio_task(void *arg)
+{
+	while (1)
+	{
+		xSemaphoreTake(audio_wake, portMAX_DELAY);
+
+		while (!Settings.Mute)
+		{
+			xSemaphoreTake(audio_lock, portMAX_DELAY);
+			int count = RG_MIN(S9xGetSampleCount(), AUDIO_BUFFER_LENGTH * 2);
+			if (count > 0)
+				S9xMixSamples((uint8 *)audioBuffer, count);
+			xSemaphoreGive(audio_lock);
+
+			if (count <= 0)
+				break;
+
+			rg_audio_submit(audioBuffer, count / 2);
+		}
+	}
+}
+
+static void update_audio_mode(int mode)
+{
+	xSemaphoreTake(audio_lock, portMAX_DELAY);
+
+	audio_mode = mode % 3;
+
+	// Fast halves the DSP rate and drops the costliest stages, Full is the real thing
+	Settings.Mute = (audio_mode == 0);
+	Settings.SoundPlaybackRate = (audio_mode == 1) ? AUDIO_SAMPLE_RATE / 2 : AUDIO_SAMPLE_RATE;
+	Settings.InterpolationMethod = (audio_mode == 1) ? DSP_INTERPOLATION_LINEAR : DSP_INTERPOLATION_GAUSSIAN;
+	Settings.SoundEcho = (audio_mode != 1);
+	Settings.SoundBRRCache = (audio_mode == 1);
+
+	rg_audio_set_sample_rate(Settings.SoundPlaybackRate);
+	S9xClearSamples();
+
+	xSemaphoreGive(audio_lock);
+}
+
+static rg_gui_event_t audio_mode_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+	int mode = audio_mode;
+
+	if (event == RG_DIALOG_PREV) mode = mode > 0 ? mode - 1 : 2;
+	if (event == RG_DIALOG_NEXT) mode = mode < 2 ? mode + 1 : 0;
+
+	if (mode != audio_mode)
+	{
+		update_audio_mode(mode);
+		rg_settings_set_number(NS_APP, SETTING_AUDIO, mode);
+	}
+
+	if (mode == 0) strcpy(option->value, "Off ");
+	if (mode == 1) strcpy(option->value, "Fast");
+	if (mode == 2) strcpy(option->value, "Full");
+
+	return RG_DIALOG_VOID;
+}
+
 static void update_keymap(int id)
 {
 	keymap_id = id % KEYMAPS_COUNT;
@@ -167,13 +238,18 @@ static bool screenshot_handler(const char *filename, int width, int height)
 
 static bool save_state_handler(const char *filename)
 {
-	return S9xFreezeGame(filename) == SUCCESS;
+	xSemaphoreTake(audio_lock, portMAX_DELAY);
+	bool ret = S9xFreezeGame(filename) == SUCCESS;
+	xSemaphoreGive(audio_lock);
+	return ret;
 }
 
 static bool load_state_handler(const char *filename)
 {
 	bool ret = false;
 
+	xSemaphoreTake(audio_lock, portMAX_DELAY);
+
 	if (access(filename, F_OK) == 0)
 	{
 		ret = S9xUnfreezeGame(filename) == SUCCESS;
@@ -183,16 +259,22 @@ static bool load_state_handler(const char *filename)
 		S9xReset();
 	}
 
+	xSemaphoreGive(audio_lock);
+
 	return ret;
 }
 
 static bool reset_handler(bool hard)
 {
+	xSemaphoreTake(audio_lock, portMAX_DELAY);
+
 	if (hard)
 		S9xReset();
 	else
 		S9xSoftReset();
 
+	xSemaphoreGive(audio_lock);
+
     return true;
 }
 
@@ -209,6 +291,7 @@ extern "C" void app_main(void)
 	};
 	const rg_gui_option_t options[] = {
 		{2, "Controls", (char*)"", 1, &menu_keymap_cb},
+		{3, "Audio", (char*)"", 1, &audio_mode_cb},
 		RG_DIALOG_CHOICE_LAST
 	};
 
@@ -223,10 +306,9 @@ extern "C" void app_main(void)
 
 	S9xInitSettings();
 
-	Settings.Stereo = FALSE;
+	Settings.Stereo = TRUE;
 	Settings.SoundPlaybackRate = AUDIO_SAMPLE_RATE;
 	Settings.SoundSync = FALSE;
-	Settings.Mute = TRUE;
 	Settings.Transparency = TRUE;
 	Settings.SkipFrames = 0;
 	Settings.Paused = FALSE;
@@ -235,12 +317,19 @@ extern "C" void app_main(void)
 
 	update_keymap(rg_settings_get_number(NS_APP, SETTING_KEYMAP, 0));
 
+	audio_wake = xSemaphoreCreateBinary();
+	audio_lock = xSemaphoreCreateMutex();
+	update_audio_mode(rg_settings_get_number(NS_APP, SETTING_AUDIO, 1));
+
 	if (!S9xMemoryInit())
 		RG_PANIC("Memory init failed!");
 
 	if (!S9xSoundInit(0))
 		RG_PANIC("Sound init failed!");
 
+	S9xSetSamplesAvailableCallback(&audio_samples_cb, NULL);
+	rg_task_create("snes_audio", &audio_task, NULL, 2048, 7, 1);
+
 	if (!S9xGraphicsInit())
 		RG_PANIC("Graphics init failed!");
 
@@ -255,7 +344,7 @@ extern "C" void app_main(void)
 	// Do this last to make sure the user sees it only the first time a game is about to start
 	if (!rg_settings_get_number(NS_APP, SETTING_NOTIFIED, 0))
 	{
-		rg_gui_alert("Important!", "SNES support is experimental.\nIt is slow and has no sound.");
+		rg_gui_alert("Important!", "SNES support is experimental.\nIt is slow, set Audio to Fast or Off\nin the options if games lag.");
 		rg_settings_set_number(NS_APP, SETTING_NOTIFIED, 1);
 		rg_settings_commit();
 	}
@@ -298,6 +387,7 @@ extern "C" void app_main(void)
 		}
 
 		S9xMainLoop();
+		xSemaphoreGive(audio_wake);
 
 		long elapsed = rg_system_timer() - startTime;
 
@@ -310,7 +400,7 @@ extern "C" void app_main(void)
 
 		rg_system_tick(elapsed);
 
-		IPPU.RenderThisFrame = (((++frames_counter) & 3) == 3);
+		IPPU.RenderThisFrame = rg_system_schedule_frame();
 		GFX.Screen = (uint16*)currentUpdate->buffer;
 	}
 }